@@ -0,0 +1,1351 @@
+//Benchmarks for the vector math, terrain, image and model loaders, model
+//processing code and the BVH.  "make bench" builds this and prints the
+//results as one JSON object, with a record per benchmark and input size,
+//always in the same order, so that runs can be diffed between commits.
+//Every input is generated, from fixed seeds.  Where a kernel has a
+//SIMD/threaded version, it is also timed against the plain single
+//threaded version and the largest difference between their results is
+//reported.  Checks that fail are reported on stderr, and make the
+//benchmark exit with status 1.
+//
+//Usage: benchmark [--reps=N] [--warmup=N] [--filter=name]
+
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <iterator>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "glm.cpp"
+#include "imageloader.cpp"
+#include "texcache.cpp"
+#include "bvh.cpp"
+#include "vec3farray.cpp"
+#include "terrain.cpp"
+#include "game.cpp"
+
+using namespace std;
+
+int reps = 15;
+int warmup = 3;
+string filter;
+vector<string> records;
+bool failed = false; //Whether a result check failed
+
+struct Timing {
+	double min; //Milliseconds
+	double median;
+	double mean;
+};
+
+//Calls setup() and then fn() warmup + reps times, and returns how long
+//the last reps calls to fn() took.  setup() is not timed.
+template<class Setup, class F>
+Timing timeRuns(Setup setup, F fn) {
+	vector<double> times;
+	for(int i = 0; i < warmup + reps; i++) {
+		setup();
+		chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+		fn();
+		chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+		if (i >= warmup) {
+			times.push_back(chrono::duration<double, milli>(t1 - t0).count());
+		}
+	}
+
+	Timing t;
+	sort(times.begin(), times.end());
+	t.min = times[0];
+	t.median = times[times.size() / 2];
+	t.mean = 0;
+	for(size_t i = 0; i < times.size(); i++) {
+		t.mean += times[i] / times.size();
+	}
+	return t;
+}
+
+template<class F>
+Timing timeRuns(F fn) {
+	return timeRuns([] {}, fn);
+}
+
+bool wanted(const char* name) {
+	return filter.empty() || string(name).find(filter) != string::npos;
+}
+
+//Adds a record for one benchmark run.  If scalar is not NULL, it is the
+//timing of the reference version and maxDiff is how far apart the two
+//versions' results were.  extra is appended to the record as is.
+void report(const char* name, size_t size, const Timing &t,
+			const Timing* scalar = NULL, double maxDiff = 0,
+			const char* extra = "") {
+	char buf[512];
+	int n = snprintf(buf, sizeof(buf),
+					 "{\"name\": \"%s\", \"size\": %zu, \"reps\": %d, "
+					 "\"min_ms\": %.4f, \"median_ms\": %.4f, \"mean_ms\": %.4f",
+					 name, size, reps, t.min, t.median, t.mean);
+	if (scalar != NULL) {
+		n += snprintf(buf + n, sizeof(buf) - n,
+					  ", \"scalar_median_ms\": %.4f, \"speedup\": %.2f, "
+					  "\"max_diff\": %g",
+					  scalar->median, scalar->median / t.median, maxDiff);
+	}
+	snprintf(buf + n, sizeof(buf) - n, "%s}", extra);
+	records.push_back(buf);
+}
+
+double maxDiff(const GLfloat* a, const GLfloat* b, size_t count) {
+	double d = 0;
+	for(size_t i = 0; i < count; i++) {
+		d = max(d, (double)fabs(a[i] - b[i]));
+	}
+	return d;
+}
+
+//Writes a bumpy torus with nu * nv vertices and twice as many triangles
+//to a temporary OBJ file, and returns its name.  With seams, the vertices
+//where the torus wraps around are written twice, the way texture seams
+//leave them, making (nu + 1) * (nv + 1) in all for glmWeld to merge.
+//With groups, the triangles of each half of the torus are in a group of
+//their own.
+string writeTorusOBJ(int nu, int nv, bool seams = false,
+					 bool groups = false) {
+	char name[] = "/tmp/glmbenchXXXXXX";
+	int fd = mkstemp(name);
+	FILE* file = fdopen(fd, "w");
+	int su = seams ? nu + 1 : nu;
+	int sv = seams ? nv + 1 : nv;
+	for(int i = 0; i < su; i++) {
+		for(int j = 0; j < sv; j++) {
+			float u = 2 * M_PI * (i % nu) / nu;
+			float v = 2 * M_PI * (j % nv) / nv;
+			float r = 0.4f + 0.02f * sinf(7 * u) * cosf(5 * v);
+			fprintf(file, "v %f %f %f\n", (1 + r * cosf(v)) * cosf(u) + 3,
+					r * sinf(v) - 1, (1 + r * cosf(v)) * sinf(u) + 0.5f);
+		}
+	}
+	for(int i = 0; i < nu; i++) {
+		if (groups && (i == 0 || i == nu / 2)) {
+			fprintf(file, "g half%d\n", i == 0 ? 1 : 2);
+		}
+		for(int j = 0; j < nv; j++) {
+			int i2 = seams ? i + 1 : (i + 1) % nu;
+			int j2 = seams ? j + 1 : (j + 1) % nv;
+			int a = i * sv + j + 1;
+			int b = i2 * sv + j + 1;
+			int c = i2 * sv + j2 + 1;
+			int d = i * sv + j2 + 1;
+			fprintf(file, "f %d %d %d\nf %d %d %d\n", a, b, c, a, c, d);
+		}
+	}
+	fclose(file);
+	return name;
+}
+
+//Returns the torus of writeTorusOBJ, read back through glmReadOBJ
+GLMmodel* makeTorus(int nu, int nv, bool seams = false,
+					bool groups = false) {
+	string name = writeTorusOBJ(nu, nv, seams, groups);
+	GLMmodel* model = glmReadOBJ((char*)name.c_str());
+	unlink(name.c_str());
+	return model;
+}
+
+//The plain version of glmUnitize, built from the scalar kernels
+void unitizeScalar(GLMmodel* model) {
+	GLfloat min[3], max[3], center[3];
+	for(int j = 0; j < 3; j++) {
+		min[j] = max[j] = model->vertices[3 + j];
+	}
+	glmBoundsScalar(model->vertices, 1, model->numvertices + 1, min, max);
+	GLfloat w = glmAbs(max[0]) + glmAbs(min[0]);
+	GLfloat h = glmAbs(max[1]) + glmAbs(min[1]);
+	GLfloat d = glmAbs(max[2]) + glmAbs(min[2]);
+	for(int j = 0; j < 3; j++) {
+		center[j] = (max[j] + min[j]) / 2.0;
+	}
+	GLfloat scale = 2.0 / glmMax(glmMax(w, h), d);
+	glmTransformScalar(model->vertices, 1, model->numvertices + 1, center,
+					   scale);
+}
+
+//The plain version of glmFacetNormals
+void facetNormalsScalar(GLMmodel* model) {
+	glmFreeArray(model, model->facetnorms);
+	model->numfacetnorms = model->numtriangles;
+	model->facetnorms = (GLfloat*)malloc(sizeof(GLfloat) *
+										 3 * (model->numfacetnorms + 1));
+	glmFacetNormalsScalar(model->vertices, model->numvertices,
+						  model->triangles, model->facetnorms, 0,
+						  model->numtriangles);
+}
+
+//The plain version of glmLinearTexture
+void linearTextureScalar(GLMmodel* model) {
+	GLfloat min[3], max[3], dims[3];
+	glmFreeArray(model, model->texcoords);
+	model->numtexcoords = model->numvertices;
+	model->texcoords = (GLfloat*)malloc(sizeof(GLfloat) *
+										2 * (model->numtexcoords + 1));
+	for(int j = 0; j < 3; j++) {
+		min[j] = max[j] = model->vertices[3 + j];
+	}
+	glmBoundsScalar(model->vertices, 1, model->numvertices + 1, min, max);
+	for(int j = 0; j < 3; j++) {
+		dims[j] = glmAbs(max[j]) + glmAbs(min[j]);
+	}
+	GLfloat scalefactor = 2.0 /
+		glmAbs(glmMax(glmMax(dims[0], dims[1]), dims[2]));
+	glmLinearTextureScalar(model->vertices, model->texcoords, 1,
+						   model->numvertices + 1, scalefactor);
+	for(GLuint i = 0; i < model->numtriangles; i++) {
+		for(int j = 0; j < 3; j++) {
+			model->triangles[i].tindices[j] = model->triangles[i].vindices[j];
+		}
+	}
+}
+
+void benchKernels(int nu, int nv) {
+	GLMmodel* model = makeTorus(nu, nv);
+	GLMmodel* reference = glmCopy(model);
+	size_t numvertices = model->numvertices;
+	size_t numfloats = 3 * (numvertices + 1);
+	vector<GLfloat> original(model->vertices, model->vertices + numfloats);
+	GLfloat* vertices = model->vertices;
+	GLfloat* refvertices = reference->vertices;
+	Timing t, s;
+
+	if (wanted("glmDimensions")) {
+		GLfloat dims[3], min[3], max[3];
+		t = timeRuns([&] { glmDimensions(model, dims); });
+		s = timeRuns([&] {
+			for(int j = 0; j < 3; j++) {
+				min[j] = max[j] = refvertices[3 + j];
+			}
+			glmBoundsScalar(refvertices, 1, numvertices + 1, min, max);
+		});
+		GLfloat refdims[3];
+		for(int j = 0; j < 3; j++) {
+			refdims[j] = glmAbs(max[j]) + glmAbs(min[j]);
+		}
+		report("glmDimensions", numvertices, t, &s, maxDiff(dims, refdims, 3));
+	}
+
+	if (wanted("glmUnitize")) {
+		t = timeRuns([&] { copy(original.begin(), original.end(), vertices); },
+					 [&] { glmUnitize(model); });
+		s = timeRuns([&] {
+			copy(original.begin(), original.end(), refvertices);
+		}, [&] { unitizeScalar(reference); });
+		report("glmUnitize", numvertices, t, &s,
+			   maxDiff(vertices, refvertices, numfloats));
+	}
+
+	if (wanted("glmScale")) {
+		GLfloat zero[3] = {0, 0, 0};
+		t = timeRuns([&] { copy(original.begin(), original.end(), vertices); },
+					 [&] { glmScale(model, 1.37f); });
+		s = timeRuns([&] {
+			copy(original.begin(), original.end(), refvertices);
+		}, [&] {
+			glmTransformScalar(refvertices, 1, numvertices + 1, zero, 1.37f);
+		});
+		report("glmScale", numvertices, t, &s,
+			   maxDiff(vertices, refvertices, numfloats));
+	}
+
+	copy(original.begin(), original.end(), vertices);
+	copy(original.begin(), original.end(), refvertices);
+
+	if (wanted("glmFacetNormals")) {
+		t = timeRuns([&] { glmFacetNormals(model); });
+		s = timeRuns([&] { facetNormalsScalar(reference); });
+		report("glmFacetNormals", model->numtriangles, t, &s,
+			   maxDiff(model->facetnorms + 3, reference->facetnorms + 3,
+					   3 * model->numtriangles));
+	}
+
+	if (wanted("glmLinearTexture")) {
+		t = timeRuns([&] { glmLinearTexture(model); });
+		s = timeRuns([&] { linearTextureScalar(reference); });
+		report("glmLinearTexture", numvertices, t, &s,
+			   maxDiff(model->texcoords + 2, reference->texcoords + 2,
+					   2 * numvertices));
+	}
+
+	if (wanted("glmSpheremapTexture")) {
+		glmVertexNormals(model, 90.0);
+		t = timeRuns([&] { glmSpheremapTexture(model); });
+		report("glmSpheremapTexture", model->numnormals, t);
+	}
+
+	glmDelete(model);
+	glmDelete(reference);
+}
+
+//Adds a record for a batch of queries, with their throughput and how far
+//the answers were from a brute force search
+void reportQueries(const char* name, size_t size, const Timing &t,
+				   int queries, double maxDiff) {
+	char extra[128];
+	snprintf(extra, sizeof(extra),
+			 ", \"queries\": %d, \"queries_per_sec\": %.0f, \"max_diff\": %g",
+			 queries, queries / (t.median / 1000), maxDiff);
+	report(name, size, t, NULL, 0, extra);
+}
+
+float randomFloat(float lo, float hi) {
+	return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+void benchBVH(int nu, int nv) {
+	GLMmodel* model = makeTorus(nu, nv);
+	size_t numtriangles = model->numtriangles;
+	const int numQueries = 10000;
+	const int numChecked = 100;
+	Timing t;
+
+	//A hierarchy with everything in one leaf is a brute force search
+	BVH* bvh = NULL;
+	BVH brute(model, model->numtriangles);
+	if (wanted("BVH build")) {
+		t = timeRuns([&] { delete bvh; }, [&] { bvh = new BVH(model); });
+		char extra[128];
+		snprintf(extra, sizeof(extra), ", \"nodes\": %d, \"depth\": %d",
+				 bvh->nodeCount(), bvh->treeDepth());
+		report("BVH build", numtriangles, t, NULL, 0, extra);
+	}
+	else {
+		bvh = new BVH(model);
+	}
+
+	GLfloat dims[3];
+	glmDimensions(model, dims);
+	Vec3f center(3, -1, 0.5f);
+	float size = max(dims[0], max(dims[1], dims[2]));
+	srand(1);
+
+	if (wanted("BVH rayCast")) {
+		vector<Vec3f> origins, dirs;
+		for(int i = 0; i < numQueries; i++) {
+			Vec3f o = Vec3f(randomFloat(-1, 1), randomFloat(-1, 1),
+							randomFloat(-1, 1)).normalize() * size * 2 + center;
+			Vec3f target = center + Vec3f(randomFloat(-0.5f, 0.5f) * dims[0],
+										  randomFloat(-0.5f, 0.5f) * dims[1],
+										  randomFloat(-0.5f, 0.5f) * dims[2]);
+			origins.push_back(o);
+			dirs.push_back((target - o).normalize());
+		}
+		int hits = 0;
+		t = timeRuns([&] {
+			hits = 0;
+			BVH::Hit hit;
+			for(int i = 0; i < numQueries; i++) {
+				hits += bvh->rayCast(origins[i], dirs[i], FLT_MAX, hit);
+			}
+		});
+		double diff = 0;
+		for(int i = 0; i < numChecked; i++) {
+			BVH::Hit a, b;
+			bool ha = bvh->rayCast(origins[i], dirs[i], FLT_MAX, a);
+			bool hb = brute.rayCast(origins[i], dirs[i], FLT_MAX, b);
+			diff = max(diff, ha != hb ? (double)FLT_MAX : ha ?
+					   (double)fabs(a.t - b.t) : 0.0);
+		}
+		reportQueries("BVH rayCast", numtriangles, t, numQueries, diff);
+	}
+
+	vector<Vec3f> points;
+	for(int i = 0; i < numQueries; i++) {
+		points.push_back(center + Vec3f(randomFloat(-0.6f, 0.6f) * dims[0],
+										randomFloat(-0.6f, 0.6f) * dims[1],
+										randomFloat(-0.6f, 0.6f) * dims[2]));
+	}
+
+	if (wanted("BVH closestPoint")) {
+		t = timeRuns([&] {
+			Vec3f closest;
+			for(int i = 0; i < numQueries; i++) {
+				bvh->closestPoint(points[i], FLT_MAX, closest);
+			}
+		});
+		double diff = 0;
+		for(int i = 0; i < numChecked; i++) {
+			Vec3f a, b;
+			bvh->closestPoint(points[i], FLT_MAX, a);
+			brute.closestPoint(points[i], FLT_MAX, b);
+			diff = max(diff, (double)fabs((a - points[i]).magnitude() -
+										  (b - points[i]).magnitude()));
+		}
+		reportQueries("BVH closestPoint", numtriangles, t, numQueries, diff);
+	}
+
+	if (wanted("BVH sphereOverlap")) {
+		float radius = 0.02f * size;
+		vector<int> found;
+		t = timeRuns([&] {
+			for(int i = 0; i < numQueries; i++) {
+				found.clear();
+				bvh->sphereOverlap(points[i], radius, found);
+			}
+		});
+		double diff = 0;
+		for(int i = 0; i < numChecked; i++) {
+			found.clear();
+			int a = bvh->sphereOverlap(points[i], radius, found);
+			int b = brute.sphereOverlap(points[i], radius, found);
+			diff = max(diff, (double)abs(a - b));
+		}
+		reportQueries("BVH sphereOverlap", numtriangles, t, numQueries, diff);
+	}
+
+	delete bvh;
+	glmDelete(model);
+}
+
+//Largest difference between kernels' results and Vec3f's, one vector at a
+//time, over every count up to 40 vectors (so that every tail is covered)
+double checkVec3fKernels(const Vec3fKernels &k) {
+	const float m[16] = {0.5f, 1.5f, -2, 0, 3, -0.25f, 1, 0,
+						 -1, 2, 0.75f, 0, 4, -5, 6, 1};
+	double diff = 0;
+	for(size_t n = 0; n <= 40; n++) {
+		Vec3fArray a(n), b(n), out(n);
+		vector<float> dots(n + 1);
+		for(size_t i = 0; i < n; i++) {
+			a.set(i, Vec3f(randomFloat(-9, 9), randomFloat(-9, 9), randomFloat(-9, 9)));
+			b.set(i, Vec3f(randomFloat(-9, 9), randomFloat(-9, 9), randomFloat(-9, 9)));
+		}
+		auto compare = [&](const Vec3fArray &got, size_t i, const Vec3f &want) {
+			for(int c = 0; c < 3; c++) {
+				diff = max(diff, (double)fabs(got.get(i)[c] - want[c]));
+			}
+		};
+		k.add(a, b, out, 0, n);
+		for(size_t i = 0; i < n; i++) {
+			compare(out, i, a.get(i) + b.get(i));
+		}
+		k.scale(a, 1.7f, out, 0, n);
+		for(size_t i = 0; i < n; i++) {
+			compare(out, i, a.get(i) * 1.7f);
+		}
+		k.dot(a, b, &dots[0], 0, n);
+		for(size_t i = 0; i < n; i++) {
+			diff = max(diff, (double)fabs(dots[i] - a.get(i).dot(b.get(i))));
+		}
+		k.cross(a, b, out, 0, n);
+		for(size_t i = 0; i < n; i++) {
+			compare(out, i, a.get(i).cross(b.get(i)));
+		}
+		k.normalize(a, out, 0, n);
+		for(size_t i = 0; i < n; i++) {
+			compare(out, i, a.get(i).normalize());
+		}
+		k.transform(m, a, out, 0, n);
+		for(size_t i = 0; i < n; i++) {
+			Vec3f p = a.get(i);
+			compare(out, i, Vec3f(m[0] * p[0] + m[4] * p[1] + m[8] * p[2] + m[12],
+								  m[1] * p[0] + m[5] * p[1] + m[9] * p[2] + m[13],
+								  m[2] * p[0] + m[6] * p[1] + m[10] * p[2] + m[14]));
+		}
+	}
+	return diff;
+}
+
+//Checks every version of the batch kernels the CPU can run, not just the
+//one in use, against Vec3f on arrays of every length up to 40, and fails
+//the benchmark if any is off
+void checkVec3fArray() {
+	if (!wanted("Vec3fArray")) {
+		return;
+	}
+	Vec3fKernels scalar = {addScalar, scaleScalar, dotScalar, crossScalar,
+						   normalizeScalar, normalizeFastScalar,
+						   transformScalar};
+	double diff = checkVec3fKernels(scalar);
+#ifdef VEC3F_X86_DISPATCH
+	if (__builtin_cpu_supports("avx2")) {
+		Vec3fKernels avx2 = {addAVX2, scaleAVX2, dotAVX2, crossAVX2,
+							 normalizeAVX2, normalizeFastAVX2,
+							 transformAVX2};
+		diff = max(diff, checkVec3fKernels(avx2));
+	}
+	if (__builtin_cpu_supports("avx512f")) {
+		Vec3fKernels avx512 = {addAVX512, scaleAVX512, dotAVX512,
+							   crossAVX512, normalizeAVX512,
+							   normalizeFastAVX512, transformAVX512};
+		diff = max(diff, checkVec3fKernels(avx512));
+	}
+#endif
+	if (diff > 1e-4) {
+		fprintf(stderr, "Vec3fArray: a kernel is off by up to %g\n", diff);
+		failed = true;
+	}
+}
+
+//The batch kernels against the same operations on a vector<Vec3f>
+void benchVec3fArray(size_t n) {
+	Vec3fArray a(n), b(n), out(n);
+	vector<Vec3f> va(n), vb(n), vout(n);
+	for(size_t i = 0; i < n; i++) {
+		va[i] = Vec3f(randomFloat(-9, 9), randomFloat(-9, 9), randomFloat(-9, 9));
+		vb[i] = Vec3f(randomFloat(-9, 9), randomFloat(-9, 9), randomFloat(-9, 9));
+		a.set(i, va[i]);
+		b.set(i, vb[i]);
+	}
+	auto diffOut = [&] {
+		double d = 0;
+		for(size_t i = 0; i < n; i++) {
+			for(int c = 0; c < 3; c++) {
+				d = max(d, (double)fabs(out.get(i)[c] - vout[i][c]));
+			}
+		}
+		return d;
+	};
+
+	if (wanted("Vec3fArray add")) {
+		Timing t = timeRuns([&] { addVec3f(a, b, out); });
+		Timing s = timeRuns([&] {
+			for(size_t i = 0; i < n; i++) {
+				vout[i] = va[i] + vb[i];
+			}
+		});
+		report("Vec3fArray add", n, t, &s, diffOut());
+	}
+
+	if (wanted("Vec3fArray dot")) {
+		vector<float> dots(n), expected(n);
+		Timing t = timeRuns([&] { dotVec3f(a, b, &dots[0], n); });
+		Timing s = timeRuns([&] {
+			for(size_t i = 0; i < n; i++) {
+				expected[i] = va[i].dot(vb[i]);
+			}
+		});
+		report("Vec3fArray dot", n, t, &s,
+			   n > 0 ? maxDiff(&dots[0], &expected[0], n) : 0);
+	}
+
+	if (wanted("Vec3fArray cross")) {
+		Timing t = timeRuns([&] { crossVec3f(a, b, out); });
+		Timing s = timeRuns([&] {
+			for(size_t i = 0; i < n; i++) {
+				vout[i] = va[i].cross(vb[i]);
+			}
+		});
+		report("Vec3fArray cross", n, t, &s, diffOut());
+	}
+
+	if (wanted("Vec3fArray normalize")) {
+		Timing t = timeRuns([&] { normalizeVec3f(a, out); });
+		Timing s = timeRuns([&] {
+			for(size_t i = 0; i < n; i++) {
+				vout[i] = va[i].normalize();
+			}
+		});
+		report("Vec3fArray normalize", n, t, &s, diffOut());
+	}
+
+	if (wanted("Vec3fArray transform")) {
+		const float m[16] = {0, 0, -1, 0, 0, 1, 0, 0, 1, 0, 0, 0, 2, 3, 4, 1};
+		Timing t = timeRuns([&] { transformVec3f(m, a, out); });
+		Timing s = timeRuns([&] {
+			for(size_t i = 0; i < n; i++) {
+				const Vec3f &p = va[i];
+				vout[i] = Vec3f(m[0] * p[0] + m[4] * p[1] + m[8] * p[2] + m[12],
+								m[1] * p[0] + m[5] * p[1] + m[9] * p[2] + m[13],
+								m[2] * p[0] + m[6] * p[1] + m[10] * p[2] + m[14]);
+			}
+		});
+		report("Vec3fArray transform", n, t, &s, diffOut());
+	}
+}
+
+//Error of approximate unit vectors against exact ones: the largest
+//difference in any component, as a distribution over the vectors
+struct NormalError {
+	vector<double> errors;
+
+	void add(const Vec3f &fast, const Vec3f &exact) {
+		double e = 0;
+		for(int c = 0; c < 3; c++) {
+			e = max(e, (double)fabs(fast[c] - exact[c]));
+		}
+		errors.push_back(e);
+	}
+
+	//Returns the largest error, and writes the distribution to extra
+	double describe(char* extra, size_t size) {
+		sort(errors.begin(), errors.end());
+		double mean = 0;
+		for(size_t i = 0; i < errors.size(); i++) {
+			mean += errors[i] / errors.size();
+		}
+		snprintf(extra, size, ", \"err_mean\": %.3g, \"err_p50\": %.3g, "
+				 "\"err_p99\": %.3g, \"err_max\": %.3g", mean,
+				 errors[errors.size() / 2], errors[errors.size() * 99 / 100],
+				 errors.back());
+		return errors.back();
+	}
+};
+
+//normalizeFast against normalize on the face normals of a bumpy w x w
+//heightfield, which is what the terrain's lighting normals are made from
+void benchNormalizeFast(int w) {
+	size_t n = (size_t)w * w;
+	vector<float> hs(n);
+	for(int z = 0; z < w; z++) {
+		for(int x = 0; x < w; x++) {
+			hs[z * w + x] = 8 * sinf(x * 0.05f) * cosf(z * 0.07f) +
+				randomFloat(-0.5f, 0.5f);
+		}
+	}
+	//The two edges of the triangle to the right of and above each point
+	Vec3fArray right(n), up(n), faces(n), out(n);
+	vector<Vec3f> vfaces(n), vout(n);
+	for(int z = 0; z < w; z++) {
+		for(int x = 0; x < w; x++) {
+			size_t i = z * w + x;
+			float h = hs[i];
+			right.set(i, Vec3f(1, hs[z * w + min(x + 1, w - 1)] - h, 0));
+			up.set(i, Vec3f(0, hs[min(z + 1, w - 1) * w + x] - h, 1));
+		}
+	}
+	crossVec3f(up, right, faces);
+	for(size_t i = 0; i < n; i++) {
+		vfaces[i] = faces.get(i);
+	}
+	char extra[256];
+
+	if (wanted("normalizeFast Vec3f")) {
+		Timing t = timeRuns([&] {
+			for(size_t i = 0; i < n; i++) {
+				vout[i] = vfaces[i].normalizeFast();
+			}
+		});
+		Timing s = timeRuns([&] {
+			for(size_t i = 0; i < n; i++) {
+				vout[i] = vfaces[i].normalize();
+			}
+		});
+		NormalError error;
+		for(size_t i = 0; i < n; i++) {
+			error.add(vfaces[i].normalizeFast(), vfaces[i].normalize());
+		}
+		double diff = error.describe(extra, sizeof(extra));
+		report("normalizeFast Vec3f", n, t, &s, diff, extra);
+	}
+
+	if (wanted("normalizeFast Vec3fArray")) {
+		Timing t = timeRuns([&] { normalizeFastVec3f(faces, out); });
+		Timing s = timeRuns([&] { normalizeVec3f(faces, out); });
+		//Every version the CPU can run goes into the distribution
+		vector<void (*)(Streams, OutStreams, size_t, size_t)> versions;
+		versions.push_back(normalizeFastScalar);
+#ifdef VEC3F_X86_DISPATCH
+		if (__builtin_cpu_supports("avx2")) {
+			versions.push_back(normalizeFastAVX2);
+		}
+		if (__builtin_cpu_supports("avx512f")) {
+			versions.push_back(normalizeFastAVX512);
+		}
+#endif
+		NormalError error;
+		for(size_t v = 0; v < versions.size(); v++) {
+			versions[v](faces, out, 0, n);
+			for(size_t i = 0; i < n; i++) {
+				error.add(out.get(i), vfaces[i].normalize());
+			}
+		}
+		double diff = error.describe(extra, sizeof(extra));
+		report("normalizeFast Vec3fArray", n, t, &s, diff, extra);
+	}
+}
+
+//Returns the positions of the vertices used by triangles of more than
+//one group, sorted
+vector<array<GLfloat, 3> > groupBorders(GLMmodel* model) {
+	vector<GLuint> owner(model->numvertices + 1, GLM_NOT_FOUND);
+	vector<bool> border(model->numvertices + 1, false);
+	GLuint g = 0;
+	for(GLMgroup* group = model->groups; group != NULL; group = group->next) {
+		for(GLuint i = 0; i < group->numtriangles; i++) {
+			const GLuint* v = model->triangles[group->triangles[i]].vindices;
+			for(int j = 0; j < 3; j++) {
+				if (owner[v[j]] == GLM_NOT_FOUND) {
+					owner[v[j]] = g;
+				}
+				else if (owner[v[j]] != g) {
+					border[v[j]] = true;
+				}
+			}
+		}
+		g++;
+	}
+
+	vector<array<GLfloat, 3> > positions;
+	for(GLuint i = 1; i <= model->numvertices; i++) {
+		if (border[i]) {
+			array<GLfloat, 3> p = {{model->vertices[3 * i],
+									model->vertices[3 * i + 1],
+									model->vertices[3 * i + 2]}};
+			positions.push_back(p);
+		}
+	}
+	sort(positions.begin(), positions.end());
+	return positions;
+}
+
+//Reading, writing and processing whole models: glmReadOBJ, glmWriteOBJ,
+//glmVertexNormals, glmWeld, glmOptimize and glmSimplify
+void benchModels(int nu, int nv) {
+	char extra[128];
+	if (wanted("glmReadOBJ")) {
+		string name = writeTorusOBJ(nu, nv);
+		GLMmodel* model = NULL;
+		Timing t = timeRuns([&] {
+			if (model != NULL) {
+				glmDelete(model);
+				model = NULL;
+			}
+		}, [&] { model = glmReadOBJ((char*)name.c_str()); });
+		struct stat st;
+		stat(name.c_str(), &st);
+		snprintf(extra, sizeof(extra), ", \"bytes\": %lld",
+				 (long long)st.st_size);
+		report("glmReadOBJ", model->numvertices, t, NULL, 0, extra);
+		glmDelete(model);
+		unlink(name.c_str());
+	}
+
+	//Writes the torus with its normals, and checks that reading the file
+	//back gives exactly the same numbers
+	if (wanted("glmWriteOBJ")) {
+		GLMmodel* model = makeTorus(nu, nv);
+		glmFacetNormals(model);
+		glmVertexNormals(model, 90);
+		char name[] = "/tmp/glmbenchXXXXXX";
+		close(mkstemp(name));
+		Timing t = timeRuns([&] { glmWriteOBJ(model, name, GLM_SMOOTH); });
+
+		struct stat st;
+		stat(name, &st);
+		GLMmodel* back = glmReadOBJ(name);
+		bool same = back->numvertices == model->numvertices &&
+			back->numnormals == model->numnormals &&
+			back->numtriangles == model->numtriangles &&
+			memcmp(back->vertices + 3, model->vertices + 3,
+				   sizeof(GLfloat) * 3 * model->numvertices) == 0 &&
+			memcmp(back->normals + 3, model->normals + 3,
+				   sizeof(GLfloat) * 3 * model->numnormals) == 0;
+		if (!same) {
+			fprintf(stderr, "glmWriteOBJ: reading %s back gave a different "
+					"model\n", name);
+			failed = true;
+		}
+		snprintf(extra, sizeof(extra), ", \"bytes\": %lld, \"round_trip\": %s",
+				 (long long)st.st_size, same ? "true" : "false");
+		report("glmWriteOBJ", model->numvertices, t, NULL, 0, extra);
+		glmDelete(back);
+		glmDelete(model);
+		unlink(name);
+	}
+
+	if (wanted("glmVertexNormals")) {
+		GLMmodel* model = makeTorus(nu, nv);
+		glmFacetNormals(model);
+		Timing t = timeRuns([&] { glmVertexNormals(model, 90); });
+		report("glmVertexNormals", model->numvertices, t);
+		glmDelete(model);
+	}
+
+	//glmWeld compares every vertex with every one kept so far, so leave out
+	//the largest models, which would take minutes
+	if (wanted("glmWeld") && nu * nv <= 256 * 256) {
+		GLMmodel* model = makeTorus(nu, nv, true);
+		GLMmodel* copy = NULL;
+		Timing t = timeRuns([&] {
+			if (copy != NULL) {
+				glmDelete(copy);
+			}
+			copy = glmCopy(model);
+		}, [&] { glmWeld(copy, 0.00001f); });
+		snprintf(extra, sizeof(extra), ", \"welded_vertices\": %u",
+				 copy->numvertices);
+		report("glmWeld", model->numvertices, t, NULL, 0, extra);
+		glmDelete(copy);
+		glmDelete(model);
+	}
+
+	if (wanted("glmOptimize")) {
+		GLMmodel* model = makeTorus(nu, nv);
+		GLMmodel* copy = NULL;
+		GLfloat acmr[2];
+		Timing t = timeRuns([&] {
+			if (copy != NULL) {
+				glmDelete(copy);
+			}
+			copy = glmCopy(model);
+		}, [&] { glmOptimize(copy, 24, GL_TRUE, acmr); });
+		snprintf(extra, sizeof(extra),
+				 ", \"acmr_before\": %.3f, \"acmr_after\": %.3f",
+				 acmr[0], acmr[1]);
+		report("glmOptimize", model->numtriangles, t, NULL, 0, extra);
+		glmDelete(copy);
+		glmDelete(model);
+	}
+
+	//Simplifies to a quarter of the triangles, and checks that every vertex
+	//on the border between the two halves' groups stays there.  The largest
+	//models take seconds a run, so are left out.
+	if (wanted("glmSimplify") && nu * nv <= 256 * 256) {
+		GLMmodel* model = makeTorus(nu, nv, false, true);
+		GLMmodel* copy = NULL;
+		GLuint target = model->numtriangles / 4;
+		Timing t = timeRuns([&] {
+			if (copy != NULL) {
+				glmDelete(copy);
+			}
+			copy = glmCopy(model);
+		}, [&] { glmSimplify(copy, target); });
+
+		vector<array<GLfloat, 3> > before = groupBorders(model);
+		vector<array<GLfloat, 3> > after = groupBorders(copy);
+		vector<array<GLfloat, 3> > lost;
+		set_difference(before.begin(), before.end(), after.begin(), after.end(),
+					   back_inserter(lost));
+		if (!lost.empty()) {
+			fprintf(stderr, "glmSimplify: %zu of %zu group border vertices "
+					"lost at size %u\n", lost.size(), before.size(),
+					model->numtriangles);
+			failed = true;
+		}
+		snprintf(extra, sizeof(extra),
+				 ", \"target\": %u, \"triangles\": %u, \"border_lost\": %zu",
+				 target, copy->numtriangles, lost.size());
+		report("glmSimplify", model->numtriangles, t, NULL, 0, extra);
+		glmDelete(copy);
+		glmDelete(model);
+	}
+}
+
+//Vec3f operations one vector at a time, over n of them
+void benchVec3f(size_t n) {
+	vector<Vec3f> a(n), b(n), out(n);
+	vector<float> dots(n);
+	for(size_t i = 0; i < n; i++) {
+		a[i] = Vec3f(randomFloat(-9, 9), randomFloat(-9, 9), randomFloat(-9, 9));
+		b[i] = Vec3f(randomFloat(-9, 9), randomFloat(-9, 9), randomFloat(-9, 9));
+	}
+
+	if (wanted("Vec3f add")) {
+		Timing t = timeRuns([&] {
+			for(size_t i = 0; i < n; i++) {
+				out[i] = a[i] + b[i] * 0.5f;
+			}
+		});
+		report("Vec3f add", n, t);
+	}
+
+	if (wanted("Vec3f dot")) {
+		Timing t = timeRuns([&] {
+			for(size_t i = 0; i < n; i++) {
+				dots[i] = a[i].dot(b[i]);
+			}
+		});
+		report("Vec3f dot", n, t);
+	}
+
+	if (wanted("Vec3f cross")) {
+		Timing t = timeRuns([&] {
+			for(size_t i = 0; i < n; i++) {
+				out[i] = a[i].cross(b[i]);
+			}
+		});
+		report("Vec3f cross", n, t);
+	}
+
+	if (wanted("Vec3f normalize")) {
+		Timing t = timeRuns([&] {
+			for(size_t i = 0; i < n; i++) {
+				out[i] = a[i].normalize();
+			}
+		});
+		report("Vec3f normalize", n, t);
+	}
+
+	if (wanted("Vec3f magnitude")) {
+		Timing t = timeRuns([&] {
+			for(size_t i = 0; i < n; i++) {
+				dots[i] = a[i].magnitude();
+			}
+		});
+		report("Vec3f magnitude", n, t);
+	}
+}
+
+//Terrain::computeNormals, and getHeight looked up the ways the game does:
+//row by row, column by column, and along the bike's wandering path
+void benchTerrain(int w, int l) {
+	Terrain terrain(w, l);
+	for(int z = 0; z < l; z++) {
+		for(int x = 0; x < w; x++) {
+			terrain.setHeight(x, z, 8 * sinf(x * 0.05f) * cosf(z * 0.07f) +
+							  randomFloat(-0.5f, 0.5f));
+		}
+	}
+	size_t points = (size_t)w * l;
+	volatile float sink;
+
+	if (wanted("Terrain computeNormals")) {
+		float h = terrain.getHeight(0, 0);
+		Timing t = timeRuns([&] { terrain.setHeight(0, 0, h); },
+							[&] { terrain.computeNormals(); });
+		report("Terrain computeNormals", points, t);
+	}
+
+	if (wanted("Terrain getHeight rows")) {
+		Timing t = timeRuns([&] {
+			float sum = 0;
+			for(int z = 0; z < l; z++) {
+				for(int x = 0; x < w; x++) {
+					sum += terrain.getHeight(x, z);
+				}
+			}
+			sink = sum;
+		});
+		report("Terrain getHeight rows", points, t);
+	}
+
+	if (wanted("Terrain getHeight columns")) {
+		Timing t = timeRuns([&] {
+			float sum = 0;
+			for(int x = 0; x < w; x++) {
+				for(int z = 0; z < l; z++) {
+					sum += terrain.getHeight(x, z);
+				}
+			}
+			sink = sum;
+		});
+		report("Terrain getHeight columns", points, t);
+	}
+
+	if (wanted("Terrain getHeight path")) {
+		//A walk that turns a little at every step, bouncing off the edges,
+		//looking up the height and normal under it each time
+		vector<float> xs(points), zs(points);
+		float x = w / 2.0f, z = l / 2.0f, heading = 0;
+		for(size_t i = 0; i < points; i++) {
+			heading += randomFloat(-0.2f, 0.2f);
+			x += 0.7f * sinf(heading);
+			z += 0.7f * cosf(heading);
+			if (x < 0 || x > w - 1 || z < 0 || z > l - 1) {
+				heading += (float)M_PI;
+				x = max(0.0f, min(x, w - 1.0f));
+				z = max(0.0f, min(z, l - 1.0f));
+			}
+			xs[i] = x;
+			zs[i] = z;
+		}
+		terrain.computeNormals();
+		Timing t = timeRuns([&] {
+			float sum = 0;
+			for(size_t i = 0; i < points; i++) {
+				sum += terrain.getHeight((int)xs[i], (int)zs[i]) +
+					terrain.getNormal((int)xs[i], (int)zs[i])[1];
+			}
+			sink = sum;
+		});
+		report("Terrain getHeight path", points, t);
+	}
+	(void)sink;
+}
+
+//Picking up balls along the bike's wandering path over a 1024 by 1024
+//map with n balls, through BallGrid and by checking every ball
+void benchBallPickups(int n) {
+	if (!wanted("BallGrid removeNear")) {
+		return;
+	}
+	const int SIZE = 1024;
+	const int STEPS = 10000;
+	BallGrid grid;
+	grid.reset(SIZE, SIZE);
+	for(int i = 0; i < n; i++) {
+		Ball ball = Ball();
+		ball.pos[0] = randomFloat(0, SIZE - 1);
+		ball.pos[1] = randomFloat(-2, 2);
+		ball.pos[2] = randomFloat(0, SIZE - 1);
+		grid.add(ball);
+	}
+	vector<float> path(3 * STEPS);
+	float x = SIZE / 2.0f, z = SIZE / 2.0f, heading = 0;
+	for(int i = 0; i < STEPS; i++) {
+		heading += randomFloat(-0.2f, 0.2f);
+		x = max(0.0f, min(x + 0.7f * sinf(heading), SIZE - 1.0f));
+		z = max(0.0f, min(z + 0.7f * cosf(heading), SIZE - 1.0f));
+		path[3 * i] = x;
+		path[3 * i + 1] = 0;
+		path[3 * i + 2] = z;
+	}
+
+	BallGrid copy;
+	int collected = 0;
+	Timing t = timeRuns([&] { copy = grid; }, [&] {
+		collected = 0;
+		for(int i = 0; i < STEPS; i++) {
+			collected += copy.removeNear(&path[3 * i], 2);
+		}
+	});
+
+	vector<Ball> balls;
+	int scalarCollected = 0;
+	Timing scalar = timeRuns([&] { balls = grid.all(); }, [&] {
+		scalarCollected = 0;
+		for(int i = 0; i < STEPS; i++) {
+			const float* pos = &path[3 * i];
+			for(size_t j = 0; j < balls.size();) {
+				if (fabsf(balls[j].pos[0] - pos[0]) < 2 &&
+					fabsf(balls[j].pos[1] - pos[1]) < 2 &&
+					fabsf(balls[j].pos[2] - pos[2]) < 2) {
+					balls[j] = balls.back();
+					balls.pop_back();
+					scalarCollected++;
+				}
+				else {
+					j++;
+				}
+			}
+		}
+	});
+
+	char extra[64];
+	snprintf(extra, sizeof(extra), ", \"collected\": %d", collected);
+	report("BallGrid removeNear", n, t, &scalar,
+		   abs(collected - scalarCollected), extra);
+}
+
+//Largest difference between swapping red and blue with function and with
+//the plain version, over every row width up to 200 pixels
+template<class F>
+double checkSwapRedBlue(F function) {
+	vector<unsigned char> in(600), out(600), expected(600);
+	for(size_t i = 0; i < in.size(); i++) {
+		in[i] = (unsigned char)rand();
+	}
+	double diff = 0;
+	for(int width = 0; width <= 200; width++) {
+		fill(out.begin(), out.end(), 0);
+		fill(expected.begin(), expected.end(), 0);
+		function(&in[0], &out[0], width);
+		swapRedBlueScalar(&in[0], &expected[0], width);
+		for(size_t i = 0; i < out.size(); i++) {
+			diff = max(diff, (double)abs(out[i] - expected[i]));
+		}
+	}
+	return diff;
+}
+
+void benchImages(int width, int height) {
+	//A bottom up BGR view with padded rows, like a 24 bit BMP
+	int stride = (width * 3 + 3) & ~3;
+	vector<unsigned char> rows((size_t)stride * height);
+	for(size_t i = 0; i < rows.size(); i++) {
+		rows[i] = (unsigned char)(i * 7 + i / 4093);
+	}
+	ImageView view;
+	view.rows = &rows[0];
+	view.width = width;
+	view.height = height;
+	view.stride = stride;
+	view.format = PIXEL_BGR;
+	view.bottomUp = true;
+	size_t pixels = (size_t)width * height;
+
+	if (wanted("swapRedBlue")) {
+		vector<unsigned char> out(3 * pixels);
+		Timing t = timeRuns([&] {
+			for(int y = 0; y < height; y++) {
+				swapRedBlue(view.row(y), &out[3 * (size_t)width * y], width);
+			}
+		});
+		Timing s = timeRuns([&] {
+			for(int y = 0; y < height; y++) {
+				swapRedBlueScalar(view.row(y), &out[3 * (size_t)width * y],
+								  width);
+			}
+		});
+		//Every version the CPU can run is checked, not just the one in use
+		double diff = checkSwapRedBlue(swapRedBlue);
+#ifdef IMAGE_X86_DISPATCH
+		if (__builtin_cpu_supports("ssse3")) {
+			diff = max(diff, checkSwapRedBlue(swapRedBlueSSSE3));
+		}
+		if (__builtin_cpu_supports("avx2")) {
+			diff = max(diff, checkSwapRedBlue(swapRedBlueAVX2));
+		}
+#endif
+		report("swapRedBlue", pixels, t, &s, diff);
+	}
+
+	if (wanted("toImage")) {
+		Image image;
+		Image reference;
+		Timing t = timeRuns([&] { image = Image(); },
+							[&] { image = toImage(view); });
+		Timing s = timeRuns([&] { reference = Image(); }, [&] {
+			reference = Image(width, height);
+			for(int y = 0; y < height; y++) {
+				swapRedBlueScalar(view.row(y), reference.row(y), width);
+			}
+		});
+		double diff = 0;
+		for(int y = 0; y < height; y++) {
+			for(int x = 0; x < 3 * width; x++) {
+				diff = max(diff, (double)abs(image.row(y)[x] - reference.row(y)[x]));
+			}
+		}
+		report("toImage", pixels, t, &s, diff);
+	}
+
+	if (wanted("decodeBMP32")) {
+		//A 32 bit bitmap with the usual BGRX layout, which has a fast path
+		vector<unsigned char> file(54 + 4 * pixels);
+		const int header[] = {0, 0, 54, 40, width, height};
+		memcpy(&file[2], header, sizeof(header));
+		file[0] = 'B';
+		file[1] = 'M';
+		file[26] = 1;
+		file[28] = 32;
+		for(size_t i = 54; i < file.size(); i++) {
+			file[i] = (unsigned char)(i * 7 + i / 4093);
+		}
+		ImageView decoded;
+		unsigned char* out = NULL;
+		Timing t = timeRuns([&] { delete[] out; }, [&] {
+			out = decodeBMP(&file[0], file.size(), decoded);
+		});
+		unsigned char* reference = NULL;
+		Timing s = timeRuns([&] { delete[] reference; }, [&] {
+			const unsigned char* in = &file[54];
+			reference = new unsigned char[3 * pixels];
+			for(size_t i = 0; i < pixels; i++) {
+				reference[3 * i + 0] = in[4 * i + 2];
+				reference[3 * i + 1] = in[4 * i + 1];
+				reference[3 * i + 2] = in[4 * i + 0];
+			}
+		});
+		double diff = 0;
+		for(size_t i = 0; i < 3 * pixels; i++) {
+			diff = max(diff, (double)abs(out[i] - reference[i]));
+		}
+		report("decodeBMP32", pixels, t, &s, diff);
+		delete[] out;
+		delete[] reference;
+	}
+}
+
+//Decodes a BC1 block (or the color half of a BC3 block) into RGBA
+void decodeBC1Block(const unsigned char* in, unsigned char* rgba) {
+	int c0 = in[0] | in[1] << 8;
+	int c1 = in[2] | in[3] << 8;
+	int palette[4][3];
+	from565(c0, palette[0]);
+	from565(c1, palette[1]);
+	for(int c = 0; c < 3; c++) {
+		if (c0 > c1) {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		else {
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+	}
+	for(int i = 0; i < 16; i++) {
+		int k = (in[4 + i / 4] >> (2 * (i % 4))) & 3;
+		for(int c = 0; c < 3; c++) {
+			rgba[4 * i + c] = (unsigned char)palette[k][c];
+		}
+		rgba[4 * i + 3] = 255;
+	}
+}
+
+//Writes a 24 bit BMP of a grassy looking pattern and returns its path
+string writeTestBMP(int width, int height) {
+	char name[] = "/tmp/glmbenchXXXXXX";
+	int fd = mkstemp(name);
+	close(fd);
+	string path = string(name) + ".bmp";
+	rename(name, path.c_str());
+	
+	int stride = (width * 3 + 3) & ~3;
+	vector<unsigned char> file(54 + (size_t)stride * height);
+	const int header[] = {(int)file.size(), 0, 54, 40, width, height};
+	memcpy(&file[2], header, sizeof(header));
+	file[0] = 'B';
+	file[1] = 'M';
+	file[26] = 1;
+	file[28] = 24;
+	unsigned seed = 1;
+	for(int y = 0; y < height; y++) {
+		unsigned char* row = &file[54 + (size_t)stride * y];
+		for(int x = 0; x < width; x++) {
+			seed = seed * 1103515245 + 12345;
+			int noise = (int)(seed >> 16) % 48;
+			float wave = 40 * sinf(x * 0.05f) * cosf(y * 0.03f);
+			row[3 * x + 0] = (unsigned char)max(0, min(255, 30 + noise / 2));
+			row[3 * x + 1] = (unsigned char)max(0, min(255, (int)(140 + wave) + noise));
+			row[3 * x + 2] = (unsigned char)max(0, min(255, (int)(70 + wave / 2) + noise));
+		}
+	}
+	FILE* out = fopen(path.c_str(), "wb");
+	fwrite(&file[0], 1, file.size(), out);
+	fclose(out);
+	return path;
+}
+
+//loadBMP on a 24 bit bitmap file
+void benchLoadBMP(int width, int height) {
+	if (!wanted("loadBMP")) {
+		return;
+	}
+	string path = writeTestBMP(width, height);
+	Image image;
+	Timing t = timeRuns([&] { image = Image(); },
+						[&] { image = loadBMP(path.c_str()); });
+	report("loadBMP", (size_t)width * height, t);
+	remove(path.c_str());
+}
+
+void benchTextureCache(int width, int height) {
+	string path = writeTestBMP(width, height);
+	string cache = cachePathFor(path.c_str());
+	size_t pixels = (size_t)width * height;
+	
+	if (wanted("buildTextureCache")) {
+		//Building: decode, mipmap and compress, against just decoding
+		CachedTexture* texture = NULL;
+		Timing t = timeRuns([&] {
+			delete texture;
+			remove(cache.c_str());
+		}, [&] { texture = CachedTexture::load(path.c_str(), TEXTURE_BC1); });
+		Image image = loadBMP(path.c_str());
+		
+		//Error of the compressed first level against the image
+		const unsigned char* blocks = texture->levelData(0);
+		int blocksWide = (width + 3) / 4;
+		double error = 0;
+		unsigned char rgba[64];
+		for(int by = 0; by < (height + 3) / 4; by++) {
+			for(int bx = 0; bx < blocksWide; bx++) {
+				decodeBC1Block(blocks + 8 * ((size_t)blocksWide * by + bx), rgba);
+				for(int i = 0; i < 16; i++) {
+					int x = 4 * bx + i % 4;
+					int y = 4 * by + i / 4;
+					for(int c = 0; c < 3 && x < width && y < height; c++) {
+						double d = rgba[4 * i + c] -
+							image.row(y)[3 * x + c];
+						error += d * d;
+					}
+				}
+			}
+		}
+		char extra[128];
+		snprintf(extra, sizeof(extra), ", \"rmse\": %.3f, \"bytes\": %zu, "
+				 "\"rgba_bytes\": %zu", sqrt(error / (3 * pixels)),
+				 texture->dataSize(), 4 * pixels);
+		report("buildTextureCache", pixels, t, NULL, 0, extra);
+		delete texture;
+	}
+	
+	if (wanted("loadTextureCache")) {
+		//Loading: mapping the cache and copying it out, as an upload through
+		//a pixel buffer would, against decoding the BMP and copying its
+		//first level alone
+		delete CachedTexture::load(path.c_str(), TEXTURE_BC1);
+		vector<unsigned char> staging(4 * pixels);
+		Timing t = timeRuns([&] {
+			CachedTexture* texture = CachedTexture::load(path.c_str(), TEXTURE_BC1);
+			memcpy(&staging[0], texture->levelData(0), texture->dataSize());
+			delete texture;
+		});
+		Timing s = timeRuns([&] {
+			Image image = loadBMP(path.c_str());
+			memcpy(&staging[0], image.pixels, 3 * pixels);
+		});
+		report("loadTextureCache", pixels, t, &s);
+	}
+	remove(cache.c_str());
+	remove(path.c_str());
+}
+
+int main(int argc, char** argv) {
+	for(int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg.compare(0, 7, "--reps=") == 0) {
+			reps = max(1, atoi(arg.c_str() + 7));
+		}
+		else if (arg.compare(0, 9, "--warmup=") == 0) {
+			warmup = max(0, atoi(arg.c_str() + 9));
+		}
+		else if (arg.compare(0, 9, "--filter=") == 0) {
+			filter = arg.substr(9);
+		}
+		else {
+			fprintf(stderr, "usage: %s [--reps=N] [--warmup=N] [--filter=name]\n",
+					argv[0]);
+			return 1;
+		}
+	}
+
+	benchKernels(32, 32);
+	benchKernels(256, 256);
+	benchKernels(1024, 512);
+	benchBVH(32, 32);
+	benchBVH(256, 256);
+	benchBVH(1024, 512);
+	benchVec3f(1000);
+	benchVec3f(1 << 20);
+	checkVec3fArray();
+	benchVec3fArray(1000);
+	benchVec3fArray(1 << 20);
+	benchNormalizeFast(64);
+	benchNormalizeFast(1024);
+	benchTerrain(64, 64);
+	benchTerrain(256, 256);
+	benchTerrain(1024, 1024);
+	benchBallPickups(1000);
+	benchBallPickups(100000);
+	benchModels(32, 32);
+	benchModels(256, 256);
+	benchModels(1024, 512);
+	benchImages(60, 60);
+	benchImages(512, 512);
+	benchImages(4096, 4096);
+	benchLoadBMP(64, 64);
+	benchLoadBMP(512, 512);
+	benchLoadBMP(2048, 2048);
+	benchTextureCache(600, 450);
+	benchTextureCache(2048, 2048);
+
+	printf("{\n  \"threads\": %d,\n  \"simd\": %s,\n  \"benchmarks\": [\n",
+		   ThreadPool::instance().size(),
+#ifdef GLM_SIMD
+		   "true"
+#else
+		   "false"
+#endif
+		   );
+	for(size_t i = 0; i < records.size(); i++) {
+		printf("    %s%s\n", records[i].c_str(),
+			   i + 1 < records.size() ? "," : "");
+	}
+	printf("  ]\n}\n");
+	return failed ? 1 : 0;
+}
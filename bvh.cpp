@@ -0,0 +1,580 @@
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include "bvh.h"
+#include "parallel.h"
+
+using namespace std;
+
+//Per triangle data used while building
+struct BVH::Build {
+	vector<float> bounds; //min xyz, max xyz of each triangle
+	vector<float> centroids; //Center of each triangle's bounding box
+	vector<int> refs; //Triangles, reordered into leaf order as nodes split
+};
+
+namespace {
+	const int NUM_BINS = 16;
+	const int MAX_LEAF = 16; //Ranges bigger than this are always split
+
+	float boxArea(const float* min, const float* max) {
+		float dx = max[0] - min[0];
+		float dy = max[1] - min[1];
+		float dz = max[2] - min[2];
+		return dx * dy + dy * dz + dz * dx;
+	}
+
+	void emptyBox(float* min, float* max) {
+		for(int j = 0; j < 3; j++) {
+			min[j] = FLT_MAX;
+			max[j] = -FLT_MAX;
+		}
+	}
+
+	void growBox(float* min, float* max, const float* otherMin,
+				 const float* otherMax) {
+		for(int j = 0; j < 3; j++) {
+			min[j] = std::min(min[j], otherMin[j]);
+			max[j] = std::max(max[j], otherMax[j]);
+		}
+	}
+
+	//Distance along the ray at which it enters the box, or FLT_MAX if it
+	//misses it (or only meets it after maxT)
+	float rayBox(const BVH::Node &node, const float* origin,
+				 const float* invDir, float maxT) {
+		float tNear = 0;
+		float tFar = maxT;
+		for(int j = 0; j < 3; j++) {
+			float t1 = (node.min[j] - origin[j]) * invDir[j];
+			float t2 = (node.max[j] - origin[j]) * invDir[j];
+			if (t1 > t2) {
+				swap(t1, t2);
+			}
+			tNear = t1 > tNear ? t1 : tNear;
+			tFar = t2 < tFar ? t2 : tFar;
+		}
+		return tNear <= tFar ? tNear : FLT_MAX;
+	}
+
+	//Squared distance from p to the box (0 inside it)
+	float boxDistanceSquared(const BVH::Node &node, const float* p) {
+		float d = 0;
+		for(int j = 0; j < 3; j++) {
+			float e = 0;
+			if (p[j] < node.min[j]) {
+				e = node.min[j] - p[j];
+			}
+			else if (p[j] > node.max[j]) {
+				e = p[j] - node.max[j];
+			}
+			d += e * e;
+		}
+		return d;
+	}
+
+	//Nodes still to visit in a traversal, which holds at most one more than
+	//the depth of the tree
+	class NodeStack {
+		private:
+			int buffer[64];
+			vector<int> spill;
+			int* items;
+			int top;
+		public:
+			explicit NodeStack(int depth) : items(buffer), top(0) {
+				if (depth + 2 > 64) {
+					spill.resize(depth + 2);
+					items = &spill[0];
+				}
+			}
+
+			void push(int node) {
+				items[top++] = node;
+			}
+
+			int pop() {
+				return items[--top];
+			}
+
+			bool empty() const {
+				return top == 0;
+			}
+	};
+
+	Vec3f corner(const float* c, int i) {
+		return Vec3f(c[3 * i], c[3 * i + 1], c[3 * i + 2]);
+	}
+
+	//Returns the point on triangle abc nearest to p (from Ericson,
+	//"Real-Time Collision Detection", 5.1.5)
+	Vec3f closestOnTriangle(const Vec3f &p, const Vec3f &a, const Vec3f &b,
+							const Vec3f &c) {
+		Vec3f ab = b - a;
+		Vec3f ac = c - a;
+		Vec3f ap = p - a;
+		float d1 = ab.dot(ap);
+		float d2 = ac.dot(ap);
+		if (d1 <= 0 && d2 <= 0) {
+			return a;
+		}
+
+		Vec3f bp = p - b;
+		float d3 = ab.dot(bp);
+		float d4 = ac.dot(bp);
+		if (d3 >= 0 && d4 <= d3) {
+			return b;
+		}
+
+		float vc = d1 * d4 - d3 * d2;
+		if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+			return a + ab * (d1 / (d1 - d3));
+		}
+
+		Vec3f cp = p - c;
+		float d5 = ab.dot(cp);
+		float d6 = ac.dot(cp);
+		if (d6 >= 0 && d5 <= d6) {
+			return c;
+		}
+
+		float vb = d5 * d2 - d1 * d6;
+		if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+			return a + ac * (d2 / (d2 - d6));
+		}
+
+		float va = d3 * d6 - d5 * d4;
+		if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) {
+			return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+		}
+
+		float denom = 1 / (va + vb + vc);
+		return a + ab * (vb * denom) + ac * (vc * denom);
+	}
+}
+
+//Works out the bounds of the triangles in refs[begin, end) into node and,
+//unless they are best left as a leaf, reorders them into two halves with
+//the surface area heuristic and returns where the second half starts.
+//Returns -1 for a leaf.
+int BVH::split(Build &build, Node &node, int begin, int end) const {
+	float cmin[3], cmax[3];
+	emptyBox(node.min, node.max);
+	emptyBox(cmin, cmax);
+	for(int i = begin; i < end; i++) {
+		int t = build.refs[i];
+		const float* b = &build.bounds[6 * t];
+		const float* c = &build.centroids[3 * t];
+		growBox(node.min, node.max, b, b + 3);
+		growBox(cmin, cmax, c, c);
+	}
+
+	int count = end - begin;
+	if (count <= maxLeafSize) {
+		return -1;
+	}
+
+	//Bin the centroids along each axis and try every plane between bins
+	float bestCost = FLT_MAX;
+	int bestAxis = -1;
+	int bestSplit = 0;
+	for(int axis = 0; axis < 3; axis++) {
+		float extent = cmax[axis] - cmin[axis];
+		if (extent <= 0) {
+			continue;
+		}
+		float scale = NUM_BINS / extent;
+
+		int binCount[NUM_BINS] = {0};
+		float binMin[NUM_BINS][3], binMax[NUM_BINS][3];
+		for(int k = 0; k < NUM_BINS; k++) {
+			emptyBox(binMin[k], binMax[k]);
+		}
+		for(int i = begin; i < end; i++) {
+			int t = build.refs[i];
+			int k = min(NUM_BINS - 1,
+						(int)((build.centroids[3 * t + axis] - cmin[axis]) * scale));
+			const float* b = &build.bounds[6 * t];
+			binCount[k]++;
+			growBox(binMin[k], binMax[k], b, b + 3);
+		}
+
+		//Cost of the right side of each plane, swept from the right
+		float rightCost[NUM_BINS];
+		float boxMin[3], boxMax[3];
+		int n = 0;
+		emptyBox(boxMin, boxMax);
+		for(int k = NUM_BINS - 1; k > 0; k--) {
+			growBox(boxMin, boxMax, binMin[k], binMax[k]);
+			n += binCount[k];
+			rightCost[k] = n ? n * boxArea(boxMin, boxMax) : 0;
+		}
+
+		n = 0;
+		emptyBox(boxMin, boxMax);
+		for(int k = 0; k < NUM_BINS - 1; k++) {
+			growBox(boxMin, boxMax, binMin[k], binMax[k]);
+			n += binCount[k];
+			if (n == 0 || n == count) {
+				continue;
+			}
+			float cost = n * boxArea(boxMin, boxMax) + rightCost[k + 1];
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = k + 1;
+			}
+		}
+	}
+
+	if (bestAxis < 0) {
+		//All the centroids are in the same place; split by position in the
+		//list if there are too many to keep together
+		return count > MAX_LEAF ? begin + count / 2 : -1;
+	}
+
+	//A split costs one box test (about as much as a triangle) plus the
+	//triangles on each side, in proportion to how often they are reached
+	float area = boxArea(node.min, node.max);
+	if (count <= MAX_LEAF && area + bestCost >= count * area) {
+		return -1;
+	}
+
+	float scale = NUM_BINS / (cmax[bestAxis] - cmin[bestAxis]);
+	float lo = cmin[bestAxis];
+	const float* centroids = &build.centroids[bestAxis];
+	int* mid = partition(&build.refs[begin], &build.refs[0] + end,
+						 [&](int t) {
+							 return min(NUM_BINS - 1,
+										(int)((centroids[3 * t] - lo) * scale)) <
+								 bestSplit;
+						 });
+	return (int)(mid - &build.refs[0]);
+}
+
+//Builds the hierarchy over refs[begin, end) into out, with its root at
+//out[0] and the nodes below numbered from 1
+void BVH::buildSubtree(Build &build, int begin, int end,
+					   vector<Node> &out) const {
+	struct Range {
+		int node;
+		int begin;
+		int end;
+	};
+
+	vector<Range> stack;
+	out.push_back(Node());
+	Range root = {0, begin, end};
+	stack.push_back(root);
+	while (!stack.empty()) {
+		Range r = stack.back();
+		stack.pop_back();
+
+		Node node;
+		int mid = split(build, node, r.begin, r.end);
+		if (mid < 0) {
+			node.first = r.begin;
+			node.count = r.end - r.begin;
+			out[r.node] = node;
+		}
+		else {
+			node.first = (int)out.size();
+			node.count = 0;
+			out[r.node] = node;
+			out.push_back(Node());
+			out.push_back(Node());
+			Range right = {node.first + 1, mid, r.end};
+			Range left = {node.first, r.begin, mid};
+			stack.push_back(right);
+			stack.push_back(left);
+		}
+	}
+}
+
+BVH::BVH(GLMmodel* model, int maxLeafSize_) : maxLeafSize(maxLeafSize_) {
+	int n = (int)model->numtriangles;
+	GLfloat* vertices = model->vertices;
+	GLMtriangle* triangles = model->triangles;
+
+	Build build;
+	build.bounds.resize(6 * n);
+	build.centroids.resize(3 * n);
+	build.refs.resize(n);
+	parallelFor(0, n, 16384, [&](size_t b, size_t e) {
+		for(size_t i = b; i < e; i++) {
+			float* min = &build.bounds[6 * i];
+			float* max = min + 3;
+			emptyBox(min, max);
+			for(int k = 0; k < 3; k++) {
+				const float* v = &vertices[3 * triangles[i].vindices[k]];
+				growBox(min, max, v, v);
+			}
+			for(int j = 0; j < 3; j++) {
+				build.centroids[3 * i + j] = 0.5f * (min[j] + max[j]);
+			}
+			build.refs[i] = (int)i;
+		}
+	});
+
+	//Split the top of the tree here, until there are enough pieces to
+	//keep every thread busy, then build the pieces in parallel
+	struct Task {
+		int node;
+		int begin;
+		int end;
+		vector<Node> nodes;
+	};
+	int taskSize = max(4096, n / (8 * ThreadPool::instance().size()));
+	vector<Task> tasks;
+	vector<Task> stack(1);
+	stack[0].node = 0;
+	stack[0].begin = 0;
+	stack[0].end = n;
+	nodes.push_back(Node());
+	while (!stack.empty()) {
+		Task r = stack.back();
+		stack.pop_back();
+		if (r.end - r.begin <= taskSize) {
+			tasks.push_back(r);
+			continue;
+		}
+
+		Node node;
+		int mid = split(build, node, r.begin, r.end);
+		if (mid < 0) {
+			node.first = r.begin;
+			node.count = r.end - r.begin;
+			nodes[r.node] = node;
+			continue;
+		}
+		node.first = (int)nodes.size();
+		node.count = 0;
+		nodes[r.node] = node;
+		nodes.push_back(Node());
+		nodes.push_back(Node());
+		Task right = {node.first + 1, mid, r.end, vector<Node>()};
+		Task left = {node.first, r.begin, mid, vector<Node>()};
+		stack.push_back(right);
+		stack.push_back(left);
+	}
+
+	parallelFor(0, tasks.size(), 1, [&](size_t b, size_t e) {
+		for(size_t i = b; i < e; i++) {
+			buildSubtree(build, tasks[i].begin, tasks[i].end, tasks[i].nodes);
+		}
+	});
+
+	//Each piece's root goes into the slot left for it, and the rest of
+	//its nodes on the end
+	for(size_t i = 0; i < tasks.size(); i++) {
+		vector<Node> &local = tasks[i].nodes;
+		int base = (int)nodes.size() - 1;
+		for(size_t k = 0; k < local.size(); k++) {
+			if (local[k].count == 0) {
+				local[k].first += base;
+			}
+		}
+		nodes[tasks[i].node] = local[0];
+		nodes.insert(nodes.end(), local.begin() + 1, local.end());
+	}
+
+	//Traversals size their stacks by the depth of the tree
+	vector<pair<int, int> > pending(1, make_pair(0, 0));
+	depth = 0;
+	while (!pending.empty()) {
+		pair<int, int> p = pending.back();
+		pending.pop_back();
+		depth = max(depth, p.second);
+		if (n > 0 && nodes[p.first].count == 0) {
+			pending.push_back(make_pair(nodes[p.first].first, p.second + 1));
+			pending.push_back(make_pair(nodes[p.first].first + 1, p.second + 1));
+		}
+	}
+
+	order.swap(build.refs);
+	corners.resize(9 * n);
+	parallelFor(0, n, 16384, [&](size_t b, size_t e) {
+		for(size_t i = b; i < e; i++) {
+			for(int k = 0; k < 3; k++) {
+				const float* v = &vertices[3 * triangles[order[i]].vindices[k]];
+				copy(v, v + 3, &corners[9 * i + 3 * k]);
+			}
+		}
+	});
+}
+
+bool BVH::rayCast(const Vec3f &origin, const Vec3f &dir, float maxT,
+				  Hit &hit) const {
+	float o[3] = {origin[0], origin[1], origin[2]};
+	float invDir[3];
+	for(int j = 0; j < 3; j++) {
+		invDir[j] = 1 / dir[j];
+	}
+
+	hit.t = maxT;
+	hit.triangle = -1;
+	NodeStack stack(depth);
+	if (!order.empty() && rayBox(nodes[0], o, invDir, maxT) != FLT_MAX) {
+		stack.push(0);
+	}
+	while (!stack.empty()) {
+		const Node &node = nodes[stack.pop()];
+		if (node.count > 0) {
+			for(int i = node.first; i < node.first + node.count; i++) {
+				//Moller-Trumbore
+				const float* c = &corners[9 * i];
+				Vec3f a = corner(c, 0);
+				Vec3f e1 = corner(c, 1) - a;
+				Vec3f e2 = corner(c, 2) - a;
+				Vec3f p = dir.cross(e2);
+				float det = e1.dot(p);
+				if (det == 0) {
+					continue;
+				}
+				float invDet = 1 / det;
+				Vec3f s = origin - a;
+				float u = s.dot(p) * invDet;
+				if (u < 0 || u > 1) {
+					continue;
+				}
+				Vec3f q = s.cross(e1);
+				float v = dir.dot(q) * invDet;
+				if (v < 0 || u + v > 1) {
+					continue;
+				}
+				float t = e2.dot(q) * invDet;
+				if (t >= 0 && t <= hit.t) {
+					hit.t = t;
+					hit.triangle = order[i];
+					hit.u = u;
+					hit.v = v;
+				}
+			}
+			continue;
+		}
+
+		//Visit the nearer child first
+		float tl = rayBox(nodes[node.first], o, invDir, hit.t);
+		float tr = rayBox(nodes[node.first + 1], o, invDir, hit.t);
+		int near = node.first;
+		int far = node.first + 1;
+		if (tr < tl) {
+			swap(tl, tr);
+			swap(near, far);
+		}
+		if (tr != FLT_MAX) {
+			stack.push(far);
+		}
+		if (tl != FLT_MAX) {
+			stack.push(near);
+		}
+	}
+	return hit.triangle >= 0;
+}
+
+int BVH::closestPoint(const Vec3f &p, float maxDistance,
+					  Vec3f &closest) const {
+	float pf[3] = {p[0], p[1], p[2]};
+	float best = maxDistance * maxDistance;
+	int bestTriangle = -1;
+
+	NodeStack stack(depth);
+	if (!order.empty()) {
+		stack.push(0);
+	}
+	while (!stack.empty()) {
+		const Node &node = nodes[stack.pop()];
+		if (boxDistanceSquared(node, pf) > best) {
+			continue;
+		}
+		if (node.count > 0) {
+			for(int i = node.first; i < node.first + node.count; i++) {
+				const float* c = &corners[9 * i];
+				Vec3f q = closestOnTriangle(p, corner(c, 0), corner(c, 1),
+											corner(c, 2));
+				float d = (q - p).magnitudeSquared();
+				if (d <= best) {
+					best = d;
+					bestTriangle = order[i];
+					closest = q;
+				}
+			}
+			continue;
+		}
+
+		float dl = boxDistanceSquared(nodes[node.first], pf);
+		float dr = boxDistanceSquared(nodes[node.first + 1], pf);
+		if (dl < dr) {
+			stack.push(node.first + 1);
+			stack.push(node.first);
+		}
+		else {
+			stack.push(node.first);
+			stack.push(node.first + 1);
+		}
+	}
+	return bestTriangle;
+}
+
+int BVH::sphereOverlap(const Vec3f &center, float radius,
+					   vector<int> &triangles) const {
+	float c[3] = {center[0], center[1], center[2]};
+	float r2 = radius * radius;
+	int found = 0;
+
+	NodeStack stack(depth);
+	if (!order.empty()) {
+		stack.push(0);
+	}
+	while (!stack.empty()) {
+		const Node &node = nodes[stack.pop()];
+		if (boxDistanceSquared(node, c) > r2) {
+			continue;
+		}
+		if (node.count > 0) {
+			for(int i = node.first; i < node.first + node.count; i++) {
+				const float* k = &corners[9 * i];
+				Vec3f q = closestOnTriangle(center, corner(k, 0), corner(k, 1),
+											corner(k, 2));
+				if ((q - center).magnitudeSquared() <= r2) {
+					triangles.push_back(order[i]);
+					found++;
+				}
+			}
+			continue;
+		}
+		stack.push(node.first + 1);
+		stack.push(node.first);
+	}
+	return found;
+}
+
+bool BVH::sphereOverlaps(const Vec3f &center, float radius) const {
+	float c[3] = {center[0], center[1], center[2]};
+	float r2 = radius * radius;
+
+	NodeStack stack(depth);
+	if (!order.empty()) {
+		stack.push(0);
+	}
+	while (!stack.empty()) {
+		const Node &node = nodes[stack.pop()];
+		if (boxDistanceSquared(node, c) > r2) {
+			continue;
+		}
+		if (node.count > 0) {
+			for(int i = node.first; i < node.first + node.count; i++) {
+				const float* k = &corners[9 * i];
+				Vec3f q = closestOnTriangle(center, corner(k, 0), corner(k, 1),
+											corner(k, 2));
+				if ((q - center).magnitudeSquared() <= r2) {
+					return true;
+				}
+			}
+			continue;
+		}
+		stack.push(node.first + 1);
+		stack.push(node.first);
+	}
+	return false;
+}
@@ -0,0 +1,87 @@
+#ifndef BVH_H_INCLUDED
+#define BVH_H_INCLUDED
+
+#include <vector>
+#include "glm.h"
+#include "vec3f.h"
+
+//A bounding volume hierarchy over the triangles of a GLMmodel, for ray
+//casts, closest point queries and sphere overlap tests.  It is built with
+//the surface area heuristic and stores its nodes in one flat array, with
+//the two children of a node next to each other.  The triangles' corners
+//are copied in, so the model can change (or go away) afterwards without
+//affecting the hierarchy.
+class BVH {
+	public:
+		struct Node {
+			float min[3];
+			float max[3];
+			int first; //Leaves: first triangle slot; otherwise: left child
+			int count; //Number of triangles in a leaf, 0 for other nodes
+					   //(and for the root of an empty hierarchy)
+		};
+
+		//Result of a ray cast
+		struct Hit {
+			float t; //Distance along the ray, in units of its direction
+			int triangle; //Index into model->triangles, or -1 for no hit
+			float u, v; //Barycentric coordinates of the hit on the triangle
+		};
+
+		//Builds the hierarchy over all of model's triangles, with at most
+		//maxLeafSize triangles per leaf wherever they can be split
+		explicit BVH(GLMmodel* model, int maxLeafSize = 4);
+
+		//Finds the nearest triangle hit by origin + t * dir for
+		//0 <= t <= maxT.  Returns whether there was one.
+		bool rayCast(const Vec3f &origin, const Vec3f &dir, float maxT,
+					 Hit &hit) const;
+
+		//Finds the point on the model nearest to p, no further away than
+		//maxDistance.  Returns the triangle it is on, or -1 if there is none.
+		int closestPoint(const Vec3f &p, float maxDistance,
+						 Vec3f &closest) const;
+
+		//Appends the triangles that touch the sphere to triangles and
+		//returns how many there were
+		int sphereOverlap(const Vec3f &center, float radius,
+						  std::vector<int> &triangles) const;
+
+		//Returns whether any triangle touches the sphere
+		bool sphereOverlaps(const Vec3f &center, float radius) const;
+
+		int nodeCount() const {
+			return (int)nodes.size();
+		}
+
+		int triangleCount() const {
+			return (int)order.size();
+		}
+
+		//Returns the number of levels below the root
+		int treeDepth() const {
+			return depth;
+		}
+	private:
+		std::vector<Node> nodes;
+		std::vector<int> order; //Model triangle in each slot
+		std::vector<float> corners; //The 3 corners (9 floats) of each slot
+		int maxLeafSize;
+		int depth;
+
+		struct Build;
+		int split(Build &build, Node &node, int begin, int end) const;
+		void buildSubtree(Build &build, int begin, int end,
+						  std::vector<Node> &out) const;
+};
+
+
+
+
+
+
+
+
+
+
+#endif
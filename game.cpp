@@ -0,0 +1,493 @@
+#include <algorithm>
+#include <cmath>
+#include <stdlib.h>
+#include <vector>
+#include "game.h"
+#include "terrain.h"
+
+using namespace std;
+
+BallGrid _balls;
+
+//Gloabal variables
+int current_view=3,pause_scene=1,game_start_flag=1,game_over_flag=0,score=0,game_time=100,enable=1;
+float pitch=0,roll=0,thrust=0.2,accn=0,vel=0,prev_temp;
+
+cell translation[3] = {
+    { 1, 120, 40, -5.0, 5.0, 0.0, 0.01,
+        "Specifies X coordinate of translation vector.", "%.2f" },
+    { 2, 180, 40, -5.0, 5.0, 0.0, 0.01,
+    "Specifies Y coordinate of translation vector.", "%.2f" },
+    { 3, 240, 40, -5.0, 5.0, 0.0, 0.01,
+    "Specifies Z coordinate of translation vector.", "%.2f" },
+};
+
+cell rotation[4] = {
+    { 4, 120, 80, -360.0, 360.0, 0.0, 1.0,
+        "Specifies angle of rotation, in degrees.", "%.1f" },
+    { 5, 180, 80, -1.0, 1.0, 0.0, 0.01,
+    "Specifies X coordinate of vector to rotate about.", "%.2f" },
+    { 6, 240, 80, -1.0, 1.0, 1.0, 0.01,
+    "Specifies Y coordinate of vector to rotate about.", "%.2f" },
+    { 7, 300, 80, -1.0, 1.0, 0.0, 0.01,
+    "Specifies Z coordinate of vector to rotate about.", "%.2f" },
+};
+
+cell scale[3] = {
+    {  8, 120, 120, -5.0, 5.0, 1.0, 0.01,
+        "Specifies scale factor along X axis.", "%.2f" },
+    {  9, 180, 120, -5.0, 5.0, 1.0, 0.01,
+    "Specifies scale factor along Y axis.", "%.2f" },
+    { 10, 240, 120, -5.0, 5.0, 1.0, 0.01,
+    "Specifies scale factor along Z axis.", "%.2f" },
+};
+
+Heading _heading;
+float eye[3] = { 0.0, 0.0, 2.0 };
+float at[3]  = { 0.0, 0.0, 0.0 };
+float up[3]  = { 0.0, 1.0, 0.0 };
+
+Terrain* _terrain;
+
+int BallGrid::column(float x) const {
+	return max(0, min((int)floorf(x / CELL), columns - 1));
+}
+
+int BallGrid::row(float z) const {
+	return max(0, min((int)floorf(z / CELL), rows - 1));
+}
+
+vector<int> &BallGrid::bucket(const Ball &ball) {
+	return cells[row(ball.pos[2]) * columns + column(ball.pos[0])];
+}
+
+void BallGrid::reset(int width, int length) {
+	balls.clear();
+	changes++;
+	columns = max(1, (width + CELL - 1) / CELL);
+	rows = max(1, (length + CELL - 1) / CELL);
+	cells.assign((size_t)columns * rows, vector<int>());
+}
+
+void BallGrid::add(const Ball &ball) {
+	vector<int> &b = bucket(ball);
+	balls.push_back(ball);
+	balls.back().slot = (int)b.size();
+	b.push_back((int)balls.size() - 1);
+	changes++;
+}
+
+void BallGrid::remove(size_t i) {
+	//Move the last ball in its bucket into its place there, and the last
+	//ball of all into its place in balls
+	vector<int> &b = bucket(balls[i]);
+	int slot = balls[i].slot;
+	b[slot] = b.back();
+	balls[b[slot]].slot = slot;
+	b.pop_back();
+	
+	size_t last = balls.size() - 1;
+	if (i != last) {
+		balls[i] = balls[last];
+		bucket(balls[i])[balls[i].slot] = (int)i;
+	}
+	balls.pop_back();
+	changes++;
+}
+
+int BallGrid::removeNear(const float* pos, float reach) {
+	if (balls.empty()) {
+		return 0;
+	}
+	int removed = 0;
+	int c1 = column(pos[0] + reach);
+	int r1 = row(pos[2] + reach);
+	for(int r = row(pos[2] - reach); r <= r1; r++) {
+		for(int c = column(pos[0] - reach); c <= c1; c++) {
+			vector<int> &b = cells[r * columns + c];
+			//Removing a ball moves another into its slot, so only step on
+			//when the ball stays
+			for(size_t j = 0; j < b.size();) {
+				const Ball &ball = balls[b[j]];
+				if (fabsf(ball.pos[0] - pos[0]) < reach &&
+					fabsf(ball.pos[1] - pos[1]) < reach &&
+					fabsf(ball.pos[2] - pos[2]) < reach) {
+					remove(b[j]);
+					removed++;
+				}
+				else {
+					j++;
+				}
+			}
+		}
+	}
+	return removed;
+}
+
+//Turns the bike to face degrees
+void setHeading(float degrees) {
+	rotation[0].value = degrees;
+	_heading.set(degrees);
+}
+
+void create_ball()
+{
+	for(int z = 0; z < _terrain->length() - 1; z++) {
+		
+		for(int x = 0; x < _terrain->width(); x++) {
+
+//			x, _terrain->getHeight(x, z), z 
+
+
+		if ((rand() % 5000)==1)
+		{
+
+			Ball ball;
+				
+				ball.pos[0] = x;
+				ball.pos[1] =_terrain->getHeight(x, z);
+				ball.pos[2] = z;
+				
+				ball.r = 0.5f;
+				ball.marked=0;
+				int color_code = rand() % 3;
+				if (color_code==0)//red
+				{
+				ball.color[0] = 1.0f;
+				ball.color[1] = 0.0f;
+				ball.color[2] = 0.0f;
+				}
+				else if (color_code==1) // green
+				{
+				ball.color[0] = 0.0f;
+				ball.color[1] = 1.0f;
+				ball.color[2] = 0.0f;	
+				}
+				else
+				{
+				ball.color[0] = 0.0f;
+				ball.color[1] = 0.0f;
+				ball.color[2] = 0.0f;	
+				}
+
+
+				_balls.add(ball);
+
+
+
+		}	
+		
+
+		}
+
+	}
+
+
+
+
+}
+
+
+void change_camera()
+{
+const Vec3f &forward = _heading.forward();
+if(current_view==0) //helicopter
+{
+			eye[0] =  translation[0].value -  10*forward[0];
+ 			 eye[1] = translation[1].value + 10;
+			 eye[2] =  translation[2].value -  10*forward[2];
+			 at[0]  =  translation[0].value + 4*forward[0];
+			 at[1]  =    translation[1].value + 0;
+			 at[2]  =  (translation[2].value +  4*forward[2]);
+}
+else if (current_view==1) // front wheel
+{
+	eye[0] =  translation[0].value;
+ 			 eye[1] = translation[1].value + 2 ;
+			 eye[2] =  translation[2].value ;
+			 at[0]  =  translation[0].value + 5*forward[0];
+			 at[1]  =    translation[1].value + 2;
+			 at[2]  =  (translation[2].value +  5*forward[2]);
+
+}
+else if (current_view==2) // driver
+{
+			eye[0] =  translation[0].value - 2.8*forward[0];
+ 			 eye[1] = translation[1].value +1;
+			 eye[2] =  translation[2].value - 2.8*forward[2];
+			 at[0]  =  translation[0].value + 2*forward[0];
+			 at[1]  =    translation[1].value +2;
+			 at[2]  =  (translation[2].value +  4*forward[2]);
+
+}
+else if (current_view==3) // overhead
+{
+			eye[0] =  translation[0].value -  10*forward[0];
+ 			 eye[1] = translation[1].value + 10;
+			 eye[2] =  translation[2].value -  12*forward[2];
+			 at[0]  =  translation[0].value + 10*forward[0];
+			 at[1]  =    translation[1].value + 0;
+			 at[2]  =  (translation[2].value +  10*forward[2]);
+}
+else if (current_view==4) // chase
+{
+			eye[0] =  translation[0].value - 5*forward[0];
+ 			 eye[1] = translation[1].value +1;
+			 eye[2] =  translation[2].value - 10*forward[2];
+			 at[0]  =  translation[0].value + 5*forward[0];
+			 at[1]  =    translation[1].value +2;
+			 at[2]  =  (translation[2].value +  5*forward[2]);
+}
+
+
+
+}
+
+
+void applyKeypress(unsigned char key) 
+{
+	switch (key) 
+		{
+
+
+		case 97: // a - roll
+			setHeading(rotation[0].value + 10);
+			break;
+
+		case 100: // d - roll
+			setHeading(rotation[0].value - 10);
+			break;
+		case 104:
+			if(enable==0)
+				enable=1;
+			else enable = 0;
+			break;
+
+
+		
+
+
+		case 118: //v - change view
+			current_view =(current_view + 1)%5;
+			change_camera();
+			
+
+ 
+			break;
+
+			
+
+
+
+
+		case 112:
+		
+
+		
+			if(pause_scene==0)
+				pause_scene=1;
+			else pause_scene=0;
+			break;
+
+		
+		case 13:
+			
+		      if(game_start_flag==1)
+				{
+					game_start_flag=0;
+					pause_scene=0;
+					
+				}
+			break;	
+			
+			
+    
+		}
+
+
+
+	
+}
+
+
+void applySpecialKey(int key) 
+{
+if (pause_scene==0)
+{
+
+    if (key == GAME_KEY_UP)
+	{
+		vel+=thrust;		
+
+
+	}
+if (key == GAME_KEY_DOWN)
+	{
+		vel-=thrust;
+
+
+       	
+	}
+    if (key == GAME_KEY_RIGHT)
+        {
+
+		
+		if(rotation[0].value - 3 < 0)
+			setHeading(360 + rotation[0].value - 3);
+		else
+			setHeading(rotation[0].value - 3);
+		rotation[1].value = 0.0;
+	        rotation[2].value = 1.0;
+	        rotation[3].value = 0.0;
+		roll += 2;
+
+
+	}
+if (key == GAME_KEY_LEFT)
+        {
+
+		if(rotation[0].value + 3 > 360)
+			setHeading(rotation[0].value + 3 - 360);
+		else
+			setHeading(rotation[0].value + 3);
+		rotation[1].value = 0.0;
+	        rotation[2].value = 1.0;
+	        rotation[3].value = 0.0;
+		roll -= 2;
+
+	}
+
+}
+}
+
+void resetGame() {
+	translation[0].value = 0;
+	translation[1].value = 0;
+	translation[2].value = 0;
+	setHeading(45);
+	rotation[1].value = 0.0;
+	rotation[2].value = 1.0;
+	rotation[3].value = 0.0;
+	pitch = 0;
+	roll = 0;
+	accn = 0;
+	vel = 0;
+	prev_temp = -10;
+	score = 0;
+	game_time = 100;
+	pause_scene = 1;
+	game_start_flag = 1;
+	game_over_flag = 0;
+	
+	_balls.reset(_terrain->width(), _terrain->length());
+	create_ball();
+	
+	change_camera();
+	followGround();
+}
+
+//Stops the bike at the edge of the terrain, so that it never looks up a
+//height or normal off the map
+void stayOnTerrain() {
+	float maxX = _terrain->width() - 1;
+	float maxZ = _terrain->length() - 1;
+	float x = translation[0].value;
+	float z = translation[2].value;
+	if (x < 0 || x > maxX || z < 0 || z > maxZ) {
+		translation[0].value = max(0.0f, min(x, maxX));
+		translation[2].value = max(0.0f, min(z, maxZ));
+		vel = 0;
+		accn = 0;
+	}
+}
+
+void followGround() {
+/* checking height of next point
+float tempx = translation[2].value + vel * 0.1 * _heading.forward()[2];
+float tempy = translation[0].value + vel * 0.1 * _heading.forward()[0];
+float next_height = _terrain->getHeight(int(tempx),int(tempy));*/
+float current_height = _terrain->getHeight(int(translation[0].value) ,int(translation[2].value))  +1; ;
+
+if(prev_temp > current_height + 0.1)
+{
+
+//translation[1].value = current_height + (current_height*0.1);
+translation[1].value = prev_temp ;
+
+pitch = 0;
+
+}
+else
+{
+translation[1].value = current_height; 
+
+}
+
+prev_temp = _terrain->getHeight(int(translation[0].value) ,int(translation[2].value))  +1; 
+}
+
+void step() {
+if(pause_scene==0)
+{
+
+if(game_time<=0)
+{
+  game_over_flag=1;
+pause_scene=1;
+}
+
+
+game_time--;
+
+float bikePos[3] = {translation[0].value, translation[1].value,
+	translation[2].value};
+int collected = _balls.removeNear(bikePos, 2);
+score += collected;
+game_time += 25 * collected;
+
+
+
+if(abs(roll)>25)
+{
+  game_over_flag=1;
+pause_scene=1;
+}
+
+
+
+// Calculation of pitch and roll
+Vec3f normal_new = _terrain->getNormal(translation[0].value, translation[2].value);
+float theta = acos(normal_new[1]/sqrt( (pow(normal_new[0],2)) + (pow(normal_new[1],2)) + (pow(normal_new[2],2))));
+theta = RAD2DEG(theta);
+pitch = theta;
+
+
+accn -= 0.00005*sin(DEG2RAD(theta)) ;
+vel += accn;
+
+
+translation[2].value += vel * 0.1 * _heading.forward()[2];
+translation[0].value += vel * 0.1 * _heading.forward()[0];
+stayOnTerrain();
+//printf("\nI was here\n %f %f %f \n\n",translation[0].value,translation[2].value,theta);
+
+
+		change_camera();        	
+
+
+}
+	followGround();
+}
+
+Pose currentPose() {
+	Pose pose;
+	for(int i = 0; i < 3; i++) {
+		pose.pos[i] = translation[i].value;
+		pose.eye[i] = eye[i];
+		pose.at[i] = at[i];
+	}
+	pose.heading = rotation[0].value;
+	pose.pitch = pitch;
+	pose.roll = roll;
+	return pose;
+}
@@ -0,0 +1,201 @@
+#ifndef GAME_H_INCLUDED
+#define GAME_H_INCLUDED
+
+#include <vector>
+#include "terrain.h"
+#include "vec3f.h"
+
+//The game itself: the bike, the balls to collect, the clock and the score,
+//advanced a tick at a time by step().  Nothing here draws or needs a
+//window, so the game can run on its own as well as under main3.cpp.
+
+#define PI 3.141592653589
+#define DEG2RAD(deg) (deg * PI / 180)
+#define RAD2DEG(rad) (rad * 180 / PI)
+
+//The game advances in fixed ticks of TICK_MS
+const int TICK_MS = 25;
+
+struct Ball {
+	
+	float pos[3]; //Position
+	float r; //Radius
+	float color[3];
+	int marked;
+	int slot; //Where it is in its BallGrid bucket
+};
+
+//The balls left to collect.  They are kept packed together, for drawing,
+//and also bucketed by which CELL by CELL square of the terrain they are
+//on, so that finding the balls near the bike only looks at a few buckets
+//however many balls there are.  Removing a ball moves the last one into
+//its place, both in the array and in its bucket, so it takes constant
+//time, but changes the order of the balls.
+class BallGrid {
+	private:
+		std::vector<Ball> balls;
+		std::vector<std::vector<int> > cells; //Indices into balls
+		int columns;
+		int rows;
+		unsigned changes; //Bumped whenever a ball is added or removed
+		
+		int column(float x) const;
+		int row(float z) const;
+		std::vector<int> &bucket(const Ball &ball);
+	public:
+		static const int CELL = 8;
+		
+		BallGrid() : columns(0), rows(0), changes(0) {
+			
+		}
+		
+		//Removes all the balls, and sizes the grid to cover a terrain of
+		//width by length
+		void reset(int width, int length);
+		
+		void add(const Ball &ball);
+		
+		//Removes balls[i]
+		void remove(size_t i);
+		
+		//Removes every ball less than reach from pos along each axis, and
+		//returns how many there were
+		int removeNear(const float* pos, float reach);
+		
+		size_t size() const {
+			return balls.size();
+		}
+		
+		const Ball &operator[](size_t i) const {
+			return balls[i];
+		}
+		
+		const std::vector<Ball> &all() const {
+			return balls;
+		}
+		
+		//Changes whenever the balls do, so that copies of all() need only
+		//be made again when it has
+		unsigned version() const {
+			return changes;
+		}
+};
+
+typedef struct _cell {
+    int id;
+    int x, y;
+    float min, max;
+    float value;
+    float step;
+    const char* info;
+    const char* format;
+} cell;
+
+//The special keys the game acts on; the window system's arrow keys are
+//translated to these
+enum GameKey {
+	GAME_KEY_LEFT,
+	GAME_KEY_UP,
+	GAME_KEY_RIGHT,
+	GAME_KEY_DOWN
+};
+
+//The bike's heading: rotation[0].value degrees about the y axis, kept
+//alongside the directions it points the bike in, so that the sine and
+//cosine are only worked out when the heading changes
+class Heading {
+	private:
+		float degrees;
+		Vec3f forwardVec;
+		Vec3f rightVec;
+	public:
+		Heading() : degrees(0), forwardVec(0, 0, 1), rightVec(-1, 0, 0) {
+			
+		}
+		
+		void set(float degrees2) {
+			if (degrees2 == degrees) {
+				return;
+			}
+			degrees = degrees2;
+			float s = sinf(DEG2RAD(degrees));
+			float c = cosf(DEG2RAD(degrees));
+			forwardVec = Vec3f(s, 0, c);
+			rightVec = Vec3f(-c, 0, s);
+		}
+		
+		float angle() const {
+			return degrees;
+		}
+		
+		//The way the bike faces, along the ground
+		const Vec3f &forward() const {
+			return forwardVec;
+		}
+		
+		//Off to the bike's right, along the ground
+		const Vec3f &right() const {
+			return rightVec;
+		}
+};
+
+//Where the bike and camera are at some moment
+struct Pose {
+	float pos[3];
+	float heading; //In degrees
+	float pitch;
+	float roll;
+	float eye[3];
+	float at[3];
+};
+
+extern BallGrid _balls;
+extern int current_view, pause_scene, game_start_flag, game_over_flag, score,
+	game_time, enable;
+extern float pitch, roll, thrust, accn, vel, prev_temp;
+extern cell translation[3];
+extern cell rotation[4];
+extern cell scale[3];
+extern Heading _heading;
+extern float eye[3], at[3], up[3]; //The camera, as gluLookAt takes it
+extern Terrain* _terrain;
+
+//Turns the bike to face degrees
+void setHeading(float degrees);
+
+//Points the camera at the bike from current_view
+void change_camera();
+
+//Scatters balls over _terrain
+void create_ball();
+
+//Starts a new game on _terrain: the bike back at the start, waiting for
+//Enter, and a new set of balls
+void resetGame();
+
+//Acts on a key press
+void applyKeypress(unsigned char key);
+
+//Acts on a press of one of the GameKeys
+void applySpecialKey(int key);
+
+//Keeps the bike on the ground, or in the air for a moment when it goes
+//over a crest
+void followGround();
+
+//Advances the game by one tick of TICK_MS
+void step();
+
+//Where the bike and camera are now
+Pose currentPose();
+
+
+
+
+
+
+
+
+
+
+#endif
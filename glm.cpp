@@ -18,20 +18,19 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <stddef.h>
+#include <charconv>
 #include "glm.h"
+#include "imageloader.h"
+#include "parallel.h"
+#if defined(__SSE2__) && !defined(GLM_NO_SIMD)
+#include <emmintrin.h>
+#endif
 
 #define GLM_MATERIAL 1
 #define T(x) (model->triangles[(x)])
 
 
-/* _GLMnode: general purpose node */
-typedef struct _GLMnode {
-    GLuint index;
-    GLboolean averaged;
-    struct _GLMnode* next;
-} GLMnode;
-
-
 /* glmMax: returns the maximum of two floats */
 static GLfloat
 glmMax(GLfloat a, GLfloat b) 
@@ -96,6 +95,39 @@ glmNormalize(GLfloat* v)
     v[2] /= l;
 }
 
+/* Define GLM_FAST_NORMALS to make the facet and vertex normals with an
+ * approximate reciprocal square root and one Newton-Raphson step instead
+ * of a square root and three divides.  The normals come out within a few
+ * parts in 10^7 of the exact ones, which lighting can't tell apart.
+ */
+#ifdef GLM_FAST_NORMALS
+/* glmNormalizeFast: normalize a vector, approximately
+ *
+ * v - array of 3 GLfloats (GLfloat v[3]) to be normalized
+ */
+static GLvoid
+glmNormalizeFast(GLfloat* v)
+{
+    GLfloat d, r;
+    
+    assert(v);
+    
+    d = v[0]*v[0] + v[1]*v[1] + v[2]*v[2];
+#if defined(__SSE2__) && !defined(GLM_NO_SIMD)
+    r = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(d)));
+    r = r * (1.5f - 0.5f * d * r * r);
+#else
+    r = 1.0f / (GLfloat)sqrt(d);
+#endif
+    v[0] *= r;
+    v[1] *= r;
+    v[2] *= r;
+}
+#define glmNormalizeNormal glmNormalizeFast
+#else
+#define glmNormalizeNormal glmNormalize
+#endif
+
 /* glmEqual: compares two vectors and returns GL_TRUE if they are
  * equal (within a certain threshold) or GL_FALSE if not. An epsilon
  * that works fairly well is 0.000001.
@@ -158,22 +190,336 @@ duplicate:
     return copies;
 }
 
+/* GLMhash: open addressing hash table that maps names to indices.
+ * The table does not own the names; they point at the interned copy
+ * kept in the group or material they refer to.
+ */
+typedef struct _GLMhash {
+    GLuint  size;               /* number of slots (a power of two) */
+    GLuint  count;              /* number of used slots */
+    char**  names;              /* name in each slot (NULL if empty) */
+    GLuint* values;             /* index stored with each name */
+} GLMhash;
+
+#define GLM_NOT_FOUND ((GLuint)-1)
+
+/* glmHashString: FNV-1a hash of a string */
+static GLuint
+glmHashString(const char* name)
+{
+    GLuint hash = 2166136261u;
+    
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* glmNewHash: create an empty hash table with room for at least
+ * count names before it has to grow.
+ */
+static GLMhash*
+glmNewHash(GLuint count)
+{
+    GLMhash* hash;
+    
+    hash = (GLMhash*)malloc(sizeof(GLMhash));
+    hash->size = 16;
+    while (hash->size < 2 * count)
+        hash->size *= 2;
+    hash->count = 0;
+    hash->names = (char**)calloc(hash->size, sizeof(char*));
+    hash->values = (GLuint*)malloc(sizeof(GLuint) * hash->size);
+    return hash;
+}
+
+/* glmDeleteHash: free a hash table (but not the names in it) */
+static GLvoid
+glmDeleteHash(GLMhash* hash)
+{
+    if (!hash)
+        return;
+    free(hash->names);
+    free(hash->values);
+    free(hash);
+}
+
+/* glmHashSlot: return the slot holding name, or the empty slot where
+ * it would be inserted.
+ */
+static GLuint
+glmHashSlot(GLMhash* hash, const char* name)
+{
+    GLuint mask = hash->size - 1;
+    GLuint slot = glmHashString(name) & mask;
+    
+    while (hash->names[slot] && strcmp(hash->names[slot], name))
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+/* glmHashFind: return the index stored for name, or GLM_NOT_FOUND */
+static GLuint
+glmHashFind(GLMhash* hash, const char* name)
+{
+    GLuint slot;
+    
+    if (!hash)
+        return GLM_NOT_FOUND;
+    slot = glmHashSlot(hash, name);
+    return hash->names[slot] ? hash->values[slot] : GLM_NOT_FOUND;
+}
+
+/* glmHashInsert: store value for name, unless name is already in the
+ * table (the first index stored for a name wins).
+ */
+static GLvoid
+glmHashInsert(GLMhash* hash, char* name, GLuint value)
+{
+    char** names;
+    GLuint* values;
+    GLuint size, slot, i;
+    
+    /* keep the table at most half full */
+    if (2 * (hash->count + 1) > hash->size) {
+        names = hash->names;
+        values = hash->values;
+        size = hash->size;
+        hash->size *= 2;
+        hash->names = (char**)calloc(hash->size, sizeof(char*));
+        hash->values = (GLuint*)malloc(sizeof(GLuint) * hash->size);
+        for (i = 0; i < size; i++) {
+            if (names[i]) {
+                slot = glmHashSlot(hash, names[i]);
+                hash->names[slot] = names[i];
+                hash->values[slot] = values[i];
+            }
+        }
+        free(names);
+        free(values);
+    }
+    
+    slot = glmHashSlot(hash, name);
+    if (!hash->names[slot]) {
+        hash->names[slot] = name;
+        hash->values[slot] = value;
+        hash->count++;
+    }
+}
+
+/* glmLinkGroups: thread the groups in grouparray into the model's
+ * linked list, newest group first.
+ */
+static GLvoid
+glmLinkGroups(GLMmodel* model)
+{
+    GLuint i;
+    
+    model->groups = NULL;
+    for (i = 0; i < model->numgroups; i++) {
+        model->grouparray[i].next = model->groups;
+        model->groups = &model->grouparray[i];
+    }
+}
+
+/* GLM_ARENA_ALIGN: round a size up to a whole number of cache lines,
+ * so that every array carved out of an arena starts on one.
+ */
+#define GLM_ARENA_ALIGN(size) (((size_t)(size) + 63) & ~(size_t)63)
+
+/* glmInArena: returns GL_TRUE if p points into the model's arena (and
+ * so must not be free'd on its own).
+ */
+static GLboolean
+glmInArena(GLMmodel* model, void* p)
+{
+    return model->arena && (char*)p >= model->arena &&
+        (char*)p < model->arena + model->arenasize;
+}
+
+/* glmFreeArray: free a piece of a model unless it lives in the arena */
+static GLvoid
+glmFreeArray(GLMmodel* model, void* p)
+{
+    if (p && !glmInArena(model, p))
+        free(p);
+}
+
+/* glmArenaTake: hand out size bytes at *cursor (copying data into them
+ * if it is not NULL) and move the cursor past them.
+ */
+static GLvoid*
+glmArenaTake(char** cursor, const GLvoid* data, size_t size)
+{
+    GLvoid* p = *cursor;
+    
+    if (data)
+        memcpy(p, data, size);
+    *cursor += GLM_ARENA_ALIGN(size);
+    return p;
+}
+
+/* glmArenaString: copy a string into the arena */
+static char*
+glmArenaString(char** cursor, const char* s)
+{
+    return s ? (char*)glmArenaTake(cursor, s, strlen(s) + 1) : NULL;
+}
+
+/* glmArenaStringSize: arena space taken by a string */
+static size_t
+glmArenaStringSize(const char* s)
+{
+    return s ? GLM_ARENA_ALIGN(strlen(s) + 1) : 0;
+}
+
+/* glmPack: make a copy of a model in a single block of memory (its
+ * arena), with the GLMmodel itself at the start of the block.  The
+ * names, materials and groups of source are copied, as are whichever
+ * of its vertex, normal, texcoord, facet normal, triangle and group
+ * triangle arrays exist.  Arrays that are counted but don't exist yet
+ * (as after glmFirstPass) get uninitialized space of the right size.
+ *
+ * source - GLMmodel structure with at least its counts, names,
+ *          materials and groups filled in
+ */
+static GLMmodel*
+glmPack(GLMmodel* source)
+{
+    GLMmodel* model;
+    GLMgroup* from;
+    GLMgroup* group;
+    char* cursor;
+    size_t size;
+    GLuint i;
+    
+    /* add up the space for everything */
+    size = GLM_ARENA_ALIGN(sizeof(GLMmodel));
+    size += glmArenaStringSize(source->pathname);
+    size += glmArenaStringSize(source->mtllibname);
+    size += GLM_ARENA_ALIGN(sizeof(GLMmaterial) * source->nummaterials);
+    for (i = 0; i < source->nummaterials; i++)
+        size += glmArenaStringSize(source->materials[i].name);
+    size += GLM_ARENA_ALIGN(sizeof(GLMgroup) * source->numgroups);
+    for (i = 0; i < source->numgroups; i++) {
+        size += glmArenaStringSize(source->grouparray[i].name);
+        size += GLM_ARENA_ALIGN(sizeof(GLuint) * source->grouparray[i].numtriangles);
+    }
+    size += GLM_ARENA_ALIGN(sizeof(GLfloat) * 3 * (source->numvertices + 1));
+    if (source->normals || source->numnormals)
+        size += GLM_ARENA_ALIGN(sizeof(GLfloat) * 3 * (source->numnormals + 1));
+    if (source->texcoords || source->numtexcoords)
+        size += GLM_ARENA_ALIGN(sizeof(GLfloat) * 2 * (source->numtexcoords + 1));
+    if (source->facetnorms)
+        size += GLM_ARENA_ALIGN(sizeof(GLfloat) * 3 * (source->numfacetnorms + 1));
+    size += GLM_ARENA_ALIGN(sizeof(GLMtriangle) * source->numtriangles);
+    
+    /* then carve it up */
+    cursor = (char*)malloc(size);
+    model = (GLMmodel*)glmArenaTake(&cursor, source, sizeof(GLMmodel));
+    model->arena = (char*)model;
+    model->arenasize = size;
+    model->grouphash = NULL;
+    model->materialhash = NULL;
+    model->pathname = glmArenaString(&cursor, source->pathname);
+    model->mtllibname = glmArenaString(&cursor, source->mtllibname);
+    
+    model->materials = NULL;
+    if (source->nummaterials) {
+        model->materials = (GLMmaterial*)glmArenaTake(&cursor,
+            source->materials, sizeof(GLMmaterial) * source->nummaterials);
+        for (i = 0; i < source->nummaterials; i++) {
+            model->materials[i].name =
+                glmArenaString(&cursor, source->materials[i].name);
+        }
+    }
+    
+    model->grouparray = (GLMgroup*)glmArenaTake(&cursor, NULL,
+        sizeof(GLMgroup) * source->numgroups);
+    model->maxgroups = source->numgroups;
+    for (i = 0; i < source->numgroups; i++) {
+        from = &source->grouparray[i];
+        group = &model->grouparray[i];
+        group->name = glmArenaString(&cursor, from->name);
+        group->numtriangles = from->numtriangles;
+        group->material = from->material;
+        group->triangles = (GLuint*)glmArenaTake(&cursor, from->triangles,
+            sizeof(GLuint) * from->numtriangles);
+    }
+    glmLinkGroups(model);
+    
+    model->vertices = (GLfloat*)glmArenaTake(&cursor, source->vertices,
+        sizeof(GLfloat) * 3 * (source->numvertices + 1));
+    if (source->normals || source->numnormals) {
+        model->normals = (GLfloat*)glmArenaTake(&cursor, source->normals,
+            sizeof(GLfloat) * 3 * (source->numnormals + 1));
+    }
+    if (source->texcoords || source->numtexcoords) {
+        model->texcoords = (GLfloat*)glmArenaTake(&cursor, source->texcoords,
+            sizeof(GLfloat) * 2 * (source->numtexcoords + 1));
+    }
+    if (source->facetnorms) {
+        model->facetnorms = (GLfloat*)glmArenaTake(&cursor, source->facetnorms,
+            sizeof(GLfloat) * 3 * (source->numfacetnorms + 1));
+    }
+    model->triangles = (GLMtriangle*)glmArenaTake(&cursor, source->triangles,
+        sizeof(GLMtriangle) * source->numtriangles);
+    
+    return model;
+}
+
+/* glmFreeParts: free every piece of a model that was allocated on its
+ * own rather than from the arena (all of them, if there is no arena),
+ * leaving the GLMmodel structure and arena themselves.
+ */
+static GLvoid
+glmFreeParts(GLMmodel* model)
+{
+    GLuint i;
+    
+    glmFreeArray(model, model->pathname);
+    glmFreeArray(model, model->mtllibname);
+    glmFreeArray(model, model->vertices);
+    glmFreeArray(model, model->normals);
+    glmFreeArray(model, model->texcoords);
+    glmFreeArray(model, model->facetnorms);
+    glmFreeArray(model, model->triangles);
+    if (model->materials) {
+        for (i = 0; i < model->nummaterials; i++)
+            glmFreeArray(model, model->materials[i].name);
+    }
+    glmFreeArray(model, model->materials);
+    for (i = 0; i < model->numgroups; i++) {
+        glmFreeArray(model, model->grouparray[i].name);
+        glmFreeArray(model, model->grouparray[i].triangles);
+    }
+    glmFreeArray(model, model->grouparray);
+    glmDeleteHash(model->grouphash);
+    glmDeleteHash(model->materialhash);
+    model->grouphash = NULL;
+    model->materialhash = NULL;
+}
+
 /* glmFindGroup: Find a group in the model */
 GLMgroup*
 glmFindGroup(GLMmodel* model, char* name)
 {
-    GLMgroup* group;
+    GLuint i;
     
     assert(model);
     
-    group = model->groups;
-    while(group) {
-        if (!strcmp(name, group->name))
-            break;
-        group = group->next;
+    /* (re)build the index if it was dropped after loading */
+    if (!model->grouphash && model->numgroups) {
+        model->grouphash = glmNewHash(model->numgroups);
+        for (i = 0; i < model->numgroups; i++)
+            glmHashInsert(model->grouphash, model->grouparray[i].name, i);
     }
     
-    return group;
+    i = glmHashFind(model->grouphash, name);
+    if (i == GLM_NOT_FOUND)
+        return NULL;
+    return &model->grouparray[i];
 }
 
 /* glmAddGroup: Add a group to the model */
@@ -184,38 +530,62 @@ glmAddGroup(GLMmodel* model, char* name)
     
     group = glmFindGroup(model, name);
     if (!group) {
-        group = (GLMgroup*)malloc(sizeof(GLMgroup));
+        if (!model->grouphash)
+            model->grouphash = glmNewHash(16);
+        
+        /* grow the group storage, which moves the groups, so the list
+        has to be linked up again */
+        if (model->numgroups == model->maxgroups) {
+            model->maxgroups = model->maxgroups ? 2 * model->maxgroups : 16;
+            if (glmInArena(model, model->grouparray)) {
+                group = (GLMgroup*)malloc(sizeof(GLMgroup) * model->maxgroups);
+                memcpy(group, model->grouparray,
+                    sizeof(GLMgroup) * model->numgroups);
+                model->grouparray = group;
+            } else {
+                model->grouparray = (GLMgroup*)realloc(model->grouparray,
+                    sizeof(GLMgroup) * model->maxgroups);
+            }
+            glmLinkGroups(model);
+        }
+        
+        group = &model->grouparray[model->numgroups];
         group->name = strdup(name);
         group->material = 0;
         group->numtriangles = 0;
         group->triangles = NULL;
         group->next = model->groups;
         model->groups = group;
+        glmHashInsert(model->grouphash, group->name, model->numgroups);
         model->numgroups++;
     }
     
     return group;
 }
 
-/* glmFindGroup: Find a material in the model */
+/* glmFindMaterial: Find a material in the model */
 GLuint
 glmFindMaterial(GLMmodel* model, char* name)
 {
     GLuint i;
     
-    /* XXX doing a linear search on a string key'd list is pretty lame,
-    but it works and is fast enough for now. */
-    for (i = 0; i < model->nummaterials; i++) {
-        if (!strcmp(model->materials[i].name, name))
-            goto found;
+    /* (re)build the index if it was dropped after loading */
+    if (!model->materialhash && model->materials) {
+        model->materialhash = glmNewHash(model->nummaterials);
+        for (i = 0; i < model->nummaterials; i++) {
+            if (model->materials[i].name)
+                glmHashInsert(model->materialhash, model->materials[i].name, i);
+        }
     }
     
-    /* didn't find the name, so print a warning and return the default
-    material (0). */
-    printf("glmFindMaterial():  can't find material \"%s\".\n", name);
-    i = 0;
+    i = glmHashFind(model->materialhash, name);
+    if (i == GLM_NOT_FOUND) {
+        /* didn't find the name, so print a warning and return the default
+        material (0). */
+        printf("glmFindMaterial():  can't find material \"%s\".\n", name);
+        i = 0;
+    }
     
-found:
     return i;
 }
 
@@ -370,6 +740,14 @@ glmReadMTL(GLMmodel* model, char* name)
     }
 
     fclose(file);
+    
+    /* index the materials by name */
+    glmDeleteHash(model->materialhash);
+    model->materialhash = glmNewHash(model->nummaterials);
+    for (i = 0; i < model->nummaterials; i++) {
+        if (model->materials[i].name)
+            glmHashInsert(model->materialhash, model->materials[i].name, i);
+    }
 }
 
 /* glmWriteMTL: write a wavefront material library file
@@ -482,6 +860,7 @@ glmFirstPass(GLMmodel* model, FILE* file)
             case 'm':
                 fgets(buf, sizeof(buf), file);
                 sscanf(buf, "%s %s", buf, buf);
+                free(model->mtllibname);
                 model->mtllibname = strdup(buf);
                 glmReadMTL(model, buf);
                 break;
@@ -559,14 +938,6 @@ glmFirstPass(GLMmodel* model, FILE* file)
   model->numnormals   = numnormals;
   model->numtexcoords = numtexcoords;
   model->numtriangles = numtriangles;
-  
-  /* allocate memory for the triangles in each group */
-  group = model->groups;
-  while(group) {
-      group->triangles = (GLuint*)malloc(sizeof(GLuint) * group->numtriangles);
-      group->numtriangles = 0;
-      group = group->next;
-  }
 }
 
 /* glmSecondPass: second pass at a Wavefront OBJ file that gets all
@@ -762,6 +1133,360 @@ glmSecondPass(GLMmodel* model, FILE* file)
 }
 
 
+/* model kernels
+ *
+ * The per-vertex and per-triangle loops behind glmUnitize(),
+ * glmDimensions(), glmScale(), glmFacetNormals() and glmLinearTexture()
+ * work on a range of the model at a time, so that large models can be
+ * split across the thread pool.  Each has a plain C version and, unless
+ * GLM_NO_SIMD is defined, an SSE2 version that gives the same results.
+ */
+
+#define GLM_GRAIN 16384         /* vertices or triangles per parallel chunk */
+
+/* glmBoundsScalar: grow min/max (3 GLfloats each) to take in vertices
+ * first..last-1
+ */
+static GLvoid
+glmBoundsScalar(const GLfloat* vertices, size_t first, size_t last,
+                GLfloat* min, GLfloat* max)
+{
+    size_t i;
+    GLuint j;
+    
+    for (i = first; i < last; i++) {
+        for (j = 0; j < 3; j++) {
+            if (max[j] < vertices[3 * i + j])
+                max[j] = vertices[3 * i + j];
+            if (min[j] > vertices[3 * i + j])
+                min[j] = vertices[3 * i + j];
+        }
+    }
+}
+
+/* glmTransformScalar: translate vertices first..last-1 by -center and
+ * then scale them
+ */
+static GLvoid
+glmTransformScalar(GLfloat* vertices, size_t first, size_t last,
+                   const GLfloat* center, GLfloat scale)
+{
+    size_t i;
+    GLuint j;
+    
+    for (i = first; i < last; i++) {
+        for (j = 0; j < 3; j++)
+            vertices[3 * i + j] = (vertices[3 * i + j] - center[j]) * scale;
+    }
+}
+
+/* glmFacetNormalsScalar: compute the facet normals (1-based) of
+ * triangles first..last-1 and point their findex at them
+ * (numvertices is only needed by the SIMD version)
+ */
+static GLvoid
+glmFacetNormalsScalar(const GLfloat* vertices, GLuint numvertices,
+                      GLMtriangle* triangles, GLfloat* facetnorms,
+                      size_t first, size_t last)
+{
+    const GLfloat* p0;
+    const GLfloat* p1;
+    const GLfloat* p2;
+    GLfloat u[3];
+    GLfloat v[3];
+    size_t i;
+    
+    for (i = first; i < last; i++) {
+        triangles[i].findex = i+1;
+        
+        p0 = &vertices[3 * triangles[i].vindices[0]];
+        p1 = &vertices[3 * triangles[i].vindices[1]];
+        p2 = &vertices[3 * triangles[i].vindices[2]];
+        u[0] = p1[0] - p0[0];
+        u[1] = p1[1] - p0[1];
+        u[2] = p1[2] - p0[2];
+        v[0] = p2[0] - p0[0];
+        v[1] = p2[1] - p0[1];
+        v[2] = p2[2] - p0[2];
+        
+        glmCross(u, v, &facetnorms[3 * (i+1)]);
+        glmNormalizeNormal(&facetnorms[3 * (i+1)]);
+    }
+}
+
+/* glmLinearTextureScalar: planar (x, z) texture coordinates of vertices
+ * first..last-1
+ */
+static GLvoid
+glmLinearTextureScalar(const GLfloat* vertices, GLfloat* texcoords,
+                       size_t first, size_t last, GLfloat scalefactor)
+{
+    GLfloat x, y;
+    size_t i;
+    
+    for (i = first; i < last; i++) {
+        x = vertices[3 * i + 0] * scalefactor;
+        y = vertices[3 * i + 2] * scalefactor;
+        texcoords[2 * i + 0] = (x + 1.0) / 2.0;
+        texcoords[2 * i + 1] = (y + 1.0) / 2.0;
+    }
+}
+
+#if defined(__SSE2__) && !defined(GLM_NO_SIMD)
+#define GLM_SIMD 1
+
+/* Packed xyz vertices are taken 4 at a time as 3 registers, whose
+ * lanes hold x y z x | y z x y | z x y z.  A per-axis constant is
+ * spread over 3 registers in the same pattern by glmSpreadXYZ().
+ */
+static GLvoid
+glmSpreadXYZ(const GLfloat* v, __m128* r)
+{
+    r[0] = _mm_setr_ps(v[0], v[1], v[2], v[0]);
+    r[1] = _mm_setr_ps(v[1], v[2], v[0], v[1]);
+    r[2] = _mm_setr_ps(v[2], v[0], v[1], v[2]);
+}
+
+/* glmBoundsSIMD: SSE2 version of glmBoundsScalar() */
+static GLvoid
+glmBoundsSIMD(const GLfloat* vertices, size_t first, size_t last,
+              GLfloat* min, GLfloat* max)
+{
+    static const GLuint lane[3][4] = {   /* register*4+lane for each axis */
+        { 0, 3, 6, 9 }, { 1, 4, 7, 10 }, { 2, 5, 8, 11 } };
+    __m128 lo[3], hi[3], a;
+    GLfloat los[12], his[12];
+    const GLfloat* p;
+    size_t i;
+    GLuint j, k;
+    
+    glmSpreadXYZ(min, lo);
+    glmSpreadXYZ(max, hi);
+    p = vertices + 3 * first;
+    for (i = first; i + 4 <= last; i += 4, p += 12) {
+        for (k = 0; k < 3; k++) {
+            a = _mm_loadu_ps(p + 4 * k);
+            lo[k] = _mm_min_ps(lo[k], a);
+            hi[k] = _mm_max_ps(hi[k], a);
+        }
+    }
+    for (k = 0; k < 3; k++) {
+        _mm_storeu_ps(los + 4 * k, lo[k]);
+        _mm_storeu_ps(his + 4 * k, hi[k]);
+    }
+    /* lane l of register k holds axis (4*k+l) % 3 */
+    for (j = 0; j < 3; j++) {
+        for (k = 0; k < 4; k++) {
+            if (max[j] < his[lane[j][k]])
+                max[j] = his[lane[j][k]];
+            if (min[j] > los[lane[j][k]])
+                min[j] = los[lane[j][k]];
+        }
+    }
+    glmBoundsScalar(vertices, i, last, min, max);
+}
+
+/* glmTransformSIMD: SSE2 version of glmTransformScalar() */
+static GLvoid
+glmTransformSIMD(GLfloat* vertices, size_t first, size_t last,
+                 const GLfloat* center, GLfloat scale)
+{
+    __m128 c[3], s;
+    GLfloat* p;
+    size_t i;
+    GLuint k;
+    
+    glmSpreadXYZ(center, c);
+    s = _mm_set1_ps(scale);
+    p = vertices + 3 * first;
+    for (i = first; i + 4 <= last; i += 4, p += 12) {
+        for (k = 0; k < 3; k++) {
+            _mm_storeu_ps(p + 4 * k,
+                _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(p + 4 * k), c[k]), s));
+        }
+    }
+    glmTransformScalar(vertices, i, last, center, scale);
+}
+
+/* glmFacetNormalsSIMD: SSE2 version of glmFacetNormalsScalar(), which
+ * loads the corners of 4 triangles and transposes them into x, y and z
+ * registers.  A vertex is loaded as 4 floats, so triangles that use the
+ * last one (numvertices) are left to the scalar code.
+ */
+static GLvoid
+glmFacetNormalsSIMD(const GLfloat* vertices, GLuint numvertices,
+                    GLMtriangle* triangles, GLfloat* facetnorms,
+                    size_t first, size_t last)
+{
+    __m128 x[3], y[3], z[3], w;
+    __m128 ux, uy, uz, vx, vy, vz, nx, ny, nz, l;
+    GLfloat n[4];
+    GLMtriangle* t;
+    size_t i;
+    GLuint j, k;
+    
+    for (i = first; i + 4 <= last; i += 4) {
+        t = &triangles[i];
+        for (k = 0; k < 4; k++) {
+            if (t[k].vindices[0] == numvertices ||
+                t[k].vindices[1] == numvertices ||
+                t[k].vindices[2] == numvertices)
+                break;
+        }
+        if (k < 4) {
+            glmFacetNormalsScalar(vertices, numvertices, triangles, facetnorms,
+                i, i + 4);
+            continue;
+        }
+        
+        for (j = 0; j < 3; j++) {
+            x[j] = _mm_loadu_ps(&vertices[3 * t[0].vindices[j]]);
+            y[j] = _mm_loadu_ps(&vertices[3 * t[1].vindices[j]]);
+            z[j] = _mm_loadu_ps(&vertices[3 * t[2].vindices[j]]);
+            w = _mm_loadu_ps(&vertices[3 * t[3].vindices[j]]);
+            _MM_TRANSPOSE4_PS(x[j], y[j], z[j], w);
+        }
+        ux = _mm_sub_ps(x[1], x[0]);
+        uy = _mm_sub_ps(y[1], y[0]);
+        uz = _mm_sub_ps(z[1], z[0]);
+        vx = _mm_sub_ps(x[2], x[0]);
+        vy = _mm_sub_ps(y[2], y[0]);
+        vz = _mm_sub_ps(z[2], z[0]);
+        
+        nx = _mm_sub_ps(_mm_mul_ps(uy, vz), _mm_mul_ps(uz, vy));
+        ny = _mm_sub_ps(_mm_mul_ps(uz, vx), _mm_mul_ps(ux, vz));
+        nz = _mm_sub_ps(_mm_mul_ps(ux, vy), _mm_mul_ps(uy, vx));
+#ifdef GLM_FAST_NORMALS
+        /* l = 1 / length, refined by r * (1.5 - 0.5 * d * r * r) */
+        w = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx),
+            _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz));
+        l = _mm_rsqrt_ps(w);
+        l = _mm_mul_ps(l, _mm_sub_ps(_mm_set1_ps(1.5f),
+            _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), w), _mm_mul_ps(l, l))));
+        nx = _mm_mul_ps(nx, l);
+        ny = _mm_mul_ps(ny, l);
+        nz = _mm_mul_ps(nz, l);
+#else
+        l = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx),
+            _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz)));
+        nx = _mm_div_ps(nx, l);
+        ny = _mm_div_ps(ny, l);
+        nz = _mm_div_ps(nz, l);
+#endif
+        w = _mm_setzero_ps();
+        _MM_TRANSPOSE4_PS(nx, ny, nz, w);
+        
+        /* each store spills a float into the next normal, which is
+        written after it; the last normal is written on its own so that
+        nothing is stored past this range */
+        _mm_storeu_ps(&facetnorms[3 * (i+1)], nx);
+        _mm_storeu_ps(&facetnorms[3 * (i+2)], ny);
+        _mm_storeu_ps(n, nz);
+        facetnorms[3 * (i+3) + 0] = n[0];
+        facetnorms[3 * (i+3) + 1] = n[1];
+        facetnorms[3 * (i+3) + 2] = n[2];
+        _mm_storeu_ps(n, w);
+        facetnorms[3 * (i+4) + 0] = n[0];
+        facetnorms[3 * (i+4) + 1] = n[1];
+        facetnorms[3 * (i+4) + 2] = n[2];
+        for (k = 0; k < 4; k++)
+            t[k].findex = i+k+1;
+    }
+    glmFacetNormalsScalar(vertices, numvertices, triangles, facetnorms,
+        i, last);
+}
+
+/* glmLinearTextureSIMD: SSE2 version of glmLinearTextureScalar() */
+static GLvoid
+glmLinearTextureSIMD(const GLfloat* vertices, GLfloat* texcoords,
+                     size_t first, size_t last, GLfloat scalefactor)
+{
+    __m128 s, one, half, x, y;
+    const GLfloat* p;
+    size_t i;
+    
+    s = _mm_set1_ps(scalefactor);
+    one = _mm_set1_ps(1.0f);
+    half = _mm_set1_ps(0.5f);
+    for (i = first; i + 4 <= last; i += 4) {
+        p = &vertices[3 * i];
+        x = _mm_setr_ps(p[0], p[3], p[6], p[9]);
+        y = _mm_setr_ps(p[2], p[5], p[8], p[11]);
+        x = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(x, s), one), half);
+        y = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(y, s), one), half);
+        _mm_storeu_ps(&texcoords[2 * i + 0], _mm_unpacklo_ps(x, y));
+        _mm_storeu_ps(&texcoords[2 * i + 4], _mm_unpackhi_ps(x, y));
+    }
+    glmLinearTextureScalar(vertices, texcoords, i, last, scalefactor);
+}
+
+#define glmBoundsRange        glmBoundsSIMD
+#define glmTransformRange     glmTransformSIMD
+#define glmFacetNormalsRange  glmFacetNormalsSIMD
+#define glmLinearTextureRange glmLinearTextureSIMD
+#else
+#define glmBoundsRange        glmBoundsScalar
+#define glmTransformRange     glmTransformScalar
+#define glmFacetNormalsRange  glmFacetNormalsScalar
+#define glmLinearTextureRange glmLinearTextureScalar
+#endif
+
+/* glmBounds: find the minimum and maximum corners (3 GLfloats each) of
+ * the box around a model's vertices
+ */
+static GLvoid
+glmBounds(GLMmodel* model, GLfloat* min, GLfloat* max)
+{
+    GLfloat* vertices = model->vertices;
+    size_t last = (size_t)model->numvertices + 1;
+    size_t numchunks = (model->numvertices + GLM_GRAIN - 1) / GLM_GRAIN;
+    GLfloat* partial;
+    size_t c;
+    GLuint j;
+    
+    /* each chunk finds its own box, starting from its first vertex */
+    partial = (GLfloat*)malloc(sizeof(GLfloat) * 6 * (numchunks + 1));
+    parallelFor(0, numchunks, 1, [&](size_t b, size_t e) {
+        for (size_t c = b; c < e; c++) {
+            GLfloat* lo = &partial[6 * c];
+            GLfloat* hi = lo + 3;
+            size_t first = 1 + c * GLM_GRAIN;
+            
+            for (GLuint j = 0; j < 3; j++)
+                lo[j] = hi[j] = vertices[3 * first + j];
+            glmBoundsRange(vertices, first,
+                std::min(first + GLM_GRAIN, last), lo, hi);
+        }
+    });
+    
+    for (j = 0; j < 3; j++)
+        min[j] = max[j] = vertices[3 + j];
+    for (c = 0; c < numchunks; c++) {
+        for (j = 0; j < 3; j++) {
+            if (max[j] < partial[6 * c + 3 + j])
+                max[j] = partial[6 * c + 3 + j];
+            if (min[j] > partial[6 * c + j])
+                min[j] = partial[6 * c + j];
+        }
+    }
+    free(partial);
+}
+
+/* glmTransform: translate a model's vertices by -center, then scale
+ * them
+ */
+static GLvoid
+glmTransform(GLMmodel* model, const GLfloat* center, GLfloat scale)
+{
+    GLfloat* vertices = model->vertices;
+    
+    parallelFor(1, (size_t)model->numvertices + 1, GLM_GRAIN,
+        [&](size_t b, size_t e) {
+            glmTransformRange(vertices, b, e, center, scale);
+        });
+}
+
+
 /* public functions */
 
 
@@ -774,57 +1499,31 @@ glmSecondPass(GLMmodel* model, FILE* file)
 GLfloat
 glmUnitize(GLMmodel* model)
 {
-    GLuint i;
-    GLfloat maxx, minx, maxy, miny, maxz, minz;
-    GLfloat cx, cy, cz, w, h, d;
+    GLfloat min[3], max[3], center[3];
+    GLfloat w, h, d;
     GLfloat scale;
     
     assert(model);
     assert(model->vertices);
     
     /* get the max/mins */
-    maxx = minx = model->vertices[3 + 0];
-    maxy = miny = model->vertices[3 + 1];
-    maxz = minz = model->vertices[3 + 2];
-    for (i = 1; i <= model->numvertices; i++) {
-        if (maxx < model->vertices[3 * i + 0])
-            maxx = model->vertices[3 * i + 0];
-        if (minx > model->vertices[3 * i + 0])
-            minx = model->vertices[3 * i + 0];
-        
-        if (maxy < model->vertices[3 * i + 1])
-            maxy = model->vertices[3 * i + 1];
-        if (miny > model->vertices[3 * i + 1])
-            miny = model->vertices[3 * i + 1];
-        
-        if (maxz < model->vertices[3 * i + 2])
-            maxz = model->vertices[3 * i + 2];
-        if (minz > model->vertices[3 * i + 2])
-            minz = model->vertices[3 * i + 2];
-    }
+    glmBounds(model, min, max);
     
     /* calculate model width, height, and depth */
-    w = glmAbs(maxx) + glmAbs(minx);
-    h = glmAbs(maxy) + glmAbs(miny);
-    d = glmAbs(maxz) + glmAbs(minz);
+    w = glmAbs(max[0]) + glmAbs(min[0]);
+    h = glmAbs(max[1]) + glmAbs(min[1]);
+    d = glmAbs(max[2]) + glmAbs(min[2]);
     
     /* calculate center of the model */
-    cx = (maxx + minx) / 2.0;
-    cy = (maxy + miny) / 2.0;
-    cz = (maxz + minz) / 2.0;
+    center[0] = (max[0] + min[0]) / 2.0;
+    center[1] = (max[1] + min[1]) / 2.0;
+    center[2] = (max[2] + min[2]) / 2.0;
     
     /* calculate unitizing scale factor */
     scale = 2.0 / glmMax(glmMax(w, h), d);
     
     /* translate around center then scale */
-    for (i = 1; i <= model->numvertices; i++) {
-        model->vertices[3 * i + 0] -= cx;
-        model->vertices[3 * i + 1] -= cy;
-        model->vertices[3 * i + 2] -= cz;
-        model->vertices[3 * i + 0] *= scale;
-        model->vertices[3 * i + 1] *= scale;
-        model->vertices[3 * i + 2] *= scale;
-    }
+    glmTransform(model, center, scale);
     
     return scale;
 }
@@ -838,38 +1537,19 @@ glmUnitize(GLMmodel* model)
 GLvoid
 glmDimensions(GLMmodel* model, GLfloat* dimensions)
 {
-    GLuint i;
-    GLfloat maxx, minx, maxy, miny, maxz, minz;
+    GLfloat min[3], max[3];
     
     assert(model);
     assert(model->vertices);
     assert(dimensions);
     
     /* get the max/mins */
-    maxx = minx = model->vertices[3 + 0];
-    maxy = miny = model->vertices[3 + 1];
-    maxz = minz = model->vertices[3 + 2];
-    for (i = 1; i <= model->numvertices; i++) {
-        if (maxx < model->vertices[3 * i + 0])
-            maxx = model->vertices[3 * i + 0];
-        if (minx > model->vertices[3 * i + 0])
-            minx = model->vertices[3 * i + 0];
-        
-        if (maxy < model->vertices[3 * i + 1])
-            maxy = model->vertices[3 * i + 1];
-        if (miny > model->vertices[3 * i + 1])
-            miny = model->vertices[3 * i + 1];
-        
-        if (maxz < model->vertices[3 * i + 2])
-            maxz = model->vertices[3 * i + 2];
-        if (minz > model->vertices[3 * i + 2])
-            minz = model->vertices[3 * i + 2];
-    }
+    glmBounds(model, min, max);
     
     /* calculate model width, height, and depth */
-    dimensions[0] = glmAbs(maxx) + glmAbs(minx);
-    dimensions[1] = glmAbs(maxy) + glmAbs(miny);
-    dimensions[2] = glmAbs(maxz) + glmAbs(minz);
+    dimensions[0] = glmAbs(max[0]) + glmAbs(min[0]);
+    dimensions[1] = glmAbs(max[1]) + glmAbs(min[1]);
+    dimensions[2] = glmAbs(max[2]) + glmAbs(min[2]);
 }
 
 /* glmScale: Scales a model by a given amount.
@@ -880,13 +1560,9 @@ glmDimensions(GLMmodel* model, GLfloat* dimensions)
 GLvoid
 glmScale(GLMmodel* model, GLfloat scale)
 {
-    GLuint i;
+    static const GLfloat origin[3] = { 0.0, 0.0, 0.0 };
     
-    for (i = 1; i <= model->numvertices; i++) {
-        model->vertices[3 * i + 0] *= scale;
-        model->vertices[3 * i + 1] *= scale;
-        model->vertices[3 * i + 2] *= scale;
-    }
+    glmTransform(model, origin, scale);
 }
 
 /* glmReverseWinding: Reverse the polygon winding for all polygons in
@@ -944,42 +1620,22 @@ glmReverseWinding(GLMmodel* model)
 GLvoid
 glmFacetNormals(GLMmodel* model)
 {
-    GLuint  i;
-    GLfloat u[3];
-    GLfloat v[3];
-    
     assert(model);
     assert(model->vertices);
     
     /* clobber any old facetnormals */
     if (model->facetnorms)
-        free(model->facetnorms);
+        glmFreeArray(model, model->facetnorms);
     
     /* allocate memory for the new facet normals */
     model->numfacetnorms = model->numtriangles;
     model->facetnorms = (GLfloat*)malloc(sizeof(GLfloat) *
                        3 * (model->numfacetnorms + 1));
     
-    for (i = 0; i < model->numtriangles; i++) {
-        model->triangles[i].findex = i+1;
-        
-        u[0] = model->vertices[3 * T(i).vindices[1] + 0] -
-            model->vertices[3 * T(i).vindices[0] + 0];
-        u[1] = model->vertices[3 * T(i).vindices[1] + 1] -
-            model->vertices[3 * T(i).vindices[0] + 1];
-        u[2] = model->vertices[3 * T(i).vindices[1] + 2] -
-            model->vertices[3 * T(i).vindices[0] + 2];
-        
-        v[0] = model->vertices[3 * T(i).vindices[2] + 0] -
-            model->vertices[3 * T(i).vindices[0] + 0];
-        v[1] = model->vertices[3 * T(i).vindices[2] + 1] -
-            model->vertices[3 * T(i).vindices[0] + 1];
-        v[2] = model->vertices[3 * T(i).vindices[2] + 2] -
-            model->vertices[3 * T(i).vindices[0] + 2];
-        
-        glmCross(u, v, &model->facetnorms[3 * (i+1)]);
-        glmNormalize(&model->facetnorms[3 * (i+1)]);
-    }
+    parallelFor(0, model->numtriangles, GLM_GRAIN, [&](size_t b, size_t e) {
+        glmFacetNormalsRange(model->vertices, model->numvertices,
+            model->triangles, model->facetnorms, b, e);
+    });
 }
 
 /* glmVertexNormals: Generates smooth vertex normals for a model.
@@ -995,20 +1651,27 @@ glmFacetNormals(GLMmodel* model)
  * the facet normal.  This tends to preserve hard edges.  The angle to
  * use depends on the model, but 90 degrees is usually a good start.
  *
+ * The per-vertex triangle lists are kept as one compressed array
+ * (offsets + members) built with a counting pass, and the vertices
+ * are processed in parallel: a first pass counts how many normals
+ * each vertex produces, so every vertex knows where its normals go
+ * before any are written.
+ *
  * model - initialized GLMmodel structure
  * angle - maximum angle (in degrees) to smooth across
  */
 GLvoid
 glmVertexNormals(GLMmodel* model, GLfloat angle)
 {
-    GLMnode* node;
-    GLMnode* tail;
-    GLMnode** members;
-    GLfloat* normals;
+    GLuint* offsets;            /* start of each vertex's triangle list */
+    GLuint* members;            /* 3 * triangle + corner, grouped by vertex */
+    GLubyte* averaged;          /* whether each member joins the average */
+    GLuint* first;              /* first normal index produced by a vertex */
+    GLuint numvertices;
     GLuint numnormals;
-    GLfloat average[3];
-    GLfloat dot, cos_angle;
-    GLuint i, avg;
+    GLuint count;
+    GLfloat cos_angle;
+    GLuint i, j;
     
     assert(model);
     assert(model->facetnorms);
@@ -1016,135 +1679,134 @@ glmVertexNormals(GLMmodel* model, GLfloat angle)
     /* calculate the cosine of the angle (in degrees) */
     cos_angle = cos(angle * M_PI / 180.0);
     
-    /* nuke any previous normals */
-    if (model->normals)
-        free(model->normals);
-    
-    /* allocate space for new normals */
-    model->numnormals = model->numtriangles * 3; /* 3 normals per triangle */
-    model->normals = (GLfloat*)malloc(sizeof(GLfloat)* 3* (model->numnormals+1));
+    numvertices = model->numvertices;
     
-    /* allocate a structure that will hold a linked list of triangle
-    indices for each vertex */
-    members = (GLMnode**)malloc(sizeof(GLMnode*) * (model->numvertices + 1));
-    for (i = 1; i <= model->numvertices; i++)
-        members[i] = NULL;
+    /* count the triangles each vertex is in, then turn the counts into
+    the end of each vertex's list */
+    offsets = (GLuint*)calloc(numvertices + 2, sizeof(GLuint));
+    for (i = 0; i < model->numtriangles; i++) {
+        offsets[T(i).vindices[0]]++;
+        offsets[T(i).vindices[1]]++;
+        offsets[T(i).vindices[2]]++;
+    }
+    for (i = 1; i <= numvertices + 1; i++)
+        offsets[i] += offsets[i - 1];
     
-    /* for every triangle, create a node for each vertex in it */
+    /* fill the lists back to front, so each one ends up at its start
+    offset and lists the triangles in descending order (the order the
+    original linked lists had) */
+    members = (GLuint*)malloc(sizeof(GLuint) * 3 * (model->numtriangles + 1));
     for (i = 0; i < model->numtriangles; i++) {
-        node = (GLMnode*)malloc(sizeof(GLMnode));
-        node->index = i;
-        node->next  = members[T(i).vindices[0]];
-        members[T(i).vindices[0]] = node;
-        
-        node = (GLMnode*)malloc(sizeof(GLMnode));
-        node->index = i;
-        node->next  = members[T(i).vindices[1]];
-        members[T(i).vindices[1]] = node;
-        
-        node = (GLMnode*)malloc(sizeof(GLMnode));
-        node->index = i;
-        node->next  = members[T(i).vindices[2]];
-        members[T(i).vindices[2]] = node;
+        for (j = 0; j < 3; j++)
+            members[--offsets[T(i).vindices[j]]] = 3 * i + j;
     }
     
-    /* calculate the average normal for each vertex */
-    numnormals = 1;
-    for (i = 1; i <= model->numvertices; i++) {
-    /* calculate an average normal for this vertex by averaging the
-        facet normal of every triangle this vertex is in */
-        node = members[i];
-        if (!node)
-            fprintf(stderr, "glmVertexNormals(): vertex w/o a triangle\n");
-        average[0] = 0.0; average[1] = 0.0; average[2] = 0.0;
-        avg = 0;
-        while (node) {
-        /* only average if the dot product of the angle between the two
-        facet normals is greater than the cosine of the threshold
-        angle -- or, said another way, the angle between the two
-            facet normals is less than (or equal to) the threshold angle */
-            dot = glmDot(&model->facetnorms[3 * T(node->index).findex],
-                &model->facetnorms[3 * T(members[i]->index).findex]);
-            if (dot > cos_angle) {
-                node->averaged = GL_TRUE;
-                average[0] += model->facetnorms[3 * T(node->index).findex + 0];
-                average[1] += model->facetnorms[3 * T(node->index).findex + 1];
-                average[2] += model->facetnorms[3 * T(node->index).findex + 2];
-                avg = 1;            /* we averaged at least one normal! */
-            } else {
-                node->averaged = GL_FALSE;
-            }
-            node = node->next;
-        }
+    averaged = (GLubyte*)malloc(sizeof(GLubyte) * 3 * (model->numtriangles + 1));
+    first = (GLuint*)malloc(sizeof(GLuint) * (numvertices + 2));
+    
+    /* decide which facet normals are averaged at each vertex, and count
+    the normals each vertex will produce */
+    parallelFor(1, numvertices + 1, 4096, [&](size_t b, size_t e) {
+        GLfloat* reference;
+        GLfloat* facet;
+        GLuint v, k, avg;
         
-        if (avg) {
-            /* normalize the averaged normal */
-            glmNormalize(average);
+        for (v = b; v < e; v++) {
+            first[v] = 0;
+            if (offsets[v] == offsets[v + 1])
+                continue;
             
-            /* add the normal to the vertex normals list */
-            model->normals[3 * numnormals + 0] = average[0];
-            model->normals[3 * numnormals + 1] = average[1];
-            model->normals[3 * numnormals + 2] = average[2];
-            avg = numnormals;
-            numnormals++;
-        }
-        
-        /* set the normal of this vertex in each triangle it is in */
-        node = members[i];
-        while (node) {
-            if (node->averaged) {
-                /* if this node was averaged, use the average normal */
-                if (T(node->index).vindices[0] == i)
-                    T(node->index).nindices[0] = avg;
-                else if (T(node->index).vindices[1] == i)
-                    T(node->index).nindices[1] = avg;
-                else if (T(node->index).vindices[2] == i)
-                    T(node->index).nindices[2] = avg;
-            } else {
-                /* if this node wasn't averaged, use the facet normal */
-                model->normals[3 * numnormals + 0] = 
-                    model->facetnorms[3 * T(node->index).findex + 0];
-                model->normals[3 * numnormals + 1] = 
-                    model->facetnorms[3 * T(node->index).findex + 1];
-                model->normals[3 * numnormals + 2] = 
-                    model->facetnorms[3 * T(node->index).findex + 2];
-                if (T(node->index).vindices[0] == i)
-                    T(node->index).nindices[0] = numnormals;
-                else if (T(node->index).vindices[1] == i)
-                    T(node->index).nindices[1] = numnormals;
-                else if (T(node->index).vindices[2] == i)
-                    T(node->index).nindices[2] = numnormals;
-                numnormals++;
+            /* only average if the dot product of the angle between the
+            two facet normals is greater than the cosine of the threshold
+            angle -- or, said another way, the angle between the two
+            facet normals is less than (or equal to) the threshold angle */
+            reference = &model->facetnorms[3 * T(members[offsets[v]] / 3).findex];
+            avg = 0;
+            for (k = offsets[v]; k < offsets[v + 1]; k++) {
+                facet = &model->facetnorms[3 * T(members[k] / 3).findex];
+                if (glmDot(facet, reference) > cos_angle) {
+                    averaged[k] = GL_TRUE;
+                    avg = 1;        /* we averaged at least one normal! */
+                } else {
+                    averaged[k] = GL_FALSE;
+                    first[v]++;
+                }
             }
-            node = node->next;
+            first[v] += avg;
         }
+    });
+    
+    /* turn the counts into the index of each vertex's first normal */
+    numnormals = 1;
+    for (i = 1; i <= numvertices; i++) {
+        if (offsets[i] == offsets[i + 1])
+            fprintf(stderr, "glmVertexNormals(): vertex w/o a triangle\n");
+        count = first[i];
+        first[i] = numnormals;
+        numnormals += count;
     }
     
+    /* nuke any previous normals and allocate exactly as many as are
+    needed */
+    if (model->normals)
+        glmFreeArray(model, model->normals);
     model->numnormals = numnormals - 1;
+    model->normals = (GLfloat*)malloc(sizeof(GLfloat)* 3* (model->numnormals+1));
     
-    /* free the member information */
-    for (i = 1; i <= model->numvertices; i++) {
-        node = members[i];
-        while (node) {
-            tail = node;
-            node = node->next;
-            free(tail);
+    /* calculate the average normal for each vertex, and set the normal
+    of this vertex in each triangle it is in */
+    parallelFor(1, numvertices + 1, 4096, [&](size_t b, size_t e) {
+        GLfloat average[3];
+        GLfloat* facet;
+        GLuint v, k, avg, next;
+        
+        for (v = b; v < e; v++) {
+            next = first[v];
+            avg = 0;
+            average[0] = 0.0; average[1] = 0.0; average[2] = 0.0;
+            for (k = offsets[v]; k < offsets[v + 1]; k++) {
+                if (averaged[k]) {
+                    facet = &model->facetnorms[3 * T(members[k] / 3).findex];
+                    average[0] += facet[0];
+                    average[1] += facet[1];
+                    average[2] += facet[2];
+                    avg = 1;
+                }
+            }
+            
+            if (avg) {
+                /* normalize the averaged normal */
+                glmNormalizeNormal(average);
+                
+                /* add the normal to the vertex normals list */
+                model->normals[3 * next + 0] = average[0];
+                model->normals[3 * next + 1] = average[1];
+                model->normals[3 * next + 2] = average[2];
+                avg = next;
+                next++;
+            }
+            
+            for (k = offsets[v]; k < offsets[v + 1]; k++) {
+                if (averaged[k]) {
+                    /* if this member was averaged, use the average normal */
+                    T(members[k] / 3).nindices[members[k] % 3] = avg;
+                } else {
+                    /* if this member wasn't averaged, use the facet normal */
+                    facet = &model->facetnorms[3 * T(members[k] / 3).findex];
+                    model->normals[3 * next + 0] = facet[0];
+                    model->normals[3 * next + 1] = facet[1];
+                    model->normals[3 * next + 2] = facet[2];
+                    T(members[k] / 3).nindices[members[k] % 3] = next;
+                    next++;
+                }
+            }
         }
-    }
-    free(members);
+    });
     
-    /* pack the normals array (we previously allocated the maximum
-    number of normals that could possibly be created (numtriangles *
-    3), so get rid of some of them (usually alot unless none of the
-    facet normals were averaged)) */
-    normals = model->normals;
-    model->normals = (GLfloat*)malloc(sizeof(GLfloat)* 3* (model->numnormals+1));
-    for (i = 1; i <= model->numnormals; i++) {
-        model->normals[3 * i + 0] = normals[3 * i + 0];
-        model->normals[3 * i + 1] = normals[3 * i + 1];
-        model->normals[3 * i + 2] = normals[3 * i + 2];
-    }
-    free(normals);
+    free(first);
+    free(averaged);
+    free(members);
+    free(offsets);
 }
 
 
@@ -1159,13 +1821,13 @@ glmLinearTexture(GLMmodel* model)
 {
     GLMgroup *group;
     GLfloat dimensions[3];
-    GLfloat x, y, scalefactor;
+    GLfloat scalefactor;
     GLuint i;
     
     assert(model);
     
     if (model->texcoords)
-        free(model->texcoords);
+        glmFreeArray(model, model->texcoords);
     model->numtexcoords = model->numvertices;
     model->texcoords=(GLfloat*)malloc(sizeof(GLfloat)*2*(model->numtexcoords+1));
     
@@ -1174,12 +1836,11 @@ glmLinearTexture(GLMmodel* model)
         glmAbs(glmMax(glmMax(dimensions[0], dimensions[1]), dimensions[2]));
     
     /* do the calculations */
-    for(i = 1; i <= model->numvertices; i++) {
-        x = model->vertices[3 * i + 0] * scalefactor;
-        y = model->vertices[3 * i + 2] * scalefactor;
-        model->texcoords[2 * i + 0] = (x + 1.0) / 2.0;
-        model->texcoords[2 * i + 1] = (y + 1.0) / 2.0;
-    }
+    parallelFor(1, (size_t)model->numvertices + 1, GLM_GRAIN,
+        [&](size_t b, size_t e) {
+            glmLinearTextureRange(model->vertices, model->texcoords, b, e,
+                scalefactor);
+        });
     
     /* go through and put texture coordinate indices in all the triangles */
     group = model->groups;
@@ -1213,42 +1874,46 @@ GLvoid
 glmSpheremapTexture(GLMmodel* model)
 {
     GLMgroup* group;
-    GLfloat theta, phi, rho, x, y, z, r;
     GLuint i;
     
     assert(model);
     assert(model->normals);
     
     if (model->texcoords)
-        free(model->texcoords);
+        glmFreeArray(model, model->texcoords);
     model->numtexcoords = model->numnormals;
     model->texcoords=(GLfloat*)malloc(sizeof(GLfloat)*2*(model->numtexcoords+1));
     
-    for (i = 1; i <= model->numnormals; i++) {
-        z = model->normals[3 * i + 0];  /* re-arrange for pole distortion */
-        y = model->normals[3 * i + 1];
-        x = model->normals[3 * i + 2];
-        r = sqrt((x * x) + (y * y));
-        rho = sqrt((r * r) + (z * z));
-        
-        if(r == 0.0) {
-            theta = 0.0;
-            phi = 0.0;
-        } else {
-            if(z == 0.0)
-                phi = 3.14159265 / 2.0;
-            else
-                phi = acos(z / rho);
+    parallelFor(1, (size_t)model->numnormals + 1, GLM_GRAIN,
+        [&](size_t b, size_t e) {
+            GLfloat theta, phi, rho, x, y, z, r;
             
-            if(y == 0.0)
-                theta = 3.141592365 / 2.0;
-            else
-                theta = asin(y / r) + (3.14159265 / 2.0);
-        }
-        
-        model->texcoords[2 * i + 0] = theta / 3.14159265;
-        model->texcoords[2 * i + 1] = phi / 3.14159265;
-    }
+            for (size_t i = b; i < e; i++) {
+                z = model->normals[3 * i + 0];  /* re-arrange for pole distortion */
+                y = model->normals[3 * i + 1];
+                x = model->normals[3 * i + 2];
+                r = sqrt((x * x) + (y * y));
+                rho = sqrt((r * r) + (z * z));
+                
+                if(r == 0.0) {
+                    theta = 0.0;
+                    phi = 0.0;
+                } else {
+                    if(z == 0.0)
+                        phi = 3.14159265 / 2.0;
+                    else
+                        phi = acos(z / rho);
+                
+                    if(y == 0.0)
+                        theta = 3.141592365 / 2.0;
+                    else
+                        theta = asin(y / r) + (3.14159265 / 2.0);
+                }
+                
+                model->texcoords[2 * i + 0] = theta / 3.14159265;
+                model->texcoords[2 * i + 1] = phi / 3.14159265;
+            }
+        });
     
     /* go through and put texcoord indices in all the triangles */
     group = model->groups;
@@ -1269,32 +1934,15 @@ glmSpheremapTexture(GLMmodel* model)
 GLvoid
 glmDelete(GLMmodel* model)
 {
-    GLMgroup* group;
-    GLuint i;
-    
     assert(model);
     
-    if (model->pathname)     free(model->pathname);
-    if (model->mtllibname) free(model->mtllibname);
-    if (model->vertices)     free(model->vertices);
-    if (model->normals)  free(model->normals);
-    if (model->texcoords)  free(model->texcoords);
-    if (model->facetnorms) free(model->facetnorms);
-    if (model->triangles)  free(model->triangles);
-    if (model->materials) {
-        for (i = 0; i < model->nummaterials; i++)
-            free(model->materials[i].name);
-    }
-    free(model->materials);
-    while(model->groups) {
-        group = model->groups;
-        model->groups = model->groups->next;
-        free(group->name);
-        free(group->triangles);
-        free(group);
-    }
-    
-    free(model);
+    /* only what was replaced or added after loading lives outside the
+    arena, so a freshly loaded model is a single free */
+    glmFreeParts(model);
+    if (model->arena)
+        free(model->arena);     /* the model itself is in the arena */
+    else
+        free(model);
 }
 
 /* glmReadOBJ: Reads a model description from a Wavefront .OBJ file.
@@ -1306,7 +1954,9 @@ glmDelete(GLMmodel* model)
 GLMmodel* 
 glmReadOBJ(char* filename)
 {
+    GLMmodel layout;
     GLMmodel* model;
+    GLMgroup* group;
     FILE* file;
     
     /* open the file */
@@ -1317,44 +1967,47 @@ glmReadOBJ(char* filename)
         exit(1);
     }
     
-    /* allocate a new model */
-    model = (GLMmodel*)malloc(sizeof(GLMmodel));
-    model->pathname    = strdup(filename);
-    model->mtllibname    = ".mtl";
-    model->numvertices   = 0;
-    model->vertices    = NULL;
-    model->numnormals    = 0;
-    model->normals     = NULL;
-    model->numtexcoords  = 0;
-    model->texcoords       = NULL;
-    model->numfacetnorms = 0;
-    model->facetnorms    = NULL;
-    model->numtriangles  = 0;
-    model->triangles       = NULL;
-    model->nummaterials  = 0;
-    model->materials       = NULL;
-    model->numgroups       = 0;
-    model->groups      = NULL;
-    model->position[0]   = 0.0;
-    model->position[1]   = 0.0;
-    model->position[2]   = 0.0;
+    /* collect the counts, names, materials and groups in a temporary
+    model */
+    layout.pathname      = strdup(filename);
+    layout.mtllibname    = strdup(".mtl");
+    layout.numvertices   = 0;
+    layout.vertices      = NULL;
+    layout.numnormals    = 0;
+    layout.normals       = NULL;
+    layout.numtexcoords  = 0;
+    layout.texcoords     = NULL;
+    layout.numfacetnorms = 0;
+    layout.facetnorms    = NULL;
+    layout.numtriangles  = 0;
+    layout.triangles     = NULL;
+    layout.nummaterials  = 0;
+    layout.materials     = NULL;
+    layout.numgroups     = 0;
+    layout.groups        = NULL;
+    layout.grouparray    = NULL;
+    layout.maxgroups     = 0;
+    layout.grouphash     = NULL;
+    layout.materialhash  = NULL;
+    layout.arena         = NULL;
+    layout.arenasize     = 0;
+    layout.position[0]   = 0.0;
+    layout.position[1]   = 0.0;
+    layout.position[2]   = 0.0;
     
     /* make a first pass through the file to get a count of the number
     of vertices, normals, texcoords & triangles */
-    glmFirstPass(model, file);
+    glmFirstPass(&layout, file);
     
-    /* allocate memory */
-    model->vertices = (GLfloat*)malloc(sizeof(GLfloat) *
-        3 * (model->numvertices + 1));
-    model->triangles = (GLMtriangle*)malloc(sizeof(GLMtriangle) *
-        model->numtriangles);
-    if (model->numnormals) {
-        model->normals = (GLfloat*)malloc(sizeof(GLfloat) *
-            3 * (model->numnormals + 1));
-    }
-    if (model->numtexcoords) {
-        model->texcoords = (GLfloat*)malloc(sizeof(GLfloat) *
-            2 * (model->numtexcoords + 1));
+    /* now that the sizes are known, move everything into one block */
+    model = glmPack(&layout);
+    glmFreeParts(&layout);
+    
+    /* the second pass refills the triangle list of each group */
+    group = model->groups;
+    while (group) {
+        group->numtriangles = 0;
+        group = group->next;
     }
     
     /* rewind to beginning of file and read in the data this pass */
@@ -1365,11 +2018,172 @@ glmReadOBJ(char* filename)
     /* close the file */
     fclose(file);
     
+    /* the name indices were only needed for parsing; they are rebuilt
+    if anything looks a name up later */
+    glmDeleteHash(model->grouphash);
+    glmDeleteHash(model->materialhash);
+    model->grouphash = NULL;
+    model->materialhash = NULL;
+    
     return model;
 }
 
+/* GLMbuffer: growable block of text that is built up in memory and
+ * then written to a file with a single fwrite().
+ */
+typedef struct _GLMbuffer {
+    char*  data;                /* the text */
+    size_t size;                /* number of bytes used */
+    size_t capacity;            /* number of bytes allocated */
+} GLMbuffer;
+
+/* GLM_LINE_MAX: room reserved for one vertex or face line (9 indices
+ * or 3 floats, plus separators) */
+#define GLM_LINE_MAX 128
+
+/* glmBufferReserve: make room for length more bytes in a buffer and
+ * return where they go.
+ */
+static char*
+glmBufferReserve(GLMbuffer* buffer, size_t length)
+{
+    if (buffer->size + length > buffer->capacity) {
+        buffer->capacity = 2 * buffer->capacity + length + 4096;
+        buffer->data = (char*)realloc(buffer->data, buffer->capacity);
+    }
+    return buffer->data + buffer->size;
+}
+
+/* glmBufferLine: append a line made of tag followed by s to a buffer */
+static GLvoid
+glmBufferLine(GLMbuffer* buffer, const char* tag, const char* s)
+{
+    size_t taglength = strlen(tag);
+    size_t length = strlen(s);
+    char* p;
+    
+    p = glmBufferReserve(buffer, taglength + length + 1);
+    memcpy(p, tag, taglength);
+    memcpy(p + taglength, s, length);
+    p[taglength + length] = '\n';
+    buffer->size += taglength + length + 1;
+}
+
+/* glmPutFloat: write the shortest text that reads back as f exactly */
+static char*
+glmPutFloat(char* p, GLfloat f)
+{
+    return std::to_chars(p, p + 32, f).ptr;
+}
+
+/* glmPutIndex: write an index in decimal */
+static char*
+glmPutIndex(char* p, GLuint i)
+{
+    return std::to_chars(p, p + 16, i).ptr;
+}
+
+/* glmWriteVectors: write the vectors (1-based, size floats each) as
+ * lines starting with tag.  Runs of them are formatted in parallel and
+ * then written in order.
+ */
+static GLvoid
+glmWriteVectors(FILE* file, const char* tag, GLfloat* vectors,
+                GLuint count, GLuint size)
+{
+    const size_t grain = 16384;
+    size_t taglength = strlen(tag);
+    size_t numchunks = (count + grain - 1) / grain;
+    GLMbuffer* buffers;
+    size_t c;
+    
+    buffers = (GLMbuffer*)calloc(numchunks + 1, sizeof(GLMbuffer));
+    parallelFor(0, numchunks, 1, [&](size_t b, size_t e) {
+        GLMbuffer* buffer;
+        GLfloat* v;
+        char* p;
+        size_t c, i, last;
+        GLuint j;
+        
+        for (c = b; c < e; c++) {
+            buffer = &buffers[c];
+            last = std::min((c + 1) * grain, (size_t)count);
+            glmBufferReserve(buffer, (last - c * grain) * GLM_LINE_MAX);
+            p = buffer->data;
+            for (i = c * grain + 1; i <= last; i++) {
+                v = &vectors[size * i];
+                memcpy(p, tag, taglength);
+                p += taglength;
+                for (j = 0; j < size; j++) {
+                    *p++ = ' ';
+                    p = glmPutFloat(p, v[j]);
+                }
+                *p++ = '\n';
+            }
+            buffer->size = p - buffer->data;
+        }
+    });
+    
+    for (c = 0; c < numchunks; c++) {
+        fwrite(buffers[c].data, 1, buffers[c].size, file);
+        free(buffers[c].data);
+    }
+    free(buffers);
+}
+
+/* glmWriteGroup: format a group (its name, material and faces) into a
+ * buffer, in the layout glmWriteOBJ() uses.
+ */
+static GLvoid
+glmWriteGroup(GLMmodel* model, GLMgroup* group, GLuint mode,
+              GLMbuffer* buffer)
+{
+    GLMtriangle* triangle;
+    GLuint i, j;
+    char* p;
+    
+    glmBufferLine(buffer, "g ", group->name);
+    if (mode & GLM_MATERIAL)
+        glmBufferLine(buffer, "usemtl ", model->materials[group->material].name);
+    
+    glmBufferReserve(buffer, (size_t)group->numtriangles * GLM_LINE_MAX + 1);
+    p = buffer->data + buffer->size;
+    for (i = 0; i < group->numtriangles; i++) {
+        triangle = &T(group->triangles[i]);
+        *p++ = 'f';
+        for (j = 0; j < 3; j++) {
+            *p++ = ' ';
+            p = glmPutIndex(p, triangle->vindices[j]);
+            if (mode & GLM_SMOOTH && mode & GLM_TEXTURE) {
+                *p++ = '/';
+                p = glmPutIndex(p, triangle->tindices[j]);
+                *p++ = '/';
+                p = glmPutIndex(p, triangle->nindices[j]);
+            } else if (mode & GLM_FLAT && mode & GLM_TEXTURE) {
+                *p++ = '/';
+                p = glmPutIndex(p, triangle->findex);
+            } else if (mode & GLM_TEXTURE) {
+                *p++ = '/';
+                p = glmPutIndex(p, triangle->tindices[j]);
+            } else if (mode & GLM_SMOOTH) {
+                *p++ = '/';
+                *p++ = '/';
+                p = glmPutIndex(p, triangle->nindices[j]);
+            } else if (mode & GLM_FLAT) {
+                *p++ = '/';
+                *p++ = '/';
+                p = glmPutIndex(p, triangle->findex);
+            }
+        }
+        *p++ = '\n';
+    }
+    *p++ = '\n';
+    buffer->size = p - buffer->data;
+}
+
 /* glmWriteOBJ: Writes a model description in Wavefront .OBJ format to
- * a file.
+ * a file.  Floats are written with the fewest digits that read back
+ * exactly, and the vertex runs and groups are formatted in parallel.
  *
  * model - initialized GLMmodel structure
  * filename - name of the file to write the Wavefront .OBJ format data to
@@ -1386,9 +2200,11 @@ glmReadOBJ(char* filename)
 GLvoid
 glmWriteOBJ(GLMmodel* model, char* filename, GLuint mode)
 {
-    GLuint i;
+    GLuint i, numgroups;
     FILE* file;
     GLMgroup* group;
+    GLMgroup** groups;
+    GLMbuffer* buffers;
     
     assert(model);
     
@@ -1456,43 +2272,24 @@ glmWriteOBJ(GLMmodel* model, char* filename, GLuint mode)
     /* spit out the vertices */
     fprintf(file, "\n");
     fprintf(file, "# %d vertices\n", model->numvertices);
-    for (i = 1; i <= model->numvertices; i++) {
-        fprintf(file, "v %f %f %f\n", 
-            model->vertices[3 * i + 0],
-            model->vertices[3 * i + 1],
-            model->vertices[3 * i + 2]);
-    }
+    glmWriteVectors(file, "v", model->vertices, model->numvertices, 3);
     
     /* spit out the smooth/flat normals */
     if (mode & GLM_SMOOTH) {
         fprintf(file, "\n");
         fprintf(file, "# %d normals\n", model->numnormals);
-        for (i = 1; i <= model->numnormals; i++) {
-            fprintf(file, "vn %f %f %f\n", 
-                model->normals[3 * i + 0],
-                model->normals[3 * i + 1],
-                model->normals[3 * i + 2]);
-        }
+        glmWriteVectors(file, "vn", model->normals, model->numnormals, 3);
     } else if (mode & GLM_FLAT) {
         fprintf(file, "\n");
         fprintf(file, "# %d normals\n", model->numfacetnorms);
-        for (i = 1; i <= model->numfacetnorms; i++) {
-            fprintf(file, "vn %f %f %f\n", 
-                model->facetnorms[3 * i + 0],
-                model->facetnorms[3 * i + 1],
-                model->facetnorms[3 * i + 2]);
-        }
+        glmWriteVectors(file, "vn", model->facetnorms, model->numfacetnorms, 3);
     }
     
     /* spit out the texture coordinates */
     if (mode & GLM_TEXTURE) {
         fprintf(file, "\n");
         fprintf(file, "# %d texcoords\n", model->numtexcoords);
-        for (i = 1; i <= model->numtexcoords; i++) {
-            fprintf(file, "vt %f %f\n", 
-                model->texcoords[2 * i + 0],
-                model->texcoords[2 * i + 1]);
-        }
+        glmWriteVectors(file, "vt", model->texcoords, model->numtexcoords, 2);
     }
     
     fprintf(file, "\n");
@@ -1500,65 +2297,26 @@ glmWriteOBJ(GLMmodel* model, char* filename, GLuint mode)
     fprintf(file, "# %d faces (triangles)\n", model->numtriangles);
     fprintf(file, "\n");
     
+    /* format each group into a buffer of its own, in parallel, then
+    write them out in list order */
+    groups = (GLMgroup**)malloc(sizeof(GLMgroup*) * (model->numgroups + 1));
+    buffers = (GLMbuffer*)calloc(model->numgroups + 1, sizeof(GLMbuffer));
+    numgroups = 0;
     group = model->groups;
     while(group) {
-        fprintf(file, "g %s\n", group->name);
-        if (mode & GLM_MATERIAL)
-            fprintf(file, "usemtl %s\n", model->materials[group->material].name);
-        for (i = 0; i < group->numtriangles; i++) {
-            if (mode & GLM_SMOOTH && mode & GLM_TEXTURE) {
-                fprintf(file, "f %d/%d/%d %d/%d/%d %d/%d/%d\n",
-                    T(group->triangles[i]).vindices[0], 
-                    T(group->triangles[i]).tindices[0],
-                    T(group->triangles[i]).nindices[0], 
-                    T(group->triangles[i]).vindices[1],
-                    T(group->triangles[i]).tindices[1],
-                    T(group->triangles[i]).nindices[1],
-                    T(group->triangles[i]).vindices[2],
-                    T(group->triangles[i]).tindices[2],
-                    T(group->triangles[i]).nindices[2]);
-            } else if (mode & GLM_FLAT && mode & GLM_TEXTURE) {
-                fprintf(file, "f %d/%d %d/%d %d/%d\n",
-                    T(group->triangles[i]).vindices[0],
-                    T(group->triangles[i]).findex,
-                    T(group->triangles[i]).vindices[1],
-                    T(group->triangles[i]).findex,
-                    T(group->triangles[i]).vindices[2],
-                    T(group->triangles[i]).findex);
-            } else if (mode & GLM_TEXTURE) {
-                fprintf(file, "f %d/%d %d/%d %d/%d\n",
-                    T(group->triangles[i]).vindices[0],
-                    T(group->triangles[i]).tindices[0],
-                    T(group->triangles[i]).vindices[1],
-                    T(group->triangles[i]).tindices[1],
-                    T(group->triangles[i]).vindices[2],
-                    T(group->triangles[i]).tindices[2]);
-            } else if (mode & GLM_SMOOTH) {
-                fprintf(file, "f %d//%d %d//%d %d//%d\n",
-                    T(group->triangles[i]).vindices[0],
-                    T(group->triangles[i]).nindices[0],
-                    T(group->triangles[i]).vindices[1],
-                    T(group->triangles[i]).nindices[1],
-                    T(group->triangles[i]).vindices[2], 
-                    T(group->triangles[i]).nindices[2]);
-            } else if (mode & GLM_FLAT) {
-                fprintf(file, "f %d//%d %d//%d %d//%d\n",
-                    T(group->triangles[i]).vindices[0], 
-                    T(group->triangles[i]).findex,
-                    T(group->triangles[i]).vindices[1],
-                    T(group->triangles[i]).findex,
-                    T(group->triangles[i]).vindices[2],
-                    T(group->triangles[i]).findex);
-            } else {
-                fprintf(file, "f %d %d %d\n",
-                    T(group->triangles[i]).vindices[0],
-                    T(group->triangles[i]).vindices[1],
-                    T(group->triangles[i]).vindices[2]);
-            }
-        }
-        fprintf(file, "\n");
+        groups[numgroups++] = group;
         group = group->next;
     }
+    parallelFor(0, numgroups, 1, [&](size_t b, size_t e) {
+        for (size_t g = b; g < e; g++)
+            glmWriteGroup(model, groups[g], mode, &buffers[g]);
+    });
+    for (i = 0; i < numgroups; i++) {
+        fwrite(buffers[i].data, 1, buffers[i].size, file);
+        free(buffers[i].data);
+    }
+    free(buffers);
+    free(groups);
     
     fclose(file);
 }
@@ -1742,7 +2500,7 @@ glmWeld(GLMmodel* model, GLfloat epsilon)
     }
     
     /* free space for old vertices */
-    free(vectors);
+    glmFreeArray(model, vectors);
     
     /* allocate space for the new vertices */
     model->numvertices = numvectors;
@@ -1759,6 +2517,926 @@ glmWeld(GLMmodel* model, GLfloat epsilon)
     free(copies);
 }
 
+/* glmACMR: Returns the average cache miss ratio (transformed vertices
+ * per triangle) of drawing the model group by group, as glmDraw does,
+ * through a FIFO post-transform vertex cache.
+ *
+ * model     - initialized GLMmodel structure
+ * cachesize - number of vertices the cache holds
+ */
+GLfloat
+glmACMR(GLMmodel* model, GLuint cachesize)
+{
+    GLMgroup* group;
+    GLuint* stamps;             /* miss count when each vertex was cached */
+    GLuint misses, v, i, j;
+    
+    assert(model);
+    
+    if (!model->numtriangles)
+        return 0.0;
+    
+    /* a vertex is in the cache if fewer than cachesize misses have
+    happened since it was loaded (stamp 0 means never loaded) */
+    stamps = (GLuint*)calloc(model->numvertices + 1, sizeof(GLuint));
+    misses = 0;
+    group = model->groups;
+    while (group) {
+        for (i = 0; i < group->numtriangles; i++) {
+            for (j = 0; j < 3; j++) {
+                v = T(group->triangles[i]).vindices[j];
+                if (!stamps[v] || misses - stamps[v] >= cachesize) {
+                    misses++;
+                    stamps[v] = misses;
+                }
+            }
+        }
+        group = group->next;
+    }
+    free(stamps);
+    
+    return (GLfloat)misses / model->numtriangles;
+}
+
+/* _GLMcluster: a run of triangles emitted by glmTipsify between two
+ * cache flushes, with the key it is sorted by to reduce overdraw.
+ */
+typedef struct _GLMcluster {
+    GLuint  first;              /* first triangle in the run */
+    GLuint  count;              /* number of triangles in the run */
+    GLfloat key;                /* how much the run faces away from the center */
+} GLMcluster;
+
+/* glmCompareClusters: qsort comparison, most outward facing first */
+static int
+glmCompareClusters(const void* a, const void* b)
+{
+    const GLMcluster* ca = (const GLMcluster*)a;
+    const GLMcluster* cb = (const GLMcluster*)b;
+    
+    if (ca->key > cb->key)
+        return -1;
+    if (ca->key < cb->key)
+        return 1;
+    return ca->first < cb->first ? -1 : (ca->first > cb->first);
+}
+
+/* glmTipsify: reorder the triangles of a group for vertex cache
+ * locality ("Tipsify", Sander, Nehab & Barczak, "Fast Triangle
+ * Reordering for Vertex Locality and Reduced Overdraw", 2007).
+ * Triangles are emitted in fans around a current vertex, and the
+ * next fanning vertex is the candidate that will most likely still
+ * be in the cache.  When no candidate qualifies, the walk jumps to a
+ * dead end or to the next vertex with triangles left, which starts a
+ * new cluster.
+ *
+ * model     - initialized GLMmodel structure
+ * group     - group whose triangles list is reordered in place
+ * cachesize - number of vertices in the post-transform cache
+ * overdraw  - GL_TRUE to sort the clusters so outward facing ones
+ *             are drawn first
+ * center    - array of 3 GLfloats, the center used for overdraw
+ */
+static GLvoid
+glmTipsify(GLMmodel* model, GLMgroup* group, GLuint cachesize,
+           GLboolean overdraw, GLfloat* center)
+{
+    GLuint* local;              /* group vertex -> model vertex */
+    GLuint* remap;              /* model vertex -> group vertex */
+    GLuint* corners;            /* group vertex of each triangle corner */
+    GLuint* offsets;            /* start of each vertex's triangle list */
+    GLuint* members;            /* triangles of each vertex */
+    GLuint* live;               /* triangles not yet emitted per vertex */
+    int*    stamps;             /* cache time stamp per vertex */
+    GLuint* deadend;            /* stack of recently used vertices */
+    GLuint* candidates;         /* vertices of the last fan */
+    GLboolean* emitted;         /* whether each triangle was emitted */
+    GLuint* order;              /* triangles in the new order */
+    GLMcluster* clusters;
+    GLuint numlocal, numdead, numcand, numorder, numclusters;
+    GLuint numtriangles, fan, cursor, best, t, v, i, j, k;
+    int time, priority, bestpriority;
+    GLfloat* p[3];
+    GLfloat u[3], w[3], n[3], c[3], sum[3], centroid[3], area, weight;
+    GLuint* sorted;
+    
+    numtriangles = group->numtriangles;
+    if (numtriangles < 2)
+        return;
+    
+    /* give the group's vertices dense local numbers */
+    remap = (GLuint*)malloc(sizeof(GLuint) * (model->numvertices + 1));
+    for (i = 0; i <= model->numvertices; i++)
+        remap[i] = GLM_NOT_FOUND;
+    local = (GLuint*)malloc(sizeof(GLuint) * 3 * numtriangles);
+    corners = (GLuint*)malloc(sizeof(GLuint) * 3 * numtriangles);
+    numlocal = 0;
+    for (i = 0; i < numtriangles; i++) {
+        for (j = 0; j < 3; j++) {
+            v = T(group->triangles[i]).vindices[j];
+            if (remap[v] == GLM_NOT_FOUND) {
+                remap[v] = numlocal;
+                local[numlocal++] = v;
+            }
+            corners[3 * i + j] = remap[v];
+        }
+    }
+    free(remap);
+    
+    /* vertex -> triangle adjacency, built with a counting pass */
+    offsets = (GLuint*)calloc(numlocal + 1, sizeof(GLuint));
+    for (i = 0; i < 3 * numtriangles; i++)
+        offsets[corners[i] + 1]++;
+    for (i = 1; i <= numlocal; i++)
+        offsets[i] += offsets[i - 1];
+    live = (GLuint*)malloc(sizeof(GLuint) * numlocal);
+    for (i = 0; i < numlocal; i++)
+        live[i] = offsets[i];   /* used as a fill cursor for now */
+    members = (GLuint*)malloc(sizeof(GLuint) * 3 * numtriangles);
+    for (i = 0; i < 3 * numtriangles; i++)
+        members[live[corners[i]]++] = i / 3;
+    for (i = 0; i < numlocal; i++)
+        live[i] = offsets[i + 1] - offsets[i];
+    
+    stamps = (int*)calloc(numlocal, sizeof(int));
+    deadend = (GLuint*)malloc(sizeof(GLuint) * 3 * numtriangles);
+    candidates = (GLuint*)malloc(sizeof(GLuint) * 3 * numtriangles);
+    emitted = (GLboolean*)calloc(numtriangles, sizeof(GLboolean));
+    order = (GLuint*)malloc(sizeof(GLuint) * numtriangles);
+    clusters = (GLMcluster*)malloc(sizeof(GLMcluster) * numtriangles);
+    
+    fan = 0;
+    cursor = 1;
+    time = cachesize + 1;
+    numdead = numorder = 0;
+    numclusters = 1;
+    clusters[0].first = 0;
+    while (fan != GLM_NOT_FOUND) {
+        /* emit every remaining triangle around the fanning vertex */
+        numcand = 0;
+        for (k = offsets[fan]; k < offsets[fan + 1]; k++) {
+            t = members[k];
+            if (emitted[t])
+                continue;
+            emitted[t] = GL_TRUE;
+            order[numorder++] = t;
+            for (j = 0; j < 3; j++) {
+                v = corners[3 * t + j];
+                deadend[numdead++] = v;
+                candidates[numcand++] = v;
+                live[v]--;
+                if (time - stamps[v] > (int)cachesize)
+                    stamps[v] = time++;
+            }
+        }
+        
+        /* pick the candidate that stays in the cache the longest while
+        all its remaining triangles are emitted */
+        best = GLM_NOT_FOUND;
+        bestpriority = -1;
+        for (i = 0; i < numcand; i++) {
+            v = candidates[i];
+            if (!live[v])
+                continue;
+            priority = 0;
+            if (time - stamps[v] + 2 * (int)live[v] <= (int)cachesize)
+                priority = time - stamps[v];
+            if (priority > bestpriority) {
+                bestpriority = priority;
+                best = v;
+            }
+        }
+        
+        if (best == GLM_NOT_FOUND) {
+            /* dead end: back up through the recently used vertices, then
+            fall back to scanning for any vertex with triangles left */
+            while (numdead && best == GLM_NOT_FOUND) {
+                v = deadend[--numdead];
+                if (live[v])
+                    best = v;
+            }
+            while (cursor < numlocal && best == GLM_NOT_FOUND) {
+                if (live[cursor])
+                    best = cursor;
+                else
+                    cursor++;
+            }
+            if (best != GLM_NOT_FOUND && numorder > clusters[numclusters-1].first) {
+                clusters[numclusters - 1].count =
+                    numorder - clusters[numclusters - 1].first;
+                clusters[numclusters].first = numorder;
+                numclusters++;
+            }
+        }
+        fan = best;
+    }
+    clusters[numclusters - 1].count = numorder - clusters[numclusters - 1].first;
+    
+    /* sort the clusters so the ones facing away from the center of the
+    model, which are the most likely to occlude the rest, come first */
+    if (overdraw && numclusters > 1) {
+        for (i = 0; i < numclusters; i++) {
+            sum[0] = sum[1] = sum[2] = 0.0;
+            centroid[0] = centroid[1] = centroid[2] = 0.0;
+            area = 0.0;
+            for (k = clusters[i].first; k < clusters[i].first + clusters[i].count; k++) {
+                for (j = 0; j < 3; j++)
+                    p[j] = &model->vertices[3 * local[corners[3 * order[k] + j]]];
+                for (j = 0; j < 3; j++) {
+                    u[j] = p[1][j] - p[0][j];
+                    w[j] = p[2][j] - p[0][j];
+                    c[j] = (p[0][j] + p[1][j] + p[2][j]) / 3.0;
+                }
+                glmCross(u, w, n);
+                weight = (GLfloat)sqrt(glmDot(n, n));
+                for (j = 0; j < 3; j++) {
+                    sum[j] += n[j];
+                    centroid[j] += c[j] * weight;
+                }
+                area += weight;
+            }
+            clusters[i].key = 0.0;
+            if (area > 0.0 && glmDot(sum, sum) > 0.0) {
+                glmNormalize(sum);
+                for (j = 0; j < 3; j++)
+                    centroid[j] = centroid[j] / area - center[j];
+                clusters[i].key = glmDot(centroid, sum);
+            }
+        }
+        qsort(clusters, numclusters, sizeof(GLMcluster), glmCompareClusters);
+    }
+    
+    /* write the new order back into the group */
+    sorted = (GLuint*)malloc(sizeof(GLuint) * numtriangles);
+    numorder = 0;
+    for (i = 0; i < numclusters; i++) {
+        for (k = clusters[i].first; k < clusters[i].first + clusters[i].count; k++)
+            sorted[numorder++] = group->triangles[order[k]];
+    }
+    memcpy(group->triangles, sorted, sizeof(GLuint) * numtriangles);
+    
+    free(sorted);
+    free(clusters);
+    free(order);
+    free(emitted);
+    free(candidates);
+    free(deadend);
+    free(stamps);
+    free(members);
+    free(live);
+    free(offsets);
+    free(corners);
+    free(local);
+}
+
+/* glmReorderVectors: renumber a 1-based array of vectors in the order
+ * the triangles first use them (unused vectors go last), so they are
+ * fetched sequentially when the model is drawn.  Returns the number
+ * of vectors the triangles use.
+ *
+ * model   - initialized GLMmodel structure (triangles already reordered)
+ * vectors - array of vectors, replaced by the reordered array
+ * count   - number of vectors
+ * size    - number of GLfloats per vector
+ * field   - offset of the index array inside GLMtriangle
+ * corners - number of indices per triangle in that array
+ */
+static GLuint
+glmReorderVectors(GLMmodel* model, GLfloat** vectors, GLuint count,
+                  GLuint size, size_t field, GLuint corners)
+{
+    GLuint* remap;
+    GLuint* indices;
+    GLfloat* reordered;
+    GLuint used, next, i, j, k;
+    
+    if (!*vectors || !count)
+        return 0;
+    
+    remap = (GLuint*)calloc(count + 1, sizeof(GLuint));
+    next = 1;
+    for (i = 0; i < model->numtriangles; i++) {
+        indices = (GLuint*)((char*)&T(i) + field);
+        for (j = 0; j < corners; j++) {
+            if (indices[j] && indices[j] <= count && !remap[indices[j]])
+                remap[indices[j]] = next++;
+        }
+    }
+    used = next - 1;
+    for (i = 1; i <= count; i++) {
+        if (!remap[i])
+            remap[i] = next++;
+    }
+    
+    reordered = (GLfloat*)malloc(sizeof(GLfloat) * size * (count + 1));
+    for (i = 1; i <= count; i++) {
+        for (k = 0; k < size; k++)
+            reordered[size * remap[i] + k] = (*vectors)[size * i + k];
+    }
+    for (i = 0; i < model->numtriangles; i++) {
+        indices = (GLuint*)((char*)&T(i) + field);
+        for (j = 0; j < corners; j++) {
+            if (indices[j] && indices[j] <= count)
+                indices[j] = remap[indices[j]];
+        }
+    }
+    
+    glmFreeArray(model, *vectors);
+    *vectors = reordered;
+    free(remap);
+    
+    return used;
+}
+
+/* glmOptimize: Reorders the triangles of each group for post-transform
+ * vertex cache locality (optionally sorting clusters of them to reduce
+ * overdraw), stores the triangles in the order they are drawn, and then
+ * renumbers the vertices, normals, texture coordinates and facet normals
+ * in the order they are first used.  The geometry is unchanged.
+ *
+ * model     - initialized GLMmodel structure
+ * cachesize - number of vertices in the post-transform cache
+ *             (16 to 32 covers most hardware)
+ * overdraw  - GL_TRUE to also sort triangle clusters for overdraw
+ * acmr      - array of 2 GLfloats (GLfloat acmr[2]) that receives the
+ *             average cache miss ratio before and after, or NULL
+ */
+GLvoid
+glmOptimize(GLMmodel* model, GLuint cachesize, GLboolean overdraw,
+            GLfloat* acmr)
+{
+    GLMgroup* group;
+    GLMtriangle* triangles;
+    GLfloat center[3];
+    GLuint* newindex;
+    GLuint next, i;
+    
+    assert(model);
+    assert(model->vertices);
+    
+    if (acmr)
+        acmr[0] = glmACMR(model, cachesize);
+    
+    /* the average vertex position is what overdraw sorting measures
+    "facing outwards" against */
+    center[0] = center[1] = center[2] = 0.0;
+    if (model->numvertices) {
+        for (i = 1; i <= model->numvertices; i++) {
+            center[0] += model->vertices[3 * i + 0] / model->numvertices;
+            center[1] += model->vertices[3 * i + 1] / model->numvertices;
+            center[2] += model->vertices[3 * i + 2] / model->numvertices;
+        }
+    }
+    
+    group = model->groups;
+    while (group) {
+        glmTipsify(model, group, cachesize, overdraw, center);
+        group = group->next;
+    }
+    
+    /* store the triangles in the order they are drawn */
+    newindex = (GLuint*)malloc(sizeof(GLuint) * (model->numtriangles + 1));
+    for (i = 0; i < model->numtriangles; i++)
+        newindex[i] = GLM_NOT_FOUND;
+    next = 0;
+    group = model->groups;
+    while (group) {
+        for (i = 0; i < group->numtriangles; i++) {
+            if (newindex[group->triangles[i]] == GLM_NOT_FOUND)
+                newindex[group->triangles[i]] = next++;
+        }
+        group = group->next;
+    }
+    for (i = 0; i < model->numtriangles; i++) {
+        if (newindex[i] == GLM_NOT_FOUND)
+            newindex[i] = next++;
+    }
+    triangles = (GLMtriangle*)malloc(sizeof(GLMtriangle) * model->numtriangles);
+    for (i = 0; i < model->numtriangles; i++)
+        triangles[newindex[i]] = T(i);
+    group = model->groups;
+    while (group) {
+        for (i = 0; i < group->numtriangles; i++)
+            group->triangles[i] = newindex[group->triangles[i]];
+        group = group->next;
+    }
+    glmFreeArray(model, model->triangles);
+    model->triangles = triangles;
+    free(newindex);
+    
+    /* renumber the per-vertex data in order of first use */
+    glmReorderVectors(model, &model->vertices, model->numvertices, 3,
+        offsetof(GLMtriangle, vindices), 3);
+    glmReorderVectors(model, &model->normals, model->numnormals, 3,
+        offsetof(GLMtriangle, nindices), 3);
+    glmReorderVectors(model, &model->texcoords, model->numtexcoords, 2,
+        offsetof(GLMtriangle, tindices), 3);
+    glmReorderVectors(model, &model->facetnorms, model->numfacetnorms, 3,
+        offsetof(GLMtriangle, findex), 1);
+    
+    if (acmr)
+        acmr[1] = glmACMR(model, cachesize);
+}
+
+/* _GLMcollapse: a candidate collapse of vertex "from" onto vertex "to"
+ * in the glmSimplify queue.  The versions record the state of both
+ * vertices when the cost was computed; stale entries are skipped.
+ */
+typedef struct _GLMcollapse {
+    GLdouble cost;
+    GLuint   from, to;
+    GLuint   fromversion, toversion;
+} GLMcollapse;
+
+/* _GLMqueue: binary min-heap of collapses */
+typedef struct _GLMqueue {
+    GLuint       count;
+    GLuint       size;
+    GLMcollapse* items;
+} GLMqueue;
+
+/* glmQueuePush: add a collapse to the queue */
+static GLvoid
+glmQueuePush(GLMqueue* queue, GLMcollapse* collapse)
+{
+    GLuint i, parent;
+    
+    if (queue->count == queue->size) {
+        queue->size = queue->size ? 2 * queue->size : 1024;
+        queue->items = (GLMcollapse*)realloc(queue->items,
+            sizeof(GLMcollapse) * queue->size);
+    }
+    
+    i = queue->count++;
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (queue->items[parent].cost <= collapse->cost)
+            break;
+        queue->items[i] = queue->items[parent];
+        i = parent;
+    }
+    queue->items[i] = *collapse;
+}
+
+/* glmQueuePop: remove the cheapest collapse from the queue */
+static GLvoid
+glmQueuePop(GLMqueue* queue, GLMcollapse* collapse)
+{
+    GLMcollapse last;
+    GLuint i, child;
+    
+    *collapse = queue->items[0];
+    last = queue->items[--queue->count];
+    i = 0;
+    for (;;) {
+        child = 2 * i + 1;
+        if (child >= queue->count)
+            break;
+        if (child + 1 < queue->count &&
+            queue->items[child + 1].cost < queue->items[child].cost)
+            child++;
+        if (last.cost <= queue->items[child].cost)
+            break;
+        queue->items[i] = queue->items[child];
+        i = child;
+    }
+    queue->items[i] = last;
+}
+
+/* glmAddQuadric: add the quadric of the plane n.x + d = 0, scaled by
+ * weight, to q (a symmetric 4x4 matrix stored as 10 GLdoubles)
+ */
+static GLvoid
+glmAddQuadric(GLdouble* q, GLfloat* n, GLdouble d, GLdouble weight)
+{
+    q[0] += weight * n[0] * n[0];
+    q[1] += weight * n[0] * n[1];
+    q[2] += weight * n[0] * n[2];
+    q[3] += weight * n[0] * d;
+    q[4] += weight * n[1] * n[1];
+    q[5] += weight * n[1] * n[2];
+    q[6] += weight * n[1] * d;
+    q[7] += weight * n[2] * n[2];
+    q[8] += weight * n[2] * d;
+    q[9] += weight * d * d;
+}
+
+/* glmQuadricError: evaluate the sum of quadrics a and b at point p */
+static GLdouble
+glmQuadricError(GLdouble* a, GLdouble* b, GLfloat* p)
+{
+    GLdouble q[10];
+    GLdouble x = p[0], y = p[1], z = p[2];
+    GLuint i;
+    
+    for (i = 0; i < 10; i++)
+        q[i] = a[i] + b[i];
+    return q[0]*x*x + 2*q[1]*x*y + 2*q[2]*x*z + 2*q[3]*x +
+           q[4]*y*y + 2*q[5]*y*z + 2*q[6]*y +
+           q[7]*z*z + 2*q[8]*z +
+           q[9];
+}
+
+/* glmCompareEdges: qsort comparison of edges packed into 64 bits */
+static int
+glmCompareEdges(const void* a, const void* b)
+{
+    unsigned long long ea = *(const unsigned long long*)a;
+    unsigned long long eb = *(const unsigned long long*)b;
+    
+    return ea < eb ? -1 : (ea > eb);
+}
+
+/* glmSimplify: Reduces the number of triangles in a model to about
+ * target by collapsing edges in order of increasing quadric error
+ * (Garland & Heckbert, "Surface Simplification Using Quadric Error
+ * Metrics", 1997).  Each collapse moves one vertex onto a neighbour,
+ * so no new vertices, normals or texture coordinates are made, and
+ * corners on the far side of a texture seam or hard edge keep their own.
+ * Vertices shared by triangles of different groups (and so possibly
+ * different materials) never move, open boundaries are held in place
+ * by extra quadrics, and collapses that would flip a triangle are
+ * skipped.  Unused vertices are dropped and facet normals, if any,
+ * are regenerated.
+ *
+ * model  - initialized GLMmodel structure
+ * target - number of triangles to reduce the model to
+ */
+GLvoid
+glmSimplify(GLMmodel* model, GLuint target)
+{
+    GLMgroup* group;
+    GLuint* owner;              /* group index of each triangle */
+    GLuint* vgroup;             /* group of each vertex, or GLM_NOT_FOUND */
+    GLboolean* locked;          /* vertices that must not move */
+    GLboolean* removed;         /* vertices collapsed away */
+    GLboolean* dead;            /* triangles collapsed away */
+    GLuint* version;            /* bumped whenever a vertex changes */
+    GLuint* offsets;            /* start of each vertex's triangle list */
+    GLuint* members;            /* triangles of each vertex */
+    GLuint* chain;              /* next vertex merged into the same one */
+    GLuint* tail;               /* last vertex of each merge chain */
+    GLdouble* quadrics;         /* 10 GLdoubles per vertex */
+    unsigned long long* edges;
+    unsigned long long* edge;
+    unsigned long long key;
+    GLMqueue queue;
+    GLMcollapse collapse;
+    GLuint numtriangles, numedges, from, to, w, t, i, j, k, gi, next;
+    GLuint corners[8][4];       /* from's nindex and tindex in an edge
+                                   triangle, then to's */
+    GLuint numcorners;
+    GLboolean valid, found;
+    GLfloat* p[3];
+    GLfloat u[3], v[3], n[3], m[3], moved[3];
+    GLfloat length;
+    GLMtriangle* triangles;
+    
+    assert(model);
+    assert(model->vertices);
+    
+    numtriangles = model->numtriangles;
+    if (target >= numtriangles)
+        return;
+    
+    /* which group each triangle and vertex belongs to; vertices in
+    more than one group are locked */
+    owner = (GLuint*)malloc(sizeof(GLuint) * (numtriangles + 1));
+    for (i = 0; i < numtriangles; i++)
+        owner[i] = GLM_NOT_FOUND;
+    gi = 0;
+    group = model->groups;
+    while (group) {
+        for (i = 0; i < group->numtriangles; i++)
+            owner[group->triangles[i]] = gi;
+        gi++;
+        group = group->next;
+    }
+    vgroup = (GLuint*)malloc(sizeof(GLuint) * (model->numvertices + 1));
+    locked = (GLboolean*)calloc(model->numvertices + 1, sizeof(GLboolean));
+    for (i = 0; i <= model->numvertices; i++)
+        vgroup[i] = GLM_NOT_FOUND;
+    for (i = 0; i < numtriangles; i++) {
+        for (j = 0; j < 3; j++) {
+            w = T(i).vindices[j];
+            if (vgroup[w] == GLM_NOT_FOUND)
+                vgroup[w] = owner[i];
+            else if (vgroup[w] != owner[i])
+                locked[w] = GL_TRUE;
+        }
+    }
+    free(vgroup);
+    
+    /* accumulate the area weighted plane quadric of every triangle at
+    its vertices */
+    quadrics = (GLdouble*)calloc(10 * (model->numvertices + 1), sizeof(GLdouble));
+    for (i = 0; i < numtriangles; i++) {
+        for (j = 0; j < 3; j++)
+            p[j] = &model->vertices[3 * T(i).vindices[j]];
+        for (j = 0; j < 3; j++) {
+            u[j] = p[1][j] - p[0][j];
+            v[j] = p[2][j] - p[0][j];
+        }
+        glmCross(u, v, n);
+        length = (GLfloat)sqrt(glmDot(n, n));
+        if (length == 0.0)
+            continue;
+        n[0] /= length; n[1] /= length; n[2] /= length;
+        for (j = 0; j < 3; j++) {
+            glmAddQuadric(&quadrics[10 * T(i).vindices[j]], n,
+                -glmDot(n, p[0]), length / 2.0);
+        }
+    }
+    
+    /* find the open boundary edges (used by a single triangle) and hold
+    them in place with a heavily weighted plane through the edge,
+    perpendicular to its triangle */
+    edges = (unsigned long long*)malloc(sizeof(unsigned long long) * 3 * (numtriangles + 1));
+    numedges = 0;
+    for (i = 0; i < numtriangles; i++) {
+        for (j = 0; j < 3; j++) {
+            from = T(i).vindices[j];
+            to = T(i).vindices[(j + 1) % 3];
+            if (from > to) {
+                w = from; from = to; to = w;
+            }
+            edges[numedges++] = (unsigned long long)from << 32 | to;
+        }
+    }
+    qsort(edges, numedges, sizeof(unsigned long long), glmCompareEdges);
+    for (i = 0; i < numtriangles; i++) {
+        for (j = 0; j < 3; j++) {
+            from = T(i).vindices[j];
+            to = T(i).vindices[(j + 1) % 3];
+            if (from > to) {
+                w = from; from = to; to = w;
+            }
+            key = (unsigned long long)from << 32 | to;
+            edge = (unsigned long long*)bsearch(&key, edges, numedges,
+                sizeof(unsigned long long), glmCompareEdges);
+            if ((edge > edges && edge[-1] == key) ||
+                (edge + 1 < edges + numedges && edge[1] == key))
+                continue;
+            for (k = 0; k < 3; k++)
+                p[k] = &model->vertices[3 * T(i).vindices[k]];
+            for (k = 0; k < 3; k++) {
+                u[k] = p[1][k] - p[0][k];
+                v[k] = p[2][k] - p[0][k];
+                m[k] = model->vertices[3 * to + k] - model->vertices[3 * from + k];
+            }
+            glmCross(u, v, n);
+            glmCross(m, n, v);
+            length = (GLfloat)sqrt(glmDot(v, v));
+            if (length == 0.0)
+                continue;
+            v[0] /= length; v[1] /= length; v[2] /= length;
+            length = glmDot(m, m);
+            glmAddQuadric(&quadrics[10 * from], v,
+                -glmDot(v, &model->vertices[3 * from]), 1000.0 * length);
+            glmAddQuadric(&quadrics[10 * to], v,
+                -glmDot(v, &model->vertices[3 * from]), 1000.0 * length);
+        }
+    }
+    free(edges);
+    
+    /* vertex -> triangle lists; when a vertex is collapsed its list is
+    chained onto the list of the vertex it moved to */
+    offsets = (GLuint*)calloc(model->numvertices + 2, sizeof(GLuint));
+    for (i = 0; i < numtriangles; i++) {
+        for (j = 0; j < 3; j++)
+            offsets[T(i).vindices[j] + 1]++;
+    }
+    for (i = 1; i <= model->numvertices + 1; i++)
+        offsets[i] += offsets[i - 1];
+    members = (GLuint*)malloc(sizeof(GLuint) * 3 * (numtriangles + 1));
+    chain = (GLuint*)malloc(sizeof(GLuint) * (model->numvertices + 1));
+    for (i = 0; i < numtriangles; i++) {
+        for (j = 0; j < 3; j++) {
+            w = T(i).vindices[j];
+            members[offsets[w]++] = i;
+        }
+    }
+    for (i = model->numvertices; i > 0; i--)
+        offsets[i] = offsets[i - 1];
+    offsets[0] = 0;
+    tail = (GLuint*)malloc(sizeof(GLuint) * (model->numvertices + 1));
+    for (i = 0; i <= model->numvertices; i++) {
+        chain[i] = GLM_NOT_FOUND;
+        tail[i] = i;
+    }
+    
+    removed = (GLboolean*)calloc(model->numvertices + 1, sizeof(GLboolean));
+    dead = (GLboolean*)calloc(numtriangles + 1, sizeof(GLboolean));
+    version = (GLuint*)calloc(model->numvertices + 1, sizeof(GLuint));
+    
+    /* queue the cheaper direction of every edge that may collapse */
+    queue.count = queue.size = 0;
+    queue.items = NULL;
+#define GLM_QUEUE_EDGE(a, b)                                              \
+    if (!locked[a]) {                                                     \
+        collapse.cost = glmQuadricError(&quadrics[10 * (a)],              \
+            &quadrics[10 * (b)], &model->vertices[3 * (b)]);              \
+        collapse.from = (a); collapse.to = (b);                           \
+        collapse.fromversion = version[a];                                \
+        collapse.toversion = version[b];                                  \
+        glmQueuePush(&queue, &collapse);                                  \
+    }
+    for (i = 0; i < numtriangles; i++) {
+        for (j = 0; j < 3; j++) {
+            from = T(i).vindices[j];
+            to = T(i).vindices[(j + 1) % 3];
+            GLM_QUEUE_EDGE(from, to);
+            GLM_QUEUE_EDGE(to, from);
+        }
+    }
+    
+    while (numtriangles > target && queue.count) {
+        glmQueuePop(&queue, &collapse);
+        from = collapse.from;
+        to = collapse.to;
+        if (removed[from] || removed[to] || from == to ||
+            version[from] != collapse.fromversion ||
+            version[to] != collapse.toversion)
+            continue;
+        
+        /* the collapse must not flip (or flatten) any triangle that
+        survives it, and "to" must still be a neighbour */
+        valid = GL_TRUE;
+        found = GL_FALSE;
+        for (w = from; w != GLM_NOT_FOUND && valid; w = chain[w]) {
+            for (k = offsets[w]; k < offsets[w + 1] && valid; k++) {
+                t = members[k];
+                if (dead[t])
+                    continue;
+                if (T(t).vindices[0] == to || T(t).vindices[1] == to ||
+                    T(t).vindices[2] == to) {
+                    found = GL_TRUE;
+                    continue;
+                }
+                for (j = 0; j < 3; j++)
+                    p[j] = &model->vertices[3 * T(t).vindices[j]];
+                for (j = 0; j < 3; j++) {
+                    u[j] = p[1][j] - p[0][j];
+                    v[j] = p[2][j] - p[0][j];
+                }
+                glmCross(u, v, n);
+                for (j = 0; j < 3; j++) {
+                    if (T(t).vindices[j] == from)
+                        p[j] = &model->vertices[3 * to];
+                }
+                for (j = 0; j < 3; j++) {
+                    u[j] = p[1][j] - p[0][j];
+                    v[j] = p[2][j] - p[0][j];
+                }
+                glmCross(u, v, moved);
+                if (glmDot(n, moved) <= 0.0)
+                    valid = GL_FALSE;
+            }
+        }
+        if (!valid || !found)
+            continue;
+        
+        /* remove the triangles on the edge, remembering the normal and
+        texture coordinate "from" and "to" each have in them */
+        numcorners = 0;
+        for (w = from; w != GLM_NOT_FOUND; w = chain[w]) {
+            for (k = offsets[w]; k < offsets[w + 1]; k++) {
+                t = members[k];
+                if (dead[t])
+                    continue;
+                for (j = 0; j < 3; j++) {
+                    if (T(t).vindices[j] != to)
+                        continue;
+                    for (i = 0; i < 3 && numcorners < 8; i++) {
+                        if (T(t).vindices[i] == from) {
+                            corners[numcorners][0] = T(t).nindices[i];
+                            corners[numcorners][1] = T(t).tindices[i];
+                            corners[numcorners][2] = T(t).nindices[j];
+                            corners[numcorners][3] = T(t).tindices[j];
+                            numcorners++;
+                            break;
+                        }
+                    }
+                    dead[t] = GL_TRUE;
+                    numtriangles--;
+                    break;
+                }
+            }
+        }
+        
+        /* move the rest of the triangles over to "to".  A corner only
+        takes the normal and texture coordinate of "to" if it had the
+        same ones as "from" in a removed triangle, so that UV seams and
+        hard edges running through "from" survive. */
+        for (w = from; w != GLM_NOT_FOUND; w = chain[w]) {
+            for (k = offsets[w]; k < offsets[w + 1]; k++) {
+                t = members[k];
+                if (dead[t])
+                    continue;
+                for (j = 0; j < 3; j++) {
+                    if (T(t).vindices[j] != from)
+                        continue;
+                    T(t).vindices[j] = to;
+                    for (i = 0; i < numcorners; i++) {
+                        if (T(t).nindices[j] == corners[i][0] &&
+                            T(t).tindices[j] == corners[i][1]) {
+                            T(t).nindices[j] = corners[i][2];
+                            T(t).tindices[j] = corners[i][3];
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+        chain[tail[to]] = from;
+        tail[to] = tail[from];
+        removed[from] = GL_TRUE;
+        for (i = 0; i < 10; i++)
+            quadrics[10 * to + i] += quadrics[10 * from + i];
+        version[to]++;
+        
+        /* requeue the edges around the vertex that changed */
+        for (w = to; w != GLM_NOT_FOUND; w = chain[w]) {
+            for (k = offsets[w]; k < offsets[w + 1]; k++) {
+                t = members[k];
+                if (dead[t])
+                    continue;
+                for (j = 0; j < 3; j++) {
+                    next = T(t).vindices[j];
+                    if (next == to)
+                        continue;
+                    GLM_QUEUE_EDGE(to, next);
+                    GLM_QUEUE_EDGE(next, to);
+                }
+            }
+        }
+    }
+#undef GLM_QUEUE_EDGE
+    
+    /* pack the surviving triangles, keeping their order */
+    next = 0;
+    for (i = 0; i < model->numtriangles; i++)
+        owner[i] = dead[i] ? GLM_NOT_FOUND : next++;
+    triangles = (GLMtriangle*)malloc(sizeof(GLMtriangle) * (next + 1));
+    for (i = 0; i < model->numtriangles; i++) {
+        if (!dead[i])
+            triangles[owner[i]] = T(i);
+    }
+    group = model->groups;
+    while (group) {
+        next = 0;
+        for (i = 0; i < group->numtriangles; i++) {
+            if (!dead[group->triangles[i]])
+                group->triangles[next++] = owner[group->triangles[i]];
+        }
+        group->numtriangles = next;
+        group = group->next;
+    }
+    glmFreeArray(model, model->triangles);
+    model->triangles = triangles;
+    model->numtriangles = numtriangles;
+    
+    /* drop the vertices (and normals and texture coordinates) that are
+    no longer used */
+    model->numvertices = glmReorderVectors(model, &model->vertices,
+        model->numvertices, 3, offsetof(GLMtriangle, vindices), 3);
+    if (model->normals) {
+        model->numnormals = glmReorderVectors(model, &model->normals,
+            model->numnormals, 3, offsetof(GLMtriangle, nindices), 3);
+    }
+    if (model->texcoords) {
+        model->numtexcoords = glmReorderVectors(model, &model->texcoords,
+            model->numtexcoords, 2, offsetof(GLMtriangle, tindices), 3);
+    }
+    if (model->facetnorms)
+        glmFacetNormals(model);
+    
+    free(queue.items);
+    free(version);
+    free(dead);
+    free(removed);
+    free(tail);
+    free(chain);
+    free(members);
+    free(offsets);
+    free(quadrics);
+    free(locked);
+    free(owner);
+}
+
+/* glmCopy: Returns a deep copy of a model, packed into a single block
+ * of memory, which should be free'd with glmDelete().
+ *
+ * model - initialized GLMmodel structure
+ */
+GLMmodel*
+glmCopy(GLMmodel* model)
+{
+    assert(model);
+    
+    return glmPack(model);
+}
+
 /* glmReadPPM: read a PPM raw (type P6) file.  The PPM file has a header
  * that should look something like:
  *
@@ -1790,46 +3468,27 @@ glmWeld(GLMmodel* model, GLfloat epsilon)
 GLubyte* 
 glmReadPPM(char* filename, int* width, int* height)
 {
-    FILE* fp;
-    int i, w, h, d;
-    unsigned char* image;
-    char head[70];          /* max line <= 70 in PPM (per spec). */
+    MappedFile file(filename);
+    ImageView view;
+    const char* error;
+    GLubyte* image;
     
-    fp = fopen(filename, "rb");
-    if (!fp) {
+    if (!file.isOpen()) {
         perror(filename);
         return NULL;
     }
     
-    /* grab first two chars of the file and make sure that it has the
-       correct magic cookie for a raw PPM file. */
-    fgets(head, 70, fp);
-    if (strncmp(head, "P6", 2)) {
-        fprintf(stderr, "%s: Not a raw PPM file\n", filename);
+    /* the header is parsed and the pixels are copied straight out of
+    the mapped file */
+    if (!viewPPM(file.data(), file.size(), view, &error)) {
+        fprintf(stderr, "%s: %s\n", filename, error);
         return NULL;
     }
+    image = (GLubyte*)malloc(sizeof(GLubyte) * view.stride * view.height);
+    memcpy(image, view.rows, view.stride * view.height);
     
-    /* grab the three elements in the header (width, height, maxval). */
-    i = 0;
-    while(i < 3) {
-        fgets(head, 70, fp);
-        if (head[0] == '#')     /* skip comments. */
-            continue;
-        if (i == 0)
-            i += sscanf(head, "%d %d %d", &w, &h, &d);
-        else if (i == 1)
-            i += sscanf(head, "%d %d", &h, &d);
-        else if (i == 2)
-            i += sscanf(head, "%d", &d);
-    }
-    
-    /* grab all the image data in one fell swoop. */
-    image = (unsigned char*)malloc(sizeof(unsigned char)*w*h*3);
-    fread(image, sizeof(unsigned char), w*h*3, fp);
-    fclose(fp);
-    
-    *width = w;
-    *height = h;
+    *width = view.width;
+    *height = view.height;
     return image;
 }
 
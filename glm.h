@@ -12,6 +12,9 @@
  */
 
 
+#ifndef GLM_H_INCLUDED
+#define GLM_H_INCLUDED
+
 #if defined(__APPLE__) || defined(MACOSX)
 #include <GLUT/glut.h>
 #else
@@ -88,9 +91,18 @@ typedef struct _GLMmodel {
 
   GLuint       numgroups;       /* number of groups in model */
   GLMgroup*    groups;          /* linked list of groups */
+  GLMgroup*    grouparray;      /* contiguous storage behind the list */
+  GLuint       maxgroups;       /* number of groups grouparray can hold */
+
+  struct _GLMhash* grouphash;   /* group name -> index into grouparray */
+  struct _GLMhash* materialhash; /* material name -> index into materials */
 
   GLfloat position[3];          /* position of the model */
 
+  char*   arena;                /* single block holding the model as
+                                   loaded (and the GLMmodel itself) */
+  size_t  arenasize;            /* size of the arena in bytes */
+
 } GLMmodel;
 
 
@@ -180,7 +192,10 @@ glmLinearTexture(GLMmodel* model);
 GLvoid
 glmSpheremapTexture(GLMmodel* model);
 
-/* glmDelete: Deletes a GLMmodel structure.
+/* glmDelete: Deletes a GLMmodel structure.  A model straight from
+ * glmReadOBJ() or glmCopy() lives in one block of memory, so this is a
+ * single free; arrays replaced since (by glmFacetNormals() etc.) are
+ * free'd separately.
  *
  * model - initialized GLMmodel structure
  */
@@ -250,6 +265,53 @@ glmList(GLMmodel* model, GLuint mode);
 GLvoid
 glmWeld(GLMmodel* model, GLfloat epsilon);
 
+/* glmACMR: Returns the average cache miss ratio (transformed vertices
+ * per triangle) of drawing the model with a FIFO post-transform vertex
+ * cache.  Around 0.6-0.7 is very good, 3.0 means no reuse at all.
+ *
+ * model     - initialized GLMmodel structure
+ * cachesize - number of vertices the cache holds
+ */
+GLfloat
+glmACMR(GLMmodel* model, GLuint cachesize);
+
+/* glmOptimize: Reorders the triangles of each group for post-transform
+ * vertex cache locality (Tipsify), optionally sorting clusters of them
+ * to reduce overdraw, then renumbers vertices, normals and texture
+ * coordinates in the order they are first used.  Groups, materials
+ * and the geometry itself are unchanged.
+ *
+ * model     - initialized GLMmodel structure
+ * cachesize - number of vertices in the post-transform cache
+ *             (16 to 32 covers most hardware)
+ * overdraw  - GL_TRUE to also sort triangle clusters for overdraw
+ * acmr      - array of 2 GLfloats (GLfloat acmr[2]) that receives the
+ *             cache miss ratio before and after optimizing, or NULL
+ */
+GLvoid
+glmOptimize(GLMmodel* model, GLuint cachesize, GLboolean overdraw,
+            GLfloat* acmr);
+
+/* glmSimplify: Reduces the number of triangles in a model to about
+ * target by collapsing edges in order of increasing quadric error.
+ * Vertices on the border between groups (and so between materials)
+ * and along open boundaries are kept in place.  Use glmCopy() first
+ * to build a chain of levels of detail from one model.
+ *
+ * model  - initialized GLMmodel structure
+ * target - number of triangles to reduce the model to
+ */
+GLvoid
+glmSimplify(GLMmodel* model, GLuint target);
+
+/* glmCopy: Returns a deep copy of a model, packed into a single block
+ * of memory, which should be free'd with glmDelete().
+ *
+ * model - initialized GLMmodel structure
+ */
+GLMmodel*
+glmCopy(GLMmodel* model);
+
 /* glmReadPPM: read a PPM raw (type P6) file.  The PPM file has a header
  * that should look something like:
  *
@@ -280,3 +342,5 @@ glmWeld(GLMmodel* model, GLfloat epsilon);
  */
 GLubyte* 
 glmReadPPM(char* filename, int* width, int* height);
+
+#endif
@@ -23,18 +23,79 @@
 
 
 #include <assert.h>
-#include <fstream>
+#include <fcntl.h>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define IMAGE_X86_DISPATCH
+#endif
 
 #include "imageloader.h"
+#include "parallel.h"
 
 using namespace std;
 
-Image::Image(char* ps, int w, int h) : pixels(ps), width(w), height(h) {
+Image::Image() :
+	pixels(NULL), width(0), height(0), channels(3), stride(0) {
 	
 }
 
+Image::Image(int w, int h, int channels_, int rowAlignment) :
+	pixels(NULL), width(w), height(h), channels(channels_) {
+	stride = (w * channels + rowAlignment - 1) / rowAlignment * rowAlignment;
+	void* p;
+	if (posix_memalign(&p, IMAGE_ALIGNMENT,
+					   max((size_t)stride * h, (size_t)1)) == 0) {
+		pixels = (char*)p;
+	}
+}
+
+Image::Image(Image &&other) :
+	pixels(other.pixels), width(other.width), height(other.height),
+	channels(other.channels), stride(other.stride) {
+	other.pixels = NULL;
+	other.width = 0;
+	other.height = 0;
+	other.stride = 0;
+}
+
+Image &Image::operator=(Image &&other) {
+	if (this != &other) {
+		free(pixels);
+		pixels = other.pixels;
+		width = other.width;
+		height = other.height;
+		channels = other.channels;
+		stride = other.stride;
+		other.pixels = NULL;
+		other.width = 0;
+		other.height = 0;
+		other.stride = 0;
+	}
+	return *this;
+}
+
 Image::~Image() {
-	delete[] pixels;
+	free(pixels);
+}
+
+ImageView Image::view() const {
+	//Views only describe RGB pixels
+	assert(channels == 3);
+	ImageView view;
+	view.rows = (const unsigned char*)pixels;
+	view.width = width;
+	view.height = height;
+	view.stride = stride;
+	view.format = PIXEL_RGB;
+	view.bottomUp = true;
+	return view;
 }
 
 namespace {
@@ -51,153 +112,750 @@ namespace {
 		return (short)(((unsigned char)bytes[1] << 8) |
 					   (unsigned char)bytes[0]);
 	}
+
+}
+
+MappedFile::MappedFile(const char* filename) :
+	bytes(NULL), length(0), mapped(false) {
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		return;
+	}
+	struct stat info;
+	if (fstat(fd, &info) == 0 && info.st_size > 0) {
+		length = (size_t)info.st_size;
+		void* p = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) {
+			bytes = (unsigned char*)p;
+			mapped = true;
+			madvise(p, length, MADV_SEQUENTIAL);
+		}
+		else {
+			//Fall back on reading the whole file
+			bytes = (unsigned char*)malloc(length);
+			size_t done = 0;
+			while (done < length) {
+				ssize_t n = read(fd, bytes + done, length - done);
+				if (n <= 0) {
+					break;
+				}
+				done += n;
+			}
+			if (done < length) {
+				free(bytes);
+				bytes = NULL;
+				length = 0;
+			}
+		}
+	}
+	close(fd);
+}
+
+MappedFile::~MappedFile() {
+	if (mapped) {
+		munmap(bytes, length);
+	}
+	else {
+		free(bytes);
+	}
+}
+
+void swapRedBlueScalar(const unsigned char* in, unsigned char* out,
+					   int width) {
+	for(int x = 0; x < width; x++) {
+		unsigned char r = in[3 * x + 2];
+		unsigned char b = in[3 * x];
+		out[3 * x + 1] = in[3 * x + 1];
+		out[3 * x] = r;
+		out[3 * x + 2] = b;
+	}
+}
+
+#ifdef IMAGE_X86_DISPATCH
+namespace {
+	//Shuffle that swaps red and blue in the 5 pixels at the start of 16
+	//bytes and leaves the 16th byte as it is, so that a 16 byte store can
+	//run one byte into the next group without changing it
+	#define SWAP_RED_BLUE_MASK 2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15
 	
-	//Reads the next four bytes as an integer, using little-endian form
-	int readInt(ifstream &input) {
-		char buffer[4];
-		input.read(buffer, 4);
-		return toInt(buffer);
+	__attribute__((target("ssse3")))
+	void swapRedBlueSSSE3(const unsigned char* in, unsigned char* out,
+						  int width) {
+		const __m128i mask = _mm_setr_epi8(SWAP_RED_BLUE_MASK);
+		int n = 3 * width;
+		int i = 0;
+		for(; i + 16 <= n; i += 15) {
+			__m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+			_mm_storeu_si128((__m128i*)(out + i), _mm_shuffle_epi8(v, mask));
+		}
+		swapRedBlueScalar(in + i, out + i, (n - i) / 3);
 	}
 	
-	//Reads the next two bytes as a short, using little-endian form
-	short readShort(ifstream &input) {
-		char buffer[2];
-		input.read(buffer, 2);
-		return toShort(buffer);
+	__attribute__((target("avx2")))
+	void swapRedBlueAVX2(const unsigned char* in, unsigned char* out,
+						 int width) {
+		const __m256i mask = _mm256_setr_epi8(SWAP_RED_BLUE_MASK,
+											  SWAP_RED_BLUE_MASK);
+		int n = 3 * width;
+		int i = 0;
+		//Each lane takes 5 pixels, so the upper lane starts 15 bytes in
+		for(; i + 31 <= n; i += 30) {
+			__m256i v = _mm256_inserti128_si256(
+				_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(in + i))),
+				_mm_loadu_si128((const __m128i*)(in + i + 15)), 1);
+			v = _mm256_shuffle_epi8(v, mask);
+			_mm_storeu_si128((__m128i*)(out + i), _mm256_castsi256_si128(v));
+			_mm_storeu_si128((__m128i*)(out + i + 15),
+							 _mm256_extracti128_si256(v, 1));
+		}
+		swapRedBlueSSSE3(in + i, out + i, (n - i) / 3);
+	}
+	
+	#undef SWAP_RED_BLUE_MASK
+	
+	typedef void (*SwapRedBlueFunction)(const unsigned char*, unsigned char*,
+										int);
+	
+	SwapRedBlueFunction chooseSwapRedBlue() {
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			return swapRedBlueAVX2;
+		}
+		if (__builtin_cpu_supports("ssse3")) {
+			return swapRedBlueSSSE3;
+		}
+		return swapRedBlueScalar;
+	}
+}
+#endif
+
+void swapRedBlue(const unsigned char* in, unsigned char* out, int width) {
+#ifdef IMAGE_X86_DISPATCH
+	static const SwapRedBlueFunction swap = chooseSwapRedBlue();
+	swap(in, out, width);
+#else
+	swapRedBlueScalar(in, out, width);
+#endif
+}
+
+namespace {
+	//What the headers of a BMP file say about its pixels
+	struct BMPInfo {
+		int width;
+		int height; //Always positive; see bottomUp
+		bool bottomUp;
+		int bitsPerPixel;
+		int compression;
+		unsigned int masks[3]; //Red, green and blue bits of each pixel
+		const unsigned char* palette;
+		int paletteSize; //Number of colors in the palette
+		int paletteEntrySize; //3 bytes (OS/2 V1) or 4
+		const unsigned char* pixels; //Start of the pixel data
+		size_t pixelBytes; //Bytes from pixels to the end of the file
+		unsigned char colors[3 * 256]; //The palette as RGB, once expanded
+	};
+	
+	const int BMP_RGB = 0;
+	const int BMP_RLE8 = 1;
+	const int BMP_RLE4 = 2;
+	const int BMP_BITFIELDS = 3;
+	const int BMP_ALPHABITFIELDS = 6;
+	
+	//The most pixels a run length encoded bitmap may have.  Its size can't
+	//be checked against the file's, since runs and jumps cover any number
+	//of pixels in a few bytes.
+	const size_t BMP_MAX_RLE_PIXELS = (size_t)1 << 26;
+	
+	unsigned int toUnsigned(const unsigned char* bytes) {
+		return (unsigned int)toInt((const char*)bytes);
 	}
 	
-	//Just like auto_ptr, but for arrays
-	template<class T>
-	class auto_array {
-		private:
-			T* array;
-			mutable bool isReleased;
-		public:
-			explicit auto_array(T* array_ = NULL) :
-				array(array_), isReleased(false) {
+	//Reads the headers of the BMP file in data into info.  Returns NULL, or
+	//what is wrong with the file.
+	const char* parseBMP(const unsigned char* data, size_t size,
+						 BMPInfo &info) {
+		const char* bytes = (const char*)data;
+		if (size < 18 || bytes[0] != 'B' || bytes[1] != 'M') {
+			return "not a bitmap file";
+		}
+		size_t dataOffset = toUnsigned(data + 10);
+		size_t headerSize = toUnsigned(data + 14);
+		if (14 + headerSize > size || dataOffset > size) {
+			return "file is truncated";
+		}
+		
+		int height;
+		info.compression = BMP_RGB;
+		info.paletteEntrySize = 4;
+		int paletteSize = 0;
+		switch(headerSize) {
+			case 12:
+				//OS/2 V1
+				info.width = toShort(bytes + 18);
+				height = toShort(bytes + 20);
+				info.bitsPerPixel = toShort(bytes + 24);
+				info.paletteEntrySize = 3;
+				break;
+			case 16:
+			case 64:
+				//OS/2 V2, whose compression types 3 and 4 mean Huffman and
+				//RLE24 instead of bit fields
+				info.width = toInt(bytes + 18);
+				height = toInt(bytes + 22);
+				info.bitsPerPixel = toShort(bytes + 28);
+				if (headerSize == 64) {
+					info.compression = toInt(bytes + 30);
+					paletteSize = toInt(bytes + 46);
+				}
+				if (info.compression == BMP_BITFIELDS || info.compression == 4) {
+					return "OS/2 Huffman and RLE24 compression are not supported";
+				}
+				break;
+			case 40:
+			case 52:
+			case 56:
+			case 108:
+			case 124:
+				//Windows V3, V3 with bit fields, V4 and V5 (the colour space
+				//and profile data in V4 and V5 headers is ignored)
+				info.width = toInt(bytes + 18);
+				height = toInt(bytes + 22);
+				info.bitsPerPixel = toShort(bytes + 28);
+				info.compression = toInt(bytes + 30);
+				paletteSize = toInt(bytes + 46);
+				break;
+			default:
+				return "unknown header type";
+		}
+		
+		//Top down bitmaps are stored with a negative height
+		info.bottomUp = height >= 0;
+		info.height = height < 0 ? -height : height;
+		if (info.width <= 0 || info.height <= 0 ||
+			info.width > (1 << 16) || info.height > (1 << 16)) {
+			return "bad image size";
+		}
+		
+		switch(info.compression) {
+			case BMP_RGB:
+				break;
+			case BMP_RLE8:
+			case BMP_RLE4:
+				if (info.bitsPerPixel != (info.compression == BMP_RLE8 ? 8 : 4)) {
+					return "run length encoding doesn't match bits per pixel";
+				}
+				if (!info.bottomUp) {
+					return "run length encoded bitmaps can't be top down";
+				}
+				if ((size_t)info.width * info.height > BMP_MAX_RLE_PIXELS) {
+					return "image is too large";
+				}
+				break;
+			case BMP_BITFIELDS:
+			case BMP_ALPHABITFIELDS:
+				if (info.bitsPerPixel != 16 && info.bitsPerPixel != 32) {
+					return "bit fields need 16 or 32 bits per pixel";
+				}
+				break;
+			default:
+				return "unsupported compression (JPEG, PNG or unknown)";
+		}
+		
+		//Bit masks follow a V3 header, and are inside the bigger ones
+		const unsigned char* end = data + 14 + headerSize;
+		if (info.compression == BMP_BITFIELDS ||
+			info.compression == BMP_ALPHABITFIELDS) {
+			if (headerSize == 40) {
+				end += info.compression == BMP_BITFIELDS ? 12 : 16;
 			}
-			
-			auto_array(const auto_array<T> &aarray) {
-				array = aarray.array;
-				isReleased = aarray.isReleased;
-				aarray.isReleased = true;
+			if (size < 54 + 12 || end > data + size) {
+				return "file is truncated";
 			}
-			
-			~auto_array() {
-				if (!isReleased && array != NULL) {
-					delete[] array;
+			for(int c = 0; c < 3; c++) {
+				info.masks[c] = toUnsigned(data + 54 + 4 * c);
+			}
+		}
+		else if (info.bitsPerPixel == 16) {
+			info.masks[0] = 0x7C00;
+			info.masks[1] = 0x03E0;
+			info.masks[2] = 0x001F;
+		}
+		else {
+			info.masks[0] = 0xFF0000;
+			info.masks[1] = 0x00FF00;
+			info.masks[2] = 0x0000FF;
+		}
+		
+		//Then comes the palette, for 8 bits per pixel and fewer
+		switch(info.bitsPerPixel) {
+			case 1:
+			case 4:
+			case 8:
+				if (paletteSize <= 0 || paletteSize > (1 << info.bitsPerPixel)) {
+					paletteSize = 1 << info.bitsPerPixel;
+				}
+				//Some writers leave out unused entries; the gap before the
+				//pixels says how many there really are
+				if (dataOffset > (size_t)(end - data)) {
+					paletteSize = (int)min((size_t)paletteSize,
+										   (dataOffset - (end - data)) /
+										   info.paletteEntrySize);
 				}
+				else {
+					paletteSize = 0;
+				}
+				if (paletteSize == 0) {
+					return "palette is missing";
+				}
+				break;
+			case 16:
+			case 24:
+			case 32:
+				paletteSize = 0;
+				break;
+			default:
+				return "unsupported number of bits per pixel";
+		}
+		info.palette = end;
+		info.paletteSize = paletteSize;
+		
+		info.pixels = data + dataOffset;
+		info.pixelBytes = size - dataOffset;
+		if (info.compression == BMP_RGB || info.compression == BMP_BITFIELDS ||
+			info.compression == BMP_ALPHABITFIELDS) {
+			size_t stride = ((size_t)info.width * info.bitsPerPixel + 31) / 32 * 4;
+			if (stride * info.height > info.pixelBytes) {
+				return "file is truncated";
+			}
+		}
+		return NULL;
+	}
+	
+	//Turns a row of a BMP's pixels into RGB
+	typedef void (*BMPRowDecoder)(const unsigned char* in, unsigned char* out,
+								  const BMPInfo &info);
+	
+	//Fills in info.colors from the palette.  Indices past its end are black.
+	void expandPalette(BMPInfo &info) {
+		unsigned char* colors = info.colors;
+		memset(colors, 0, 3 * 256);
+		for(int i = 0; i < info.paletteSize; i++) {
+			const unsigned char* entry = info.palette + i * info.paletteEntrySize;
+			colors[3 * i + 0] = entry[2];
+			colors[3 * i + 1] = entry[1];
+			colors[3 * i + 2] = entry[0];
+		}
+	}
+	
+	void decodeRow8(const unsigned char* in, unsigned char* out,
+					const BMPInfo &info) {
+		const unsigned char* colors = info.colors;
+		for(int x = 0; x < info.width; x++) {
+			memcpy(out + 3 * x, colors + 3 * in[x], 3);
+		}
+	}
+	
+	void decodeRow4(const unsigned char* in, unsigned char* out,
+					const BMPInfo &info) {
+		const unsigned char* colors = info.colors;
+		for(int x = 0; x < info.width; x++) {
+			int index = x & 1 ? in[x >> 1] & 15 : in[x >> 1] >> 4;
+			memcpy(out + 3 * x, colors + 3 * index, 3);
+		}
+	}
+	
+	void decodeRow1(const unsigned char* in, unsigned char* out,
+					const BMPInfo &info) {
+		const unsigned char* colors = info.colors;
+		for(int x = 0; x < info.width; x++) {
+			int index = (in[x >> 3] >> (7 - (x & 7))) & 1;
+			memcpy(out + 3 * x, colors + 3 * index, 3);
+		}
+	}
+	
+	//32 bit pixels with 8 bit blue, green and red channels in that order
+	void decodeRowBGRX(const unsigned char* in, unsigned char* out,
+					   const BMPInfo &info) {
+		for(int x = 0; x < info.width; x++) {
+			out[3 * x + 0] = in[4 * x + 2];
+			out[3 * x + 1] = in[4 * x + 1];
+			out[3 * x + 2] = in[4 * x + 0];
+		}
+	}
+	
+#ifdef IMAGE_X86_DISPATCH
+	__attribute__((target("ssse3")))
+	void decodeRowBGRXSSSE3(const unsigned char* in, unsigned char* out,
+							const BMPInfo &info) {
+		//4 pixels go into the first 12 bytes; the rest are overwritten
+		//by the next store, which stays inside the row
+		const __m128i mask = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+										   14, 13, 12, -1, -1, -1, -1);
+		int x = 0;
+		for(; 3 * x + 16 <= 3 * info.width; x += 4) {
+			__m128i v = _mm_loadu_si128((const __m128i*)(in + 4 * x));
+			_mm_storeu_si128((__m128i*)(out + 3 * x), _mm_shuffle_epi8(v, mask));
+		}
+		for(; x < info.width; x++) {
+			out[3 * x + 0] = in[4 * x + 2];
+			out[3 * x + 1] = in[4 * x + 1];
+			out[3 * x + 2] = in[4 * x + 0];
+		}
+	}
+#endif
+	
+	//Where a channel's bits are in a 16 or 32 bit pixel, and how to scale
+	//them up to 8 bits
+	struct Channel {
+		unsigned int mask;
+		int shift;
+		unsigned int top; //The largest value the channel can have
+	};
+	
+	Channel toChannel(unsigned int mask) {
+		Channel c;
+		c.mask = mask;
+		c.shift = 0;
+		c.top = 0;
+		if (mask != 0) {
+			while (!(mask & 1)) {
+				mask >>= 1;
+				c.shift++;
 			}
-			
-			T* get() const {
-				return array;
+			c.top = mask;
+		}
+		return c;
+	}
+	
+	unsigned char channelValue(const Channel &c, unsigned int pixel) {
+		if (c.top == 0) {
+			return 0;
+		}
+		unsigned int v = (pixel & c.mask) >> c.shift;
+		return (unsigned char)(((unsigned long long)v * 255 + c.top / 2) / c.top);
+	}
+	
+	//Any other 16 or 32 bit layout, from its bit masks
+	void decodeRowMasked(const unsigned char* in, unsigned char* out,
+						 const BMPInfo &info) {
+		Channel channels[3];
+		for(int c = 0; c < 3; c++) {
+			channels[c] = toChannel(info.masks[c]);
+		}
+		for(int x = 0; x < info.width; x++) {
+			unsigned int pixel = info.bitsPerPixel == 16 ?
+				in[2 * x] | in[2 * x + 1] << 8 : toUnsigned(in + 4 * x);
+			for(int c = 0; c < 3; c++) {
+				out[3 * x + c] = channelValue(channels[c], pixel);
 			}
-			
-			T &operator*() const {
-				return *array;
+		}
+	}
+	
+	//Expands run length encoded (RLE8 or RLE4) data into one palette index
+	//per pixel, bottom row first.  Pixels the data skips over keep index 0.
+	const char* decodeRLE(const BMPInfo &info, unsigned char* indices) {
+		const unsigned char* p = info.pixels;
+		const unsigned char* end = info.pixels + info.pixelBytes;
+		bool four = info.compression == BMP_RLE4;
+		int x = 0;
+		int y = 0;
+		memset(indices, 0, (size_t)info.width * info.height);
+		while (y < info.height) {
+			if (end - p < 2) {
+				return "run length encoded data is truncated";
 			}
-			
-			void operator=(const auto_array<T> &aarray) {
-				if (!isReleased && array != NULL) {
-					delete[] array;
+			int count = p[0];
+			int value = p[1];
+			p += 2;
+			if (count > 0) {
+				//A run of count pixels (alternating nibbles for RLE4)
+				unsigned char* row = indices + (size_t)info.width * y;
+				for(int i = 0; i < count && x < info.width; i++, x++) {
+					row[x] = four ? (i & 1 ? value & 15 : value >> 4) : value;
 				}
-				array = aarray.array;
-				isReleased = aarray.isReleased;
-				aarray.isReleased = true;
 			}
-			
-			T* operator->() const {
-				return array;
+			else if (value == 0) {
+				//End of line
+				x = 0;
+				y++;
 			}
-			
-			T* release() {
-				isReleased = true;
-				return array;
+			else if (value == 1) {
+				//End of bitmap
+				break;
 			}
-			
-			void reset(T* array_ = NULL) {
-				if (!isReleased && array != NULL) {
-					delete[] array;
+			else if (value == 2) {
+				//Move right and up
+				if (end - p < 2) {
+					return "run length encoded data is truncated";
 				}
-				array = array_;
-			}
-			
-			T* operator+(int i) {
-				return array + i;
+				x += p[0];
+				y += p[1];
+				p += 2;
 			}
-			
-			T &operator[](int i) {
-				return array[i];
+			else {
+				//value pixels stored as they are, padded to 16 bits
+				int bytes = four ? (value + 1) / 2 : value;
+				if (end - p < bytes) {
+					return "run length encoded data is truncated";
+				}
+				unsigned char* row = indices + (size_t)info.width * y;
+				for(int i = 0; i < value && x < info.width; i++, x++) {
+					row[x] = four ? (i & 1 ? p[i >> 1] & 15 : p[i >> 1] >> 4) :
+						p[i];
+				}
+				p += (bytes + 1) & ~1;
 			}
-	};
+		}
+		return NULL;
+	}
 }
 
-Image* loadBMP(const char* filename) {
-	ifstream input;
-	input.open(filename, ifstream::binary);
-	assert(!input.fail() || !"Could not find file");
-	char buffer[2];
-	input.read(buffer, 2);
-	assert(buffer[0] == 'B' && buffer[1] == 'M' || !"Not a bitmap file");
-	input.ignore(8);
-	int dataOffset = readInt(input);
-	
-	//Read the header
-	int headerSize = readInt(input);
-	int width;
-	int height;
-	switch(headerSize) {
-		case 40:
-			//V3
-			width = readInt(input);
-			height = readInt(input);
-			input.ignore(2);
-			assert(readShort(input) == 24 || !"Image is not 24 bits per pixel");
-			assert(readShort(input) == 0 || !"Image is compressed");
-			break;
-		case 12:
-			//OS/2 V1
-			width = readShort(input);
-			height = readShort(input);
-			input.ignore(2);
-			assert(readShort(input) == 24 || !"Image is not 24 bits per pixel");
+bool viewBMP(const unsigned char* data, size_t size, ImageView &view,
+			 const char** error) {
+	BMPInfo info;
+	const char* problem = parseBMP(data, size, info);
+	if (problem == NULL && (info.bitsPerPixel != 24 ||
+							info.compression != BMP_RGB)) {
+		problem = "pixels need decoding";
+	}
+	if (error != NULL) {
+		*error = problem;
+	}
+	if (problem != NULL) {
+		return false;
+	}
+	
+	//Rows are padded to a multiple of 4 bytes
+	view.rows = info.pixels;
+	view.width = info.width;
+	view.height = info.height;
+	view.stride = (info.width * 3 + 3) & ~3;
+	view.format = PIXEL_BGR;
+	view.bottomUp = info.bottomUp;
+	return true;
+}
+
+unsigned char* decodeBMP(const unsigned char* data, size_t size,
+						 ImageView &view, const char** error) {
+	BMPInfo info;
+	const char* problem = parseBMP(data, size, info);
+	if (problem != NULL) {
+		if (error != NULL) {
+			*error = problem;
+		}
+		return NULL;
+	}
+	
+	unsigned char* pixels =
+		new(std::nothrow) unsigned char[(size_t)info.width * info.height * 3];
+	if (pixels == NULL) {
+		if (error != NULL) {
+			*error = "image is too large";
+		}
+		return NULL;
+	}
+	view.rows = pixels;
+	view.width = info.width;
+	view.height = info.height;
+	view.stride = 3 * info.width;
+	view.format = PIXEL_RGB;
+	view.bottomUp = info.bottomUp;
+	
+	//Run length encoded data has to be expanded in order, then looked up
+	if (info.compression == BMP_RLE8 || info.compression == BMP_RLE4) {
+		unsigned char* indices =
+			new(std::nothrow) unsigned char[(size_t)info.width * info.height];
+		problem = indices != NULL ? decodeRLE(info, indices) :
+			"image is too large";
+		if (problem == NULL) {
+			expandPalette(info);
+			for(int y = 0; y < info.height; y++) {
+				decodeRow8(indices + (size_t)info.width * y,
+						   pixels + (size_t)view.stride * y, info);
+			}
+		}
+		delete[] indices;
+		if (problem != NULL) {
+			delete[] pixels;
+			if (error != NULL) {
+				*error = problem;
+			}
+			return NULL;
+		}
+		if (error != NULL) {
+			*error = NULL;
+		}
+		return pixels;
+	}
+	
+	//Everything else is decoded a row at a time, by the fastest decoder
+	//for its layout
+	BMPRowDecoder decode;
+	switch(info.bitsPerPixel) {
+		case 1:
+			decode = decodeRow1;
 			break;
-		case 64:
-			//OS/2 V2
-			assert(!"Can't load OS/2 V2 bitmaps");
+		case 4:
+			decode = decodeRow4;
 			break;
-		case 108:
-			//Windows V4
-			assert(!"Can't load Windows V4 bitmaps");
+		case 8:
+			decode = decodeRow8;
 			break;
-		case 124:
-			//Windows V5
-			assert(!"Can't load Windows V5 bitmaps");
+		case 24:
+			//Just needs red and blue swapped
+			decode = NULL;
 			break;
 		default:
-			assert(!"Unknown bitmap format");
+			if (info.bitsPerPixel == 32 && info.masks[0] == 0xFF0000 &&
+				info.masks[1] == 0x00FF00 && info.masks[2] == 0x0000FF) {
+				decode = decodeRowBGRX;
+#ifdef IMAGE_X86_DISPATCH
+				if (__builtin_cpu_supports("ssse3")) {
+					decode = decodeRowBGRXSSSE3;
+				}
+#endif
+			}
+			else {
+				decode = decodeRowMasked;
+			}
+	}
+	if (info.bitsPerPixel <= 8) {
+		expandPalette(info);
 	}
 	
-	//Read the data
-	int bytesPerRow = ((width * 3 + 3) / 4) * 4 - (width * 3 % 4);
-	int size = bytesPerRow * height;
-	auto_array<char> pixels(new char[size]);
-	input.seekg(dataOffset, ios_base::beg);
-	input.read(pixels.get(), size);
+	size_t stride = ((size_t)info.width * info.bitsPerPixel + 31) / 32 * 4;
+	size_t grain = 1 + (256 << 10) / (stride + 1);
+	parallelFor(0, info.height, grain, [&](size_t begin, size_t end) {
+		for(size_t y = begin; y < end; y++) {
+			const unsigned char* in = info.pixels + stride * y;
+			unsigned char* out = pixels + (size_t)view.stride * y;
+			if (decode == NULL) {
+				swapRedBlue(in, out, info.width);
+			}
+			else {
+				decode(in, out, info);
+			}
+		}
+	});
+	if (error != NULL) {
+		*error = NULL;
+	}
+	return pixels;
+}
+
+
+bool viewPPM(const unsigned char* data, size_t size, ImageView &view,
+			 const char** error) {
+	if (error != NULL) {
+		*error = "not a raw PPM file";
+	}
+	if (size < 2 || data[0] != 'P' || data[1] != '6') {
+		return false;
+	}
 	
-	//Get the data into the right format
-	auto_array<char> pixels2(new char[width * height * 3]);
-	for(int y = 0; y < height; y++) {
-		for(int x = 0; x < width; x++) {
-			for(int c = 0; c < 3; c++) {
-				pixels2[3 * (width * y + x) + c] =
-					pixels[bytesPerRow * y + 3 * x + (2 - c)];
+	//The header is the width, height and largest value, separated by
+	//whitespace and comments, then one whitespace character
+	int values[3];
+	size_t i = 2;
+	for(int k = 0; k < 3; k++) {
+		for(;;) {
+			while (i < size && (data[i] == ' ' || data[i] == '\t' ||
+								 data[i] == '\r' || data[i] == '\n')) {
+				i++;
 			}
+			if (i < size && data[i] == '#') {
+				while (i < size && data[i] != '\n') {
+					i++;
+				}
+				continue;
+			}
+			break;
+		}
+		if (i >= size || data[i] < '0' || data[i] > '9') {
+			return false;
+		}
+		values[k] = 0;
+		while (i < size && data[i] >= '0' && data[i] <= '9') {
+			values[k] = 10 * values[k] + (data[i++] - '0');
 		}
 	}
+	i++;
 	
-	input.close();
-	return new Image(pixels2.release(), width, height);
+	view.width = values[0];
+	view.height = values[1];
+	view.stride = 3 * values[0];
+	view.format = PIXEL_RGB;
+	view.bottomUp = false;
+	view.rows = data + i;
+	if (values[2] <= 0 || values[2] > 255) {
+		if (error != NULL) {
+			*error = "only 8 bit PPM files are supported";
+		}
+		return false;
+	}
+	if (i + (size_t)view.stride * view.height > size) {
+		if (error != NULL) {
+			*error = "file is truncated";
+		}
+		return false;
+	}
+	if (error != NULL) {
+		*error = NULL;
+	}
+	return true;
+}
+
+MappedImage::MappedImage(const char* filename) :
+	file(filename), decoded(NULL), valid(false), error(NULL) {
+	if (!file.isOpen()) {
+		error = "could not open file";
+		return;
+	}
+	if (file.size() >= 2 && file.data()[0] == 'B' && file.data()[1] == 'M') {
+		//Plain 24 bit bitmaps are used in place; anything else is decoded
+		valid = viewBMP(file.data(), file.size(), pixels, &error);
+		if (!valid) {
+			decoded = decodeBMP(file.data(), file.size(), pixels, &error);
+			valid = decoded != NULL;
+		}
+	}
+	else {
+		valid = viewPPM(file.data(), file.size(), pixels, &error);
+	}
+}
+
+MappedImage::~MappedImage() {
+	delete[] decoded;
+}
+
+Image toImage(const ImageView &view) {
+	Image image(view.width, view.height);
+	size_t rowBytes = 3 * (size_t)view.width;
+	
+	//About 256KB of pixels per job
+	size_t grain = 1 + (256 << 10) / (rowBytes + 1);
+	parallelFor(0, view.height, grain, [&](size_t begin, size_t end) {
+		for(size_t y = begin; y < end; y++) {
+			const unsigned char* row = view.row((int)y);
+			unsigned char* out = image.row((int)y);
+			if (view.format == PIXEL_BGR) {
+				swapRedBlue(row, out, view.width);
+			}
+			else {
+				memcpy(out, row, rowBytes);
+			}
+		}
+	});
+	return image;
+}
+
+Image loadBMP(const char* filename) {
+	MappedImage image(filename);
+	if (!image.isValid()) {
+		fprintf(stderr, "loadBMP: %s: %s\n", filename, image.errorMessage());
+		return Image();
+	}
+	return toImage(image.view());
 }
 
 
@@ -26,25 +26,190 @@
 #ifndef IMAGE_LOADER_H_INCLUDED
 #define IMAGE_LOADER_H_INCLUDED
 
-//Represents an image
+#include <stddef.h>
+
+struct ImageView;
+
+//Byte alignment of every Image's pixels, enough for any SIMD load
+const int IMAGE_ALIGNMENT = 64;
+
+//Represents an image.  Images own their pixels, and can be moved but not
+//copied.
 class Image {
+	private:
+		Image(const Image &other);
+		Image &operator=(const Image &other);
 	public:
-		Image(char* ps, int w, int h);
+		//Makes an empty image, with no pixels
+		Image();
+		//Makes a w x h image with uninitialized pixels, whose rows are padded
+		//to a multiple of rowAlignment bytes
+		Image(int w, int h, int channels = 3, int rowAlignment = 1);
+		Image(Image &&other);
+		Image &operator=(Image &&other);
 		~Image();
 		
 		/* An array of the form (R1, G1, B1, R2, G2, B2, ...) indicating the
-		 * color of each pixel in image.  Color components range from 0 to 255.
+		 * color of each pixel in image (with a fourth, alpha, component per
+		 * pixel in 4 channel images).  Color components range from 0 to 255.
 		 * The array starts the bottom-left pixel, then moves right to the end
 		 * of the row, then moves up to the next column, and so on.  This is the
-		 * format in which OpenGL likes images.
+		 * format in which OpenGL likes images.  The array starts on an
+		 * IMAGE_ALIGNMENT byte boundary, and each row starts stride bytes
+		 * after the last.
 		 */
 		char* pixels;
 		int width;
 		int height;
+		int channels; //Bytes per pixel
+		int stride; //Bytes from the start of one row to the next
+		
+		//Returns whether the image has no pixels (such as after a failed
+		//load, or after being moved from)
+		bool empty() const {
+			return pixels == NULL;
+		}
+		
+		//Returns row y, counting from the bottom
+		unsigned char* row(int y) {
+			return (unsigned char*)pixels + (size_t)stride * y;
+		}
+		
+		const unsigned char* row(int y) const {
+			return (const unsigned char*)pixels + (size_t)stride * y;
+		}
+		
+		//Returns a view of the pixels of a 3 channel image, which stays valid
+		//while the image is alive and isn't moved from.  Other images can't
+		//be viewed.
+		ImageView view() const;
 };
 
-//Reads a bitmap image from file.
-Image* loadBMP(const char* filename);
+//A file mapped read-only into memory (or, where it can't be mapped, read
+//into a buffer)
+class MappedFile {
+	private:
+		unsigned char* bytes;
+		size_t length;
+		bool mapped;
+		
+		MappedFile(const MappedFile &other);
+		MappedFile &operator=(const MappedFile &other);
+	public:
+		explicit MappedFile(const char* filename);
+		~MappedFile();
+		
+		//Returns whether the file could be opened
+		bool isOpen() const {
+			return bytes != NULL;
+		}
+		
+		const unsigned char* data() const {
+			return bytes;
+		}
+		
+		size_t size() const {
+			return length;
+		}
+};
+
+//The order of the channels in each pixel of an ImageView
+enum PixelFormat {
+	PIXEL_RGB,
+	PIXEL_BGR
+};
+
+//A window onto 8 bit, 3 channel pixels held by something else (such as a
+//MappedFile), which may have padding after each row and may store its
+//rows top to bottom or bottom to top
+struct ImageView {
+	const unsigned char* rows; //The first row in memory
+	int width;
+	int height;
+	int stride; //Bytes from the start of one row in memory to the next
+	PixelFormat format;
+	bool bottomUp; //Whether the first row in memory is the bottom one
+	
+	//Returns row y, counting from the bottom of the image like OpenGL does
+	const unsigned char* row(int y) const {
+		return rows + (size_t)stride * (bottomUp ? y : height - 1 - y);
+	}
+	
+	//Returns the offset of the red channel within each pixel
+	int redOffset() const {
+		return format == PIXEL_BGR ? 2 : 0;
+	}
+};
+
+/* The functions below that take an error argument set *error (if error is
+ * not NULL) to NULL on success, or to a static string saying what is wrong
+ * with the file.
+ */
+
+//Points view at the pixels of the BMP file in data, if they can be used as
+//they are, which is the case for uncompressed 24 bit bitmaps
+bool viewBMP(const unsigned char* data, size_t size, ImageView &view,
+			 const char** error = NULL);
+
+//Decodes the pixels of any BMP file we understand (1, 4, 8, 16, 24 or 32
+//bits per pixel, uncompressed, RLE8, RLE4 or with bit fields, with Windows
+//V3 to V5 or OS/2 headers) into new RGB rows and points view at them.
+//Returns the rows, to be freed with delete[], or NULL on failure.
+unsigned char* decodeBMP(const unsigned char* data, size_t size,
+						 ImageView &view, const char** error = NULL);
+
+//Points view at the pixels of the raw (P6) PPM file in data
+bool viewPPM(const unsigned char* data, size_t size, ImageView &view,
+			 const char** error = NULL);
+
+//An image file (BMP or raw PPM) mapped into memory, with a view of its
+//pixels.  The pixels are used in place where possible, and are otherwise
+//decoded into a buffer the MappedImage owns.
+class MappedImage {
+	private:
+		MappedFile file;
+		unsigned char* decoded;
+		ImageView pixels;
+		bool valid;
+		const char* error;
+		
+		MappedImage(const MappedImage &other);
+		MappedImage &operator=(const MappedImage &other);
+	public:
+		explicit MappedImage(const char* filename);
+		~MappedImage();
+		
+		//Returns whether the file was read and is a format we understand
+		bool isValid() const {
+			return valid;
+		}
+		
+		//Returns why the file couldn't be read, or NULL if it could
+		const char* errorMessage() const {
+			return error;
+		}
+		
+		const ImageView &view() const {
+			return pixels;
+		}
+};
+
+//Swaps the first and third channel of width 3 byte pixels (turning BGR
+//into RGB or back) from in to out, which may be the same row.  This uses
+//the widest shuffles the CPU supports.
+void swapRedBlue(const unsigned char* in, unsigned char* out, int width);
+
+//The plain version of swapRedBlue
+void swapRedBlueScalar(const unsigned char* in, unsigned char* out,
+					   int width);
+
+//Copies the pixels in a view into a new Image, converting them to RGB
+//rows from the bottom up.  Large images are converted on several threads.
+Image toImage(const ImageView &view);
+
+//Reads a bitmap image from file.  Returns an empty Image, after printing
+//why, if the file can't be read.
+Image loadBMP(const char* filename);
 
 
 
@@ -22,551 +22,192 @@
  */
 
 
+#include <atomic>
+#include <chrono>
 #include <cmath>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <stdlib.h>
+#include <thread>
 #include <vector>
 #ifdef __APPLE__
 #include <OpenGL/OpenGL.h>
 #include <GLUT/glut.h>
 #else
+#define GL_GLEXT_PROTOTYPES
 #include <GL/glut.h>
+#ifdef FREEGLUT
+#include <GL/freeglut_ext.h>
+#endif
 #endif
 #include "glm.cpp"
 #include "imageloader.cpp"
-#include "vec3f.cpp"
+#include "texcache.cpp"
+#include "texmanager.cpp"
+#include "vec3f.h"
+#include "mat4.h"
+#include "vec3farray.cpp"
+#include "terrain.cpp"
+#include "game.cpp"
+#include "triplebuffer.h"
 
-#define PI 3.141592653589
-#define DEG2RAD(deg) (deg * PI / 180)
-#define RAD2DEG(rad) (rad * 180 / PI)
 
 using namespace std;
 GLdouble projection[16], modelview[16];
 
-struct Ball {
-	
-	float pos[3]; //Position
-	float r; //Radius
-	float color[3];
-	int marked;
-};
-vector<Ball*> _balls ;
-typedef struct _cell {
-    int id;
-    int x, y;
-    float min, max;
-    float value;
-    float step;
-    char* info;
-    char* format;
-} cell;
-
-
-//Gloabal variables
-int current_view=3,pause_scene=1,game_start_flag=1,game_over_flag=0,score=0,game_time=100,enable=1;
-float pitch=0,roll=0,thrust=0.2,accn=0,vel=0,prev_temp;
-
-cell translation[3] = {
-    { 1, 120, 40, -5.0, 5.0, 0.0, 0.01,
-        "Specifies X coordinate of translation vector.", "%.2f" },
-    { 2, 180, 40, -5.0, 5.0, 0.0, 0.01,
-    "Specifies Y coordinate of translation vector.", "%.2f" },
-    { 3, 240, 40, -5.0, 5.0, 0.0, 0.01,
-    "Specifies Z coordinate of translation vector.", "%.2f" },
-};
-
-cell rotation[4] = {
-    { 4, 120, 80, -360.0, 360.0, 0.0, 1.0,
-        "Specifies angle of rotation, in degrees.", "%.1f" },
-    { 5, 180, 80, -1.0, 1.0, 0.0, 0.01,
-    "Specifies X coordinate of vector to rotate about.", "%.2f" },
-    { 6, 240, 80, -1.0, 1.0, 1.0, 0.01,
-    "Specifies Y coordinate of vector to rotate about.", "%.2f" },
-    { 7, 300, 80, -1.0, 1.0, 0.0, 0.01,
-    "Specifies Z coordinate of vector to rotate about.", "%.2f" },
-};
-
-cell scale[3] = {
-    {  8, 120, 120, -5.0, 5.0, 1.0, 0.01,
-        "Specifies scale factor along X axis.", "%.2f" },
-    {  9, 180, 120, -5.0, 5.0, 1.0, 0.01,
-    "Specifies scale factor along Y axis.", "%.2f" },
-    { 10, 240, 120, -5.0, 5.0, 1.0, 0.01,
-    "Specifies scale factor along Z axis.", "%.2f" },
-};
 
 
 
+Mat4 _view; //This frame's camera, from eye, at and up
 
-GLfloat eye[3] = { 0.0, 0.0, 2.0 };
-GLfloat at[3]  = { 0.0, 0.0, 0.0 };
-GLfloat up[3]  = { 0.0, 1.0, 0.0 };
+//The game (see game.h) runs on a thread of its own, in fixed ticks of
+//TICK_MS, however often frames are drawn.  After each tick it publishes a
+//snapshot of everything drawScene needs, and each frame is drawn between
+//the last two ticks, so that motion stays smooth at any frame rate.  Apart
+//from the terrain, which doesn't change once loaded, the GLUT thread only
+//touches snapshots, and the game thread everything else.
 
+//If the game thread falls further behind than this, it skips the lost
+//time, so that after a long stall the game slows down rather than spending
+//ever longer catching up
+const int MAX_LAG_MS = 250;
 
-/*--------------------------------------------------------------------------*/
-
-
-GLuint _textureId; //The id of the texture
-
-
-//Makes the image into a texture, and returns the id of the texture
-GLuint loadTexture(Image* image) {
-	GLuint textureId;
-	glGenTextures(1, &textureId); //Make room for our texture
-	glBindTexture(GL_TEXTURE_2D, textureId); //Tell OpenGL which texture to edit
-	//Map the image to the texture
-	glTexImage2D(GL_TEXTURE_2D,                //Always GL_TEXTURE_2D
-				 0,                            //0 for now
-				 GL_RGB,                       //Format OpenGL uses for image
-				 image->width, image->height,  //Width and height
-				 0,                            //The border of the image
-				 GL_RGB, //GL_RGB, because pixels are stored in RGB format
-				 GL_UNSIGNED_BYTE, //GL_UNSIGNED_BYTE, because pixels are stored
-				                   //as unsigned numbers
-				 image->pixels);               //The actual pixel data
-	return textureId; //Returns the id of the texture
+float lerp(float a, float b, float t) {
+	return a + (b - a) * t;
 }
-/*--------------------------------------------------------------------------*/
-
 
+//The pose t of the way from a to b.  The heading turns the short way round.
+Pose interpolate(const Pose &a, const Pose &b, float t) {
+	Pose pose;
+	for(int i = 0; i < 3; i++) {
+		pose.pos[i] = lerp(a.pos[i], b.pos[i], t);
+		pose.eye[i] = lerp(a.eye[i], b.eye[i], t);
+		pose.at[i] = lerp(a.at[i], b.at[i], t);
+	}
+	float turn = fmodf(b.heading - a.heading, 360);
+	if (turn > 180) {
+		turn -= 360;
+	}
+	else if (turn < -180) {
+		turn += 360;
+	}
+	pose.heading = a.heading + turn * t;
+	pose.pitch = lerp(a.pitch, b.pitch, t);
+	pose.roll = lerp(a.roll, b.roll, t);
+	return pose;
+}
 
-//Represents a terrain, by storing a set of heights and normals at 2D locations
-class Terrain {
-	private:
-		int w; //Width
-		int l; //Length
-		float** hs; //Heights
-		Vec3f** normals;
-		bool computedNormals; //Whether normals is up-to-date
-	public:
-		Terrain(int w2, int l2) {
-			w = w2;
-			l = l2;
-			
-			hs = new float*[l];
-			for(int i = 0; i < l; i++) {
-				hs[i] = new float[w];
-			}
-			
-			normals = new Vec3f*[l];
-			for(int i = 0; i < l; i++) {
-				normals[i] = new Vec3f[w];
-			}
-			
-			computedNormals = false;
-		}
-		
-		~Terrain() {
-			for(int i = 0; i < l; i++) {
-				delete[] hs[i];
-			}
-			delete[] hs;
-			
-			for(int i = 0; i < l; i++) {
-				delete[] normals[i];
-			}
-			delete[] normals;
-		}
-		
-		int width() {
-			return w;
-		}
-		
-		int length() {
-			return l;
-		}
-		
-		//Sets the height at (x, z) to y
-		void setHeight(int x, int z, float y) {
-			hs[z][x] = y;
-			computedNormals = false;
-		}
-		
-		//Returns the height at (x, z)
-		float getHeight(int x, int z) {
-			return hs[z][x];
-		}
-		
-		//Computes the normals, if they haven't been computed yet
-		void computeNormals() {
-			if (computedNormals) {
-				return;
-			}
-			
-			//Compute the rough version of the normals
-			Vec3f** normals2 = new Vec3f*[l];
-			for(int i = 0; i < l; i++) {
-				normals2[i] = new Vec3f[w];
-			}
-			
-			for(int z = 0; z < l; z++) {
-				for(int x = 0; x < w; x++) {
-					Vec3f sum(0.0f, 0.0f, 0.0f);
-					
-					Vec3f out;
-					if (z > 0) {
-						out = Vec3f(0.0f, hs[z - 1][x] - hs[z][x], -1.0f);
-					}
-					Vec3f in;
-					if (z < l - 1) {
-						in = Vec3f(0.0f, hs[z + 1][x] - hs[z][x], 1.0f);
-					}
-					Vec3f left;
-					if (x > 0) {
-						left = Vec3f(-1.0f, hs[z][x - 1] - hs[z][x], 0.0f);
-					}
-					Vec3f right;
-					if (x < w - 1) {
-						right = Vec3f(1.0f, hs[z][x + 1] - hs[z][x], 0.0f);
-					}
-					
-					if (x > 0 && z > 0) {
-						sum += out.cross(left).normalize();
-					}
-					if (x > 0 && z < l - 1) {
-						sum += left.cross(in).normalize();
-					}
-					if (x < w - 1 && z < l - 1) {
-						sum += in.cross(right).normalize();
-					}
-					if (x < w - 1 && z > 0) {
-						sum += right.cross(out).normalize();
-					}
-					
-					normals2[z][x] = sum;
-				}
-			}
-			
-			//Smooth out the normals
-			const float FALLOUT_RATIO = 0.5f;
-			for(int z = 0; z < l; z++) {
-				for(int x = 0; x < w; x++) {
-					Vec3f sum = normals2[z][x];
-					
-					if (x > 0) {
-						sum += normals2[z][x - 1] * FALLOUT_RATIO;
-					}
-					if (x < w - 1) {
-						sum += normals2[z][x + 1] * FALLOUT_RATIO;
-					}
-					if (z > 0) {
-						sum += normals2[z - 1][x] * FALLOUT_RATIO;
-					}
-					if (z < l - 1) {
-						sum += normals2[z + 1][x] * FALLOUT_RATIO;
-					}
-					
-					if (sum.magnitude() == 0) {
-						sum = Vec3f(0.0f, 1.0f, 0.0f);
-					}
-					normals[z][x] = sum;
-				}
-			}
-			
-			for(int i = 0; i < l; i++) {
-				delete[] normals2[i];
-			}
-			delete[] normals2;
-			
-			computedNormals = true;
-		}
-		
-		//Returns the normal at (x, z)
-		Vec3f getNormal(int x, int z) {
-			if (!computedNormals) {
-				computeNormals();
-			}
-			return normals[z][x];
-		}
+//What the game looked like after a tick
+struct Snapshot {
+	Pose previous; //As of the tick before
+	Pose current;
+	std::chrono::steady_clock::time_point time; //When the tick ran
+	int score;
+	int gameTime;
+	bool started;
+	bool over;
+	bool headlight;
+	//Shared between snapshots until the balls change, since copying them
+	//every tick would cost as much as a tick with thousands of them
+	shared_ptr<const vector<Ball> > balls;
 };
-Terrain* _terrain;
-
 
+TripleBuffer<Snapshot> _snapshots;
 
-void drawBitmapText(char *string,float x,float y,float z) {
- char *c; glRasterPos3f(x, y,z); 
-for (c=string; *c != '\0'; c++) 
-{ glutBitmapCharacter(GLUT_BITMAP_TIMES_ROMAN_24, *c); 
-}
- }
+//Key presses, queued on the GLUT thread for the game thread
+struct KeyPress {
+	int key;
+	bool special; //Whether key is a GameKey
+};
+std::mutex _keyMutex;
+vector<KeyPress> _keyPresses; //Guarded by _keyMutex
 
+std::thread _gameThread;
+std::atomic<bool> _stopGame(false);
 
 
+/*--------------------------------------------------------------------------*/
 
 
+TextureManager* _textures;
+int _grassTexture; //Handle of the terrain's texture in _textures
 
-void create_ball()
-{
-	for(int z = 0; z < _terrain->length() - 1; z++) {
-		
-		for(int x = 0; x < _terrain->width(); x++) {
 
-//			x, _terrain->getHeight(x, z), z 
-
-
-		if ((rand() % 5000)==1)
-		{
-
-			Ball* ball = new Ball();
-				
-				ball->pos[0] = x;
-				ball->pos[1] =_terrain->getHeight(x, z);
-				ball->pos[2] = z;
-				
-				ball->r = 0.5f;
-				ball->marked=0;
-				int color_code = rand() % 3;
-				if (color_code==0)//red
-				{
-				ball->color[0] = 1.0f;
-				ball->color[1] = 0.0f;
-				ball->color[2] = 0.0f;
-				}
-				else if (color_code==1) // green
-				{
-				ball->color[0] = 0.0f;
-				ball->color[1] = 1.0f;
-				ball->color[2] = 0.0f;	
-				}
-				else
-				{
-				ball->color[0] = 0.0f;
-				ball->color[1] = 0.0f;
-				ball->color[2] = 0.0f;	
-				}
-
-
-				_balls.push_back(ball);
-
-
-
-		}	
-		
+/*--------------------------------------------------------------------------*/
 
-		}
 
-	}
 
 
 
 
+void drawBitmapText(char *string,float x,float y,float z) {
+ char *c; glRasterPos3f(x, y,z); 
+for (c=string; *c != '\0'; c++) 
+{ glutBitmapCharacter(GLUT_BITMAP_TIMES_ROMAN_24, *c); 
 }
+ }
 
-//Loads a terrain from a heightmap.  The heights of the terrain range from
-//-height / 2 to height / 2.
-Terrain* loadTerrain(const char* filename, float height) {
-	Image* image = loadBMP(filename);
-	Terrain* t = new Terrain(image->width, image->height);
-	for(int y = 0; y < image->height; y++) {
-		for(int x = 0; x < image->width; x++) {
-			unsigned char color =
-				(unsigned char)image->pixels[3 * (y * image->width + x)];
-			float h = height * ((color / 255.0f) - 0.5f);
-			t->setHeight(x, y, h);
-
-
-		}
-	}
-	
-	delete image;
-	t->computeNormals();
-	return t;
-}
 
 float _angle = 60.0f;
 
 
+//Stops the game thread and frees the terrain.  It runs at exit, however
+//the program ends (GLUT exits on its own when the window is closed), so
+//that the thread is done with the globals before they're destroyed.
 void cleanup() {
+	_stopGame = true;
+	if (_gameThread.joinable()) {
+		_gameThread.join();
+	}
 	delete _terrain;
+	_terrain = NULL;
 }
 
-void change_camera()
-{
-if(current_view==0) //helicopter
-{
-			eye[0] =  translation[0].value -  10*sin(DEG2RAD(rotation[0].value));
- 			 eye[1] = translation[1].value + 10;
-			 eye[2] =  translation[2].value -  10*cos(DEG2RAD(rotation[0].value));
-			 at[0]  =  translation[0].value + 4*sin(DEG2RAD(rotation[0].value));
-			 at[1]  =    translation[1].value + 0;
-			 at[2]  =  (translation[2].value +  4*cos(DEG2RAD(rotation[0].value)));
-}
-else if (current_view==1) // front wheel
-{
-	eye[0] =  translation[0].value;
- 			 eye[1] = translation[1].value + 2 ;
-			 eye[2] =  translation[2].value ;
-			 at[0]  =  translation[0].value + 5*sin(DEG2RAD(rotation[0].value));
-			 at[1]  =    translation[1].value + 2;
-			 at[2]  =  (translation[2].value +  5*cos(DEG2RAD(rotation[0].value)));
-
-}
-else if (current_view==2) // driver
-{
-			eye[0] =  translation[0].value - 2.8*sin(DEG2RAD(rotation[0].value));
- 			 eye[1] = translation[1].value +1;
-			 eye[2] =  translation[2].value - 2.8*cos(DEG2RAD(rotation[0].value));
-			 at[0]  =  translation[0].value + 2*sin(DEG2RAD(rotation[0].value));
-			 at[1]  =    translation[1].value +2;
-			 at[2]  =  (translation[2].value +  4*cos(DEG2RAD(rotation[0].value)));
-
-}
-else if (current_view==3) // overhead
-{
-			eye[0] =  translation[0].value -  10*sin(DEG2RAD(rotation[0].value));
- 			 eye[1] = translation[1].value + 10;
-			 eye[2] =  translation[2].value -  12*cos(DEG2RAD(rotation[0].value));
-			 at[0]  =  translation[0].value + 10*sin(DEG2RAD(rotation[0].value));
-			 at[1]  =    translation[1].value + 0;
-			 at[2]  =  (translation[2].value +  10*cos(DEG2RAD(rotation[0].value)));
-}
-else if (current_view==4) // chase
-{
-			eye[0] =  translation[0].value - 5*sin(DEG2RAD(rotation[0].value));
- 			 eye[1] = translation[1].value +1;
-			 eye[2] =  translation[2].value - 10*cos(DEG2RAD(rotation[0].value));
-			 at[0]  =  translation[0].value + 5*sin(DEG2RAD(rotation[0].value));
-			 at[1]  =    translation[1].value +2;
-			 at[2]  =  (translation[2].value +  5*cos(DEG2RAD(rotation[0].value)));
+//Prints the texture statistics and frees the textures.  It needs the GL
+//context, which is gone by the time cleanup() runs, so it's called before
+//exiting, and by freeglut when the window is closed.
+void releaseTextures() {
+	if (_textures != NULL) {
+		_textures->printStats(stdout);
+		delete _textures;
+		_textures = NULL;
+	}
 }
 
 
-
+void queueKey(int key, bool special) {
+	KeyPress press = {key, special};
+	std::lock_guard<std::mutex> lock(_keyMutex);
+	_keyPresses.push_back(press);
 }
 
-
-
-
 void handleKeypress(unsigned char key, int x, int y) 
 {
-	switch (key) 
-		{
-
-
-		case 97: // a - roll
-			rotation[0].value+=10;
-			break;
-
-		case 100: // d - roll
-			rotation[0].value-=10;
-			break;
-		case 104:
-			if(enable==0)
-				enable=1;
-			else enable = 0;
-			break;
-
-
-		
-
-
-		case 118: //v - change view
-			current_view =(current_view + 1)%5;
-			change_camera();
-			
+	if (key == 27 || key == 113) { //Escape or q
+		releaseTextures();
+		exit(0);
+	}
+	queueKey(key, false);
+}
 
- 
+void handleKeypress2(int key, int x, int y) 
+{
+	switch (key) {
+		case GLUT_KEY_LEFT:
+			queueKey(GAME_KEY_LEFT, true);
 			break;
-
-			
-
-
-
-
-		case 27: //Escape key
-			cleanup();
-			exit(0);
+		case GLUT_KEY_UP:
+			queueKey(GAME_KEY_UP, true);
 			break;
-
-
-		case 112:
-		
-
-		
-			if(pause_scene==0)
-				pause_scene=1;
-			else pause_scene=0;
+		case GLUT_KEY_RIGHT:
+			queueKey(GAME_KEY_RIGHT, true);
 			break;
-
-		
-		case 113:
-			cleanup();
-			exit(0);     // q key is pressed
+		case GLUT_KEY_DOWN:
+			queueKey(GAME_KEY_DOWN, true);
 			break;
-		
-
-		case 13:
-			
-		      if(game_start_flag==1)
-				{
-					game_start_flag=0;
-					pause_scene=0;
-					
-				}
-			break;	
-			
-			
-    
-		}
-
-
-
-	
-}
-
-
-void handleKeypress2(int key, int x, int y) 
-{
-if (pause_scene==0)
-{
-
-    if (key == GLUT_KEY_UP)
-	{
-		vel+=thrust;		
-
-
-	}
-if (key == GLUT_KEY_DOWN)
-	{
-		vel-=thrust;
-
-
-       	
-	}
-    if (key == GLUT_KEY_RIGHT)
-        {
-
-		
-		rotation[0].value-=3;
-		if(rotation[0].value<0)
-			{
-				rotation[0].value = 360 + rotation[0].value;
-			}
-		rotation[1].value = 0.0;
-	        rotation[2].value = 1.0;
-	        rotation[3].value = 0.0;
-		roll += 2;
-
-
 	}
-if (key == GLUT_KEY_LEFT)
-        {
-
-		rotation[0].value+=3;
-		if(rotation[0].value>360)
-			{
-				rotation[0].value =  rotation[0].value - 360;
-			}
-		rotation[1].value = 0.0;
-	        rotation[2].value = 1.0;
-	        rotation[3].value = 0.0;
-		roll -= 2;
-
-	}
-
 }
-}
-
 
 void initRendering() {
 	glEnable(GL_DEPTH_TEST);
@@ -577,9 +218,10 @@ void initRendering() {
 	glShadeModel(GL_SMOOTH);
 
 
-	Image* image = loadBMP("grass1.bmp");
-	_textureId = loadTexture(image);
-	delete image;
+	//The texture is read in the background, and the terrain is drawn with
+	//a placeholder until it has been uploaded
+	_textures = new TextureManager();
+	_grassTexture = _textures->acquire("grass1.bmp");
 
 }
 
@@ -592,7 +234,7 @@ void handleResize(int width, int height) {
 glViewport(0, 0, width, height);
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
-    gluPerspective(45.0, (float)width/height, 1.0, 200.0);
+    glLoadMatrixf(Mat4::perspective(45.0f, (float)width/height, 1.0f, 200.0f).data());
     glGetDoublev(GL_PROJECTION_MATRIX, projection);
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
@@ -613,9 +255,15 @@ glViewport(0, 0, width, height);
 
 }
 
+#define NUM_LODS 3
+//Screen heights, in pixels, below which the next coarser level of detail of
+//the bike is drawn
+const float LOD_PIXELS[NUM_LODS - 1] = { 120.0f, 40.0f };
+
 GLMmodel* pmodel = NULL;
+GLMmodel* plods[NUM_LODS]; //pmodel, then simplified copies of it
 void
-drawmodel(void)
+drawmodel(float distance)
 {
     if (!pmodel) {
         pmodel = glmReadOBJ("Bike.obj");
@@ -623,27 +271,45 @@ drawmodel(void)
         glmUnitize(pmodel);
         glmFacetNormals(pmodel);
         glmVertexNormals(pmodel, 90.0);
+        glmOptimize(pmodel, 24, GL_TRUE, NULL);
+        
+        //Each level of detail has a quarter of the triangles of the last
+        plods[0] = pmodel;
+        for(int i = 1; i < NUM_LODS; i++) {
+            plods[i] = glmCopy(plods[i - 1]);
+            glmSimplify(plods[i], plods[i - 1]->numtriangles / 4);
+            glmOptimize(plods[i], 24, GL_TRUE, NULL);
+        }
     }
     
-    glmDraw(pmodel, GLM_SMOOTH | GLM_MATERIAL);
+    //The unitized bike is at most 2 units tall; work out how many pixels
+    //that covers at this distance
+    float pixels = 2.0f / (distance * tan(DEG2RAD(45.0) / 2)) *
+        glutGet(GLUT_WINDOW_HEIGHT) / 2;
+    int lod = 0;
+    while (lod < NUM_LODS - 1 && pixels < LOD_PIXELS[lod]) {
+        lod++;
+    }
+    glmDraw(plods[lod], GLM_SMOOTH | GLM_MATERIAL);
 }
-int temp=0;
 void drawScene() {
+	_snapshots.update();
+	const Snapshot &snapshot = _snapshots.read();
+	float alpha = chrono::duration<float, milli>(
+		chrono::steady_clock::now() - snapshot.time).count() / TICK_MS;
+	Pose pose = interpolate(snapshot.previous, snapshot.current,
+							max(0.0f, min(alpha, 1.0f)));
 
-
-if(temp==0)
-{create_ball();
-temp=1;
-}
+	//Uploads any textures that have been read since the last frame
+	_textures->update();
 
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	
 	glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
-
-	glTranslatef(0.0f, 0.0f, 0.0f);
-	//glRotatef(30.0f, 1.0f, 0.0f, 0.0f);
-gluLookAt(eye[0], eye[1], eye[2], at[0], at[1], at[2], up[0], up[1],up[2]);	
+	_view = Mat4::lookAt(Vec3f(pose.eye[0], pose.eye[1], pose.eye[2]),
+						 Vec3f(pose.at[0], pose.at[1], pose.at[2]),
+						 Vec3f(up[0], up[1], up[2]));
+	glLoadMatrixf(_view.data());
 
 
 
@@ -668,7 +334,7 @@ glPushMatrix();
 
 	GLfloat lightPos2[]={ 100.0 , 60.0 , 80.0, 1.0};
 //	GLfloat dirVector2[]={ 100.0, -5.0, 100.0, 1.0};
-	GLfloat dirVector2[]={ translation[0].value - 100, translation[1].value - 60,translation[2].value- 80.0, 1.0};
+	GLfloat dirVector2[]={ pose.pos[0] - 100, pose.pos[1] - 60,pose.pos[2]- 80.0, 1.0};
 	GLfloat ambientLight2[] = {1.0f, 0.0f, 0.0f, 1.0f};
 	GLfloat diffuseLight2[] = {1.0f, 0.0f, 0.0f, 1.0f};
 //	GLfloat specLight2[] = {0.7f,0.7f,0.7f,1.0f};
@@ -695,10 +361,10 @@ glEnable(GL_LIGHT2);
 //--------------------------------------------------------------------------//
 
 	glEnable(GL_TEXTURE_2D);
-	glBindTexture(GL_TEXTURE_2D, _textureId);
+	glBindTexture(GL_TEXTURE_2D, _textures->texture(_grassTexture));
 	
 	//Bottom
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -778,40 +444,44 @@ char ar8[]="Time up!! Game over!\nPress Q to Quit!";
 char ar5[]="Press Enter to start the game!";
 char ar6[]="Time: ";
 
-    glRasterPos3f(translation[0].value, 1.0f,translation[2].value); 
+    glRasterPos3f(pose.pos[0], 1.0f,pose.pos[2]); 
 
- sprintf(ar3,"           %d",score);
-sprintf(ar7,"           %d",game_time);  
+ sprintf(ar3,"           %d",snapshot.score);
+sprintf(ar7,"           %d",snapshot.gameTime);  
 
 
 int x_x = (glutGet(GLUT_SCREEN_WIDTH)/100) - 2,z_z= glutGet(GLUT_SCREEN_WIDTH)/50 ;
 
 int temp_int = 10;
-drawBitmapText(ar2,translation[0].value +  temp_int*sin(DEG2RAD(rotation[0].value)) + x_x,_terrain->getHeight(translation[0].value +  temp_int*sin(DEG2RAD(rotation[0].value)) + x_x,translation[2].value  +  temp_int*cos(DEG2RAD(rotation[0].value)) + z_z) + 1 ,translation[2].value  +  temp_int*cos(DEG2RAD(rotation[0].value)) + z_z);
-
-drawBitmapText(ar3,translation[0].value +  temp_int*sin(DEG2RAD(rotation[0].value)) + x_x,_terrain->getHeight(translation[0].value +  temp_int*sin(DEG2RAD(rotation[0].value)) + x_x,translation[2].value  +  temp_int*cos(DEG2RAD(rotation[0].value)) + z_z) + 1 ,translation[2].value  +  temp_int*cos(DEG2RAD(rotation[0].value)) + z_z);
-if(game_over_flag!=1)
+//The HUD's text floats temp_int ahead of the bike, just above the ground
+float hudX = pose.pos[0] + temp_int*sinf(DEG2RAD(pose.heading)) + x_x;
+float hudZ = pose.pos[2] + temp_int*cosf(DEG2RAD(pose.heading)) + z_z;
+float hudY = _terrain->getHeight(hudX, hudZ);
+drawBitmapText(ar2,hudX, hudY + 1, hudZ);
+
+drawBitmapText(ar3,hudX, hudY + 1, hudZ);
+if(!snapshot.over)
 {
-if(game_time<=20)
+if(snapshot.gameTime<=20)
 glColor3f(0.5f, 0.0f, 0.0f);
-drawBitmapText(ar6,translation[0].value +  temp_int*sin(DEG2RAD(rotation[0].value)) + x_x,_terrain->getHeight(translation[0].value +  temp_int*sin(DEG2RAD(rotation[0].value)) + x_x,translation[2].value  +  temp_int*cos(DEG2RAD(rotation[0].value)) + z_z) + 2.5 ,translation[2].value  +  temp_int*cos(DEG2RAD(rotation[0].value)) + z_z);
-drawBitmapText(ar7,translation[0].value +  temp_int*sin(DEG2RAD(rotation[0].value)) + x_x,_terrain->getHeight(translation[0].value +  temp_int*sin(DEG2RAD(rotation[0].value)) + x_x,translation[2].value  +  temp_int*cos(DEG2RAD(rotation[0].value)) + z_z) + 2.5 ,translation[2].value  +  temp_int*cos(DEG2RAD(rotation[0].value)) + z_z);
+drawBitmapText(ar6,hudX, hudY + 2.5, hudZ);
+drawBitmapText(ar7,hudX, hudY + 2.5, hudZ);
 }
 
 
 
-  if(game_over_flag==1)
+  if(snapshot.over)
     {
 	glColor3f(1.0f, 0.0f, 0.0f);
-if(game_time<=0)
-	drawBitmapText(ar8,translation[0].value +  temp_int*sin(DEG2RAD(rotation[0].value)) + x_x,_terrain->getHeight(translation[0].value +  temp_int*sin(DEG2RAD(rotation[0].value)) + x_x,translation[2].value  +  temp_int*cos(DEG2RAD(rotation[0].value)) + z_z) + 2.5 ,translation[2].value  +  temp_int*cos(DEG2RAD(rotation[0].value)) + z_z);
+if(snapshot.gameTime<=0)
+	drawBitmapText(ar8,hudX, hudY + 2.5, hudZ);
 
 else
 
-	drawBitmapText(ar4,translation[0].value +  temp_int*sin(DEG2RAD(rotation[0].value)) + x_x,_terrain->getHeight(translation[0].value +  temp_int*sin(DEG2RAD(rotation[0].value)) + x_x,translation[2].value  +  temp_int*cos(DEG2RAD(rotation[0].value)) + z_z) + 2.5 ,translation[2].value  +  temp_int*cos(DEG2RAD(rotation[0].value)) + z_z);
+	drawBitmapText(ar4,hudX, hudY + 2.5, hudZ);
 
 	}
-if(game_start_flag==1)
+if(!snapshot.started)
     {
 	glColor3f(0.7f, 0.0f, 0.0f);
 drawBitmapText(ar5,14,_terrain->getHeight(14,3),3);
@@ -823,37 +493,13 @@ drawBitmapText(ar5,14,_terrain->getHeight(14,3),3);
 
 
 
- 
-/* checking height of next point
-float tempx = translation[2].value + vel * 0.1 * cos(DEG2RAD(rotation[0].value));
-float tempy = translation[0].value + vel * 0.1 * sin(DEG2RAD(rotation[0].value));
-float next_height = _terrain->getHeight(int(tempx),int(tempy));*/
-float current_height = _terrain->getHeight(int(translation[0].value) ,int(translation[2].value))  +1; ;
-
-if(prev_temp > current_height + 0.1)
-{
-
-//translation[1].value = current_height + (current_height*0.1);
-translation[1].value = prev_temp ;
-
-pitch = 0;
-
-}
-else
-{
-translation[1].value = current_height; 
-
-}
-
-prev_temp = _terrain->getHeight(int(translation[0].value) ,int(translation[2].value))  +1; 
-
-
-        glTranslatef(translation[0].value,translation[1].value  ,
-            translation[2].value);
-        glRotatef(rotation[0].value, rotation[1].value, 
-            rotation[2].value, rotation[3].value);
-	glRotatef(-pitch,1,0,0);
-	glRotatef(roll,0,0,1);
+	//The bike turns to its heading, then pitches and rolls
+	Quat bikeRotation =
+		Quat::axisAngle(pose.heading, Vec3f(0, 1, 0)) *
+		Quat::axisAngle(-pose.pitch, Vec3f(1, 0, 0)) *
+		Quat::axisAngle(pose.roll, Vec3f(0, 0, 1));
+	Mat4 bike = Mat4::translation(pose.pos) * Mat4::rotation(bikeRotation);
+	glLoadMatrixf((_view * bike).data());
 
     //glScalef(scale[0].value, scale[1].value, scale[2].value);
 
@@ -876,7 +522,7 @@ GLfloat light1_ambient[] = { 1.0, 1.0, 0.0, 1.0 };
 			glLightf(GL_LIGHT1, GL_SPOT_CUTOFF, 90.0);
 			glLightfv(GL_LIGHT1, GL_SPOT_DIRECTION, spot_direction);
 			glLightf(GL_LIGHT1, GL_SPOT_EXPONENT, 2.0);
-			if(enable==1)
+			if(snapshot.headlight)
 			glEnable(GL_LIGHT1);
 			else glDisable(GL_LIGHT1);
 			
@@ -884,15 +530,17 @@ glPopMatrix();
 
 
 	glColor3f(0.0f, 0.2f, 0.0f);	
-	drawmodel();
+	drawmodel(sqrt(pow(pose.eye[0] - pose.pos[0], 2) +
+				   pow(pose.eye[1] - pose.pos[1], 2) +
+				   pow(pose.eye[2] - pose.pos[2], 2)));
 
 glPopMatrix();
 
 
-for(unsigned int i = 0; i < _balls.size(); i++) {
-		Ball* ball = _balls[i];
-		glPushMatrix();
-		glTranslatef(ball->pos[0], ball->pos[1], ball->pos[2]);
+const vector<Ball> &balls = *snapshot.balls;
+for(unsigned int i = 0; i < balls.size(); i++) {
+		const Ball* ball = &balls[i];
+		glLoadMatrixf((_view * Mat4::translation(ball->pos)).data());
 		if(ball->color[0]==0 && ball->color[1]==0 && ball->color[2]==0)
 			glColor3f(0.0, 0.0, 0.0);
 		else if(ball->color[1]==1)
@@ -900,89 +548,81 @@ for(unsigned int i = 0; i < _balls.size(); i++) {
 		else 			glColor3f(1.0, 1.0, 0.0);
 		glutSolidSphere(ball->r,
                     50,50);
-				glPopMatrix();
 
 	}
+	glLoadMatrixf(_view.data());
 
 
 	
 	glutSwapBuffers();
 }
 
-void update(int value) {
-if(pause_scene==0)
-{
 
-if(game_time<=0)
-{
-  game_over_flag=1;
-pause_scene=1;
+//Fills in the snapshot to publish after a tick
+void takeSnapshot(Snapshot &snapshot, const Pose &previous) {
+	snapshot.previous = previous;
+	snapshot.current = currentPose();
+	snapshot.time = chrono::steady_clock::now();
+	snapshot.score = score;
+	snapshot.gameTime = game_time;
+	snapshot.started = game_start_flag == 0;
+	snapshot.over = game_over_flag == 1;
+	snapshot.headlight = enable == 1;
+	
+	//The copy of the balls the latest snapshots share
+	static shared_ptr<const vector<Ball> > balls;
+	static unsigned ballsVersion;
+	if (balls == NULL || ballsVersion != _balls.version()) {
+		balls = make_shared<const vector<Ball> >(_balls.all());
+		ballsVersion = _balls.version();
+	}
+	snapshot.balls = balls;
 }
 
-
-game_time--;
-
-for(unsigned int i = 0; i < _balls.size(); i++) {
-			Ball* ball = _balls[i];
-	if(abs(ball->pos[0]-translation[0].value)<2  && abs(ball->pos[1]-translation[1].value)<2 && abs(ball->pos[2]-translation[2].value)<2)
-		{		_balls.erase (_balls.begin()+i);
-			score++;
-			game_time+=25;
+//Acts on the keys pressed since the last tick, on the game thread
+void applyKeyPresses() {
+	static vector<KeyPress> presses;
+	{
+		std::lock_guard<std::mutex> lock(_keyMutex);
+		presses.swap(_keyPresses);
+	}
+	for(size_t i = 0; i < presses.size(); i++) {
+		if (presses[i].special) {
+			applySpecialKey(presses[i].key);
+		}
+		else {
+			applyKeypress((unsigned char)presses[i].key);
 		}
 	}
-
-
-
-if(abs(roll)>25)
-{
-  game_over_flag=1;
-pause_scene=1;
+	presses.clear();
 }
 
-
-
-// Calculation of pitch and roll
-Vec3f normal_new = _terrain->getNormal(translation[0].value, translation[2].value);
-float theta = acos(normal_new[1]/sqrt( (pow(normal_new[0],2)) + (pow(normal_new[1],2)) + (pow(normal_new[2],2))));
-theta = RAD2DEG(theta);
-pitch = theta;
-
-
-accn -= 0.00005*sin(DEG2RAD(theta)) ;
-vel += accn;
-
-
-translation[2].value += vel * 0.1 * cos(DEG2RAD(rotation[0].value));
-translation[0].value += vel * 0.1 * sin(DEG2RAD(rotation[0].value));
-//printf("\nI was here\n %f %f %f \n\n",translation[0].value,translation[2].value,theta);
-
-
-		change_camera();        	
-	glutPostRedisplay();
-
-
+//The game thread: runs a tick every TICK_MS and publishes what it did
+void runGame() {
+	chrono::steady_clock::time_point next = chrono::steady_clock::now();
+	while (!_stopGame) {
+		next += chrono::milliseconds(TICK_MS);
+		this_thread::sleep_until(next);
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		if (now - next > chrono::milliseconds(MAX_LAG_MS)) {
+			next = now;
+		}
+		
+		Pose previous = currentPose();
+		applyKeyPresses();
+		step();
+		takeSnapshot(_snapshots.write(), previous);
+		_snapshots.publish();
+	}
 }
-	glutTimerFunc(25, update, 0);
 
+//Asks for frames as fast as they can be drawn
+void idle() {
+	glutPostRedisplay();
 }
 
 
 int main(int argc, char** argv) {
-
-
-
-
- translation[0].value=0;
- translation[2].value=0;
-rotation[0].value = 45;
-prev_temp = -10;
-
-change_camera();
-
-
-
-
-
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
 	glutInitWindowSize(400, 400);
@@ -991,16 +631,27 @@ change_camera();
 	initRendering();
 	
 	_terrain = loadTerrain("height_map.bmp", 20);
+	if (_terrain == NULL) {
+		releaseTextures();
+		exit(1);
+	}
+	resetGame();
+	takeSnapshot(_snapshots.write(), currentPose());
+	_snapshots.publish();
 
 	glutDisplayFunc(drawScene);
 	glutKeyboardFunc(handleKeypress);
 	glutSpecialFunc(handleKeypress2);
 	glutReshapeFunc(handleResize);
+#ifdef FREEGLUT
+	glutCloseFunc(releaseTextures);
+#endif
 	
 
 
-	glutTimerFunc(1000, update, 0);
-	//glutTimerFunc(1000, update2, 0);
+	glutIdleFunc(idle);
+	_gameThread = thread(runGame);
+	atexit(cleanup);
 
 
 	glutMainLoop();
@@ -0,0 +1,209 @@
+#ifndef MAT4_H_INCLUDED
+#define MAT4_H_INCLUDED
+
+#include <math.h>
+#include "vec3f.h"
+
+//Rotations, as unit quaternions.  Angles are in degrees, as in glRotatef.
+struct Quat {
+	float x, y, z, w;
+
+	constexpr Quat() : x(0), y(0), z(0), w(1) {
+
+	}
+
+	constexpr Quat(float x2, float y2, float z2, float w2) :
+		x(x2), y(y2), z(z2), w(w2) {
+
+	}
+
+	//A rotation of degrees counterclockwise about axis, which needn't be
+	//of unit length
+	static Quat axisAngle(float degrees, const Vec3f &axis) {
+		float half = degrees * (float)(M_PI / 360);
+		float s = sinf(half) / axis.magnitude();
+		return Quat(axis[0] * s, axis[1] * s, axis[2] * s, cosf(half));
+	}
+
+	//This rotation after other
+	constexpr Quat operator*(const Quat &other) const {
+		return Quat(w * other.x + x * other.w + y * other.z - z * other.y,
+					w * other.y - x * other.z + y * other.w + z * other.x,
+					w * other.z + x * other.y - y * other.x + z * other.w,
+					w * other.w - x * other.x - y * other.y - z * other.z);
+	}
+
+	constexpr Quat conjugate() const {
+		return Quat(-x, -y, -z, w);
+	}
+
+	//Rescales to unit length, to undo drift after many products
+	Quat normalize() const {
+		float r = 1 / sqrtf(x * x + y * y + z * z + w * w);
+		return Quat(x * r, y * r, z * r, w * r);
+	}
+
+	Vec3f rotate(const Vec3f &v) const {
+		//v + 2w(q x v) + 2q x (q x v), where q is the vector part
+		Vec3f q(x, y, z);
+		Vec3f t = q.cross(v) * 2;
+		return v + t * w + q.cross(t);
+	}
+};
+
+//A 4x4 matrix, stored column major like OpenGL's, so that data() can go
+//straight to glLoadMatrixf.  The factories build the same matrices as the
+//GL and GLU calls they are named after.
+struct Mat4 {
+	alignas(16) float m[16];
+
+	//The identity
+	constexpr Mat4() :
+		m{1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1} {
+
+	}
+
+	//Takes the columns in order
+	constexpr Mat4(float m0, float m1, float m2, float m3,
+				   float m4, float m5, float m6, float m7,
+				   float m8, float m9, float m10, float m11,
+				   float m12, float m13, float m14, float m15) :
+		m{m0, m1, m2, m3, m4, m5, m6, m7,
+		  m8, m9, m10, m11, m12, m13, m14, m15} {
+
+	}
+
+	const float* data() const {
+		return m;
+	}
+
+	//Element at row, column
+	constexpr float operator()(int row, int column) const {
+		return m[4 * column + row];
+	}
+
+	//glTranslatef
+	static constexpr Mat4 translation(float x, float y, float z) {
+		return Mat4(1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, x, y, z, 1);
+	}
+
+	static constexpr Mat4 translation(const float* v) {
+		return translation(v[0], v[1], v[2]);
+	}
+
+	//glScalef
+	static constexpr Mat4 scaling(float x, float y, float z) {
+		return Mat4(x, 0, 0, 0, 0, y, 0, 0, 0, 0, z, 0, 0, 0, 0, 1);
+	}
+
+	static constexpr Mat4 rotation(const Quat &q) {
+		return Mat4(1 - 2 * (q.y * q.y + q.z * q.z),
+					2 * (q.x * q.y + q.z * q.w),
+					2 * (q.x * q.z - q.y * q.w),
+					0,
+					2 * (q.x * q.y - q.z * q.w),
+					1 - 2 * (q.x * q.x + q.z * q.z),
+					2 * (q.y * q.z + q.x * q.w),
+					0,
+					2 * (q.x * q.z + q.y * q.w),
+					2 * (q.y * q.z - q.x * q.w),
+					1 - 2 * (q.x * q.x + q.y * q.y),
+					0,
+					0, 0, 0, 1);
+	}
+
+	//glRotatef
+	static Mat4 rotation(float degrees, const Vec3f &axis) {
+		return rotation(Quat::axisAngle(degrees, axis));
+	}
+
+	//gluLookAt
+	static Mat4 lookAt(const Vec3f &eye, const Vec3f &at, const Vec3f &up) {
+		Vec3f f = (at - eye).normalize();
+		Vec3f s = f.cross(up).normalize();
+		Vec3f u = s.cross(f);
+		return Mat4(s[0], u[0], -f[0], 0,
+					s[1], u[1], -f[1], 0,
+					s[2], u[2], -f[2], 0,
+					-s.dot(eye), -u.dot(eye), f.dot(eye), 1);
+	}
+
+	//gluPerspective, with fovy in degrees
+	static Mat4 perspective(float fovy, float aspect, float zNear,
+							float zFar) {
+		float f = 1 / tanf(fovy * (float)(M_PI / 360));
+		float depth = zNear - zFar;
+		return Mat4(f / aspect, 0, 0, 0,
+					0, f, 0, 0,
+					0, 0, (zFar + zNear) / depth, -1,
+					0, 0, 2 * zFar * zNear / depth, 0);
+	}
+
+	//This transform after other, as glMultMatrixf(other) would leave it
+	Mat4 operator*(const Mat4 &other) const {
+		Mat4 out;
+#if VEC3F_SIMD
+		__m128 c0 = _mm_load_ps(m);
+		__m128 c1 = _mm_load_ps(m + 4);
+		__m128 c2 = _mm_load_ps(m + 8);
+		__m128 c3 = _mm_load_ps(m + 12);
+		for(int j = 0; j < 4; j++) {
+			const float* b = other.m + 4 * j;
+			__m128 c = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(b[0])),
+						   _mm_mul_ps(c1, _mm_set1_ps(b[1]))),
+				_mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(b[2])),
+						   _mm_mul_ps(c3, _mm_set1_ps(b[3]))));
+			_mm_store_ps(out.m + 4 * j, c);
+		}
+#else
+		for(int j = 0; j < 4; j++) {
+			const float* b = other.m + 4 * j;
+			for(int i = 0; i < 4; i++) {
+				out.m[4 * j + i] = (m[i] * b[0] + m[4 + i] * b[1]) +
+					(m[8 + i] * b[2] + m[12 + i] * b[3]);
+			}
+		}
+#endif
+		return out;
+	}
+
+	//Transforms a point (with w = 1), ignoring the resulting w
+	Vec3f transformPoint(const Vec3f &p) const {
+		return Vec3f(m[0] * p[0] + m[4] * p[1] + m[8] * p[2] + m[12],
+					 m[1] * p[0] + m[5] * p[1] + m[9] * p[2] + m[13],
+					 m[2] * p[0] + m[6] * p[1] + m[10] * p[2] + m[14]);
+	}
+
+	//Transforms a direction (with w = 0)
+	Vec3f transformDirection(const Vec3f &d) const {
+		return Vec3f(m[0] * d[0] + m[4] * d[1] + m[8] * d[2],
+					 m[1] * d[0] + m[5] * d[1] + m[9] * d[2],
+					 m[2] * d[0] + m[6] * d[1] + m[10] * d[2]);
+	}
+
+	//The inverse of a transform made of rotations and translations only
+	Mat4 rigidInverse() const {
+		//The transpose of the rotation, and the translation rotated back
+		Mat4 out(m[0], m[4], m[8], 0,
+				 m[1], m[5], m[9], 0,
+				 m[2], m[6], m[10], 0,
+				 0, 0, 0, 1);
+		Vec3f t = out.transformDirection(Vec3f(m[12], m[13], m[14]));
+		out.m[12] = -t[0];
+		out.m[13] = -t[1];
+		out.m[14] = -t[2];
+		return out;
+	}
+};
+
+
+
+
+
+
+
+
+
+
+#endif
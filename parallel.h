@@ -0,0 +1,155 @@
+#ifndef PARALLEL_H_INCLUDED
+#define PARALLEL_H_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//A fixed set of worker threads that split index ranges between themselves.
+//The calling thread works on the range too, so on a single core machine
+//everything simply runs inline.
+class ThreadPool {
+	private:
+		std::vector<std::thread> workers;
+		std::mutex mutex;
+		std::mutex jobMutex; //Held by whichever thread owns the current job
+		std::condition_variable wake;
+		std::condition_variable done;
+		const std::function<void(size_t, size_t)>* job;
+		std::atomic<size_t> next;
+		size_t jobEnd;
+		size_t jobGrain;
+		unsigned generation;
+		int active; //Workers that have not finished the current job
+		bool stopping;
+
+		//Whether the current thread is already running part of a job
+		static bool &insideJob() {
+			static thread_local bool inside = false;
+			return inside;
+		}
+
+		void runChunks() {
+			for(;;) {
+				size_t b = next.fetch_add(jobGrain);
+				if (b >= jobEnd) {
+					break;
+				}
+				(*job)(b, std::min(b + jobGrain, jobEnd));
+			}
+		}
+
+		void workerLoop() {
+			insideJob() = true;
+			unsigned seen = 0;
+			for(;;) {
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [&] { return stopping || generation != seen; });
+				if (stopping) {
+					return;
+				}
+				seen = generation;
+				lock.unlock();
+
+				runChunks();
+
+				lock.lock();
+				if (--active == 0) {
+					done.notify_one();
+				}
+			}
+		}
+	public:
+		explicit ThreadPool(unsigned numThreads) :
+			job(NULL), next(0), jobEnd(0), jobGrain(1), generation(0),
+			active(0), stopping(false) {
+			for(unsigned i = 1; i < numThreads; i++) {
+				workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+			}
+		}
+
+		~ThreadPool() {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			wake.notify_all();
+			for(size_t i = 0; i < workers.size(); i++) {
+				workers[i].join();
+			}
+		}
+
+		//Returns the pool shared by the whole program, with one thread per core
+		static ThreadPool &instance() {
+			static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+			return pool;
+		}
+
+		//Returns the number of threads that work on a job, including the caller
+		int size() const {
+			return (int)workers.size() + 1;
+		}
+
+		//Calls fn(b, e) for consecutive subranges [b, e) of [begin, end) that
+		//are at most grain long, and returns once the whole range is done.
+		//Nested calls, and calls made while another thread owns the pool, run
+		//serially on the calling thread.
+		void run(size_t begin, size_t end, size_t grain,
+				 const std::function<void(size_t, size_t)> &fn) {
+			if (end <= begin) {
+				return;
+			}
+			grain = std::max(grain, (size_t)1);
+			if (workers.empty() || end - begin <= grain || insideJob() ||
+				!jobMutex.try_lock()) {
+				fn(begin, end);
+				return;
+			}
+
+			job = &fn;
+			next = begin;
+			jobEnd = end;
+			jobGrain = grain;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				active = (int)workers.size();
+				generation++;
+			}
+			wake.notify_all();
+
+			insideJob() = true;
+			runChunks();
+			insideJob() = false;
+
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				done.wait(lock, [&] { return active == 0; });
+			}
+			job = NULL;
+			jobMutex.unlock();
+		}
+};
+
+//Splits [begin, end) into chunks of at most grain indices and calls
+//fn(chunkBegin, chunkEnd) for each of them on the shared thread pool
+template<class F>
+void parallelFor(size_t begin, size_t end, size_t grain, F fn) {
+	ThreadPool::instance().run(begin, end, grain,
+							   std::function<void(size_t, size_t)>(fn));
+}
+
+
+
+
+
+
+
+
+
+
+#endif
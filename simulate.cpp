@@ -0,0 +1,191 @@
+//Runs the game without a window, as fast as it will go, for batch testing,
+//tuning and profiling the game logic on its own.  Key presses come from a
+//script, and each game that ends is followed straight away by a new one,
+//until the given number of ticks have run.  "make simulate" builds this;
+//it prints what happened, and how many ticks a second it managed (not
+//counting the time spent setting up new games), as one JSON object.
+//
+//Usage: simulate [--ticks=N] [--seed=N] [--terrain=file] [--script=file]
+//
+//A script has a key press per line: the tick, counted from the start of
+//each game, and the key, which is one of up, down, left, right and enter,
+//or a single letter as typed in the game.  Lines starting with # are
+//ignored.  Presses for the same tick are made in order.  Without a script,
+//each game is started with Enter and then left to roll.
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "imageloader.cpp"
+#include "vec3farray.cpp"
+#include "terrain.cpp"
+#include "game.cpp"
+
+using namespace std;
+
+//A scripted key press
+struct ScriptedKey {
+	int tick;
+	int key;
+	bool special; //Whether key is a GameKey
+};
+
+bool lessByTick(const ScriptedKey &a, const ScriptedKey &b) {
+	return a.tick < b.tick;
+}
+
+//Reads a script into keys, sorted by tick.  Returns false, after printing
+//why, if it can't be read.
+bool readScript(const char* filename, vector<ScriptedKey> &keys) {
+	FILE* file = fopen(filename, "r");
+	if (file == NULL) {
+		perror(filename);
+		return false;
+	}
+
+	char line[256];
+	int lineNumber = 0;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		lineNumber++;
+		char name[64];
+		ScriptedKey key;
+		if (line[0] == '#' || sscanf(line, " %63s", name) != 1) {
+			continue;
+		}
+		if (sscanf(line, "%d %63s", &key.tick, name) != 2 || key.tick < 0) {
+			fprintf(stderr, "%s:%d: expected a tick and a key\n", filename,
+					lineNumber);
+			fclose(file);
+			return false;
+		}
+
+		string s = name;
+		key.special = true;
+		if (s == "up") {
+			key.key = GAME_KEY_UP;
+		}
+		else if (s == "down") {
+			key.key = GAME_KEY_DOWN;
+		}
+		else if (s == "left") {
+			key.key = GAME_KEY_LEFT;
+		}
+		else if (s == "right") {
+			key.key = GAME_KEY_RIGHT;
+		}
+		else if (s == "enter") {
+			key.key = 13;
+			key.special = false;
+		}
+		else if (s.size() == 1) {
+			key.key = (unsigned char)s[0];
+			key.special = false;
+		}
+		else {
+			fprintf(stderr, "%s:%d: unknown key %s\n", filename, lineNumber,
+					name);
+			fclose(file);
+			return false;
+		}
+		keys.push_back(key);
+	}
+	fclose(file);
+	stable_sort(keys.begin(), keys.end(), lessByTick);
+	return true;
+}
+
+int main(int argc, char** argv) {
+	long long ticks = 100000;
+	unsigned seed = 1;
+	string terrainFile = "height_map.bmp";
+	string scriptFile;
+	for(int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg.compare(0, 8, "--ticks=") == 0) {
+			ticks = max(0LL, atoll(arg.c_str() + 8));
+		}
+		else if (arg.compare(0, 7, "--seed=") == 0) {
+			seed = (unsigned)strtoul(arg.c_str() + 7, NULL, 10);
+		}
+		else if (arg.compare(0, 10, "--terrain=") == 0) {
+			terrainFile = arg.substr(10);
+		}
+		else if (arg.compare(0, 9, "--script=") == 0) {
+			scriptFile = arg.substr(9);
+		}
+		else {
+			fprintf(stderr, "usage: %s [--ticks=N] [--seed=N] [--terrain=file] "
+					"[--script=file]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	vector<ScriptedKey> script;
+	if (scriptFile.empty()) {
+		ScriptedKey start = {0, 13, false};
+		script.push_back(start);
+	}
+	else if (!readScript(scriptFile.c_str(), script)) {
+		return 1;
+	}
+
+	_terrain = loadTerrain(terrainFile.c_str(), 20);
+	if (_terrain == NULL) {
+		return 1;
+	}
+	srand(seed);
+
+	int games = 0;
+	long long totalScore = 0;
+	int bestScore = 0;
+	double resetSeconds = 0; //Spent setting up new games
+
+	chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+	resetGame();
+	int gameTick = 0;
+	size_t next = 0; //Into script
+	for(long long tick = 0; tick < ticks; tick++) {
+		for(; next < script.size() && script[next].tick == gameTick; next++) {
+			if (script[next].special) {
+				applySpecialKey(script[next].key);
+			}
+			else {
+				applyKeypress((unsigned char)script[next].key);
+			}
+		}
+		step();
+		gameTick++;
+
+		if (game_over_flag == 1) {
+			games++;
+			totalScore += score;
+			bestScore = max(bestScore, score);
+			chrono::steady_clock::time_point r0 = chrono::steady_clock::now();
+			resetGame();
+			resetSeconds += chrono::duration<double>(
+				chrono::steady_clock::now() - r0).count();
+			gameTick = 0;
+			next = 0;
+		}
+	}
+	chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+	double seconds = chrono::duration<double>(t1 - t0).count();
+	double tickSeconds = seconds - resetSeconds;
+
+	printf("{\n");
+	printf("  \"ticks\": %lld,\n", ticks);
+	printf("  \"seconds\": %.4f,\n", seconds);
+	printf("  \"reset_seconds\": %.4f,\n", resetSeconds);
+	printf("  \"ticks_per_second\": %.0f,\n",
+		   tickSeconds > 0 ? ticks / tickSeconds : 0.0);
+	printf("  \"games_finished\": %d,\n", games);
+	printf("  \"total_score\": %lld,\n", totalScore);
+	printf("  \"best_score\": %d\n", bestScore);
+	printf("}\n");
+
+	delete _terrain;
+	return 0;
+}
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include "imageloader.h"
+#include "terrain.h"
+#include "vec3farray.h"
+
+using namespace std;
+
+Terrain::Terrain(int w2, int l2) {
+	w = w2;
+	l = l2;
+	
+	hs = new float*[l];
+	for(int i = 0; i < l; i++) {
+		hs[i] = new float[w];
+	}
+	
+	normals = new Vec3f*[l];
+	for(int i = 0; i < l; i++) {
+		normals[i] = new Vec3f[w];
+	}
+	
+	computedNormals = false;
+}
+
+Terrain::~Terrain() {
+	for(int i = 0; i < l; i++) {
+		delete[] hs[i];
+	}
+	delete[] hs;
+	
+	for(int i = 0; i < l; i++) {
+		delete[] normals[i];
+	}
+	delete[] normals;
+}
+
+void Terrain::computeNormals() {
+	if (computedNormals) {
+		return;
+	}
+	
+	//Compute the rough version of the normals
+	Vec3f** normals2 = new Vec3f*[l];
+	for(int i = 0; i < l; i++) {
+		normals2[i] = new Vec3f[w];
+	}
+	
+	//The edges from each point to its four neighbours, a row at a
+	//time.  Off the edge of the terrain, they are flat, and the
+	//triangles they make are left out below.
+	Vec3fArray out(w), in(w), left(w), right(w);
+	//The normals of the four triangles around each point
+	Vec3fArray outLeft(w), leftIn(w), inRight(w), rightOut(w);
+	for(int z = 0; z < l; z++) {
+		const float* row = hs[z];
+		const float* prev = hs[z > 0 ? z - 1 : z];
+		const float* next = hs[z < l - 1 ? z + 1 : z];
+		for(int x = 0; x < w; x++) {
+			out.set(x, Vec3f(0.0f, prev[x] - row[x], -1.0f));
+			in.set(x, Vec3f(0.0f, next[x] - row[x], 1.0f));
+			left.set(x, Vec3f(-1.0f, row[x > 0 ? x - 1 : x] - row[x], 0.0f));
+			right.set(x, Vec3f(1.0f, row[x < w - 1 ? x + 1 : x] - row[x], 0.0f));
+		}
+		crossVec3f(out, left, outLeft);
+		crossVec3f(left, in, leftIn);
+		crossVec3f(in, right, inRight);
+		crossVec3f(right, out, rightOut);
+		//Only used for lighting, so these needn't be exact
+		normalizeFastVec3f(outLeft, outLeft);
+		normalizeFastVec3f(leftIn, leftIn);
+		normalizeFastVec3f(inRight, inRight);
+		normalizeFastVec3f(rightOut, rightOut);
+		
+		for(int x = 0; x < w; x++) {
+			Vec3f sum(0.0f, 0.0f, 0.0f);
+			if (x > 0 && z > 0) {
+				sum += outLeft.get(x);
+			}
+			if (x > 0 && z < l - 1) {
+				sum += leftIn.get(x);
+			}
+			if (x < w - 1 && z < l - 1) {
+				sum += inRight.get(x);
+			}
+			if (x < w - 1 && z > 0) {
+				sum += rightOut.get(x);
+			}
+			normals2[z][x] = sum;
+		}
+	}
+	
+	//Smooth out the normals
+	const float FALLOUT_RATIO = 0.5f;
+	for(int z = 0; z < l; z++) {
+		for(int x = 0; x < w; x++) {
+			Vec3f sum = normals2[z][x];
+			
+			if (x > 0) {
+				sum += normals2[z][x - 1] * FALLOUT_RATIO;
+			}
+			if (x < w - 1) {
+				sum += normals2[z][x + 1] * FALLOUT_RATIO;
+			}
+			if (z > 0) {
+				sum += normals2[z - 1][x] * FALLOUT_RATIO;
+			}
+			if (z < l - 1) {
+				sum += normals2[z + 1][x] * FALLOUT_RATIO;
+			}
+			
+			if (sum.magnitude() == 0) {
+				sum = Vec3f(0.0f, 1.0f, 0.0f);
+			}
+			normals[z][x] = sum;
+		}
+	}
+	
+	for(int i = 0; i < l; i++) {
+		delete[] normals2[i];
+	}
+	delete[] normals2;
+	
+	computedNormals = true;
+}
+
+Terrain* loadTerrain(const char* filename, float height) {
+	//The heights are read straight out of the mapped file
+	MappedImage image(filename);
+	if (!image.isValid()) {
+		fprintf(stderr, "loadTerrain: %s: %s\n", filename,
+				image.errorMessage());
+		return NULL;
+	}
+	const ImageView &view = image.view();
+	int red = view.redOffset();
+	Terrain* t = new Terrain(view.width, view.height);
+	for(int y = 0; y < view.height; y++) {
+		const unsigned char* row = view.row(y);
+		for(int x = 0; x < view.width; x++) {
+			unsigned char color = row[3 * x + red];
+			float h = height * ((color / 255.0f) - 0.5f);
+			t->setHeight(x, y, h);
+		}
+	}
+	
+	t->computeNormals();
+	return t;
+}
@@ -0,0 +1,66 @@
+#ifndef TERRAIN_H_INCLUDED
+#define TERRAIN_H_INCLUDED
+
+#include "vec3f.h"
+
+//Represents a terrain, by storing a set of heights and normals at 2D locations
+class Terrain {
+	private:
+		int w; //Width
+		int l; //Length
+		float** hs; //Heights
+		Vec3f** normals;
+		bool computedNormals; //Whether normals is up-to-date
+		
+		Terrain(const Terrain &other);
+		Terrain &operator=(const Terrain &other);
+	public:
+		Terrain(int w2, int l2);
+		~Terrain();
+		
+		int width() {
+			return w;
+		}
+		
+		int length() {
+			return l;
+		}
+		
+		//Sets the height at (x, z) to y
+		void setHeight(int x, int z, float y) {
+			hs[z][x] = y;
+			computedNormals = false;
+		}
+		
+		//Returns the height at (x, z)
+		float getHeight(int x, int z) {
+			return hs[z][x];
+		}
+		
+		//Computes the normals, if they haven't been computed yet
+		void computeNormals();
+		
+		//Returns the normal at (x, z)
+		Vec3f getNormal(int x, int z) {
+			if (!computedNormals) {
+				computeNormals();
+			}
+			return normals[z][x];
+		}
+};
+
+//Loads a terrain from a heightmap.  The heights of the terrain range from
+//-height / 2 to height / 2.  Returns NULL, after printing why, if the
+//heightmap can't be read.
+Terrain* loadTerrain(const char* filename, float height);
+
+
+
+
+
+
+
+
+
+
+#endif
@@ -0,0 +1,517 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "parallel.h"
+#include "texcache.h"
+
+using namespace std;
+
+namespace {
+	//Header fields, counted in 32 bit words from the start of the header
+	//(after "DDS ")
+	const int DDS_SIZE = 0;
+	const int DDS_FLAGS = 1;
+	const int DDS_HEIGHT = 2;
+	const int DDS_WIDTH = 3;
+	const int DDS_LINEAR_SIZE = 4;
+	const int DDS_MIPMAP_COUNT = 6;
+	const int DDS_STAMP = 7; //Our use of the reserved words
+	const int DDS_PIXEL_FORMAT = 18;
+	const int DDS_CAPS = 26;
+	const int DDS_HEADER_WORDS = 31;
+	const size_t DDS_DATA_OFFSET = 4 + 4 * DDS_HEADER_WORDS;
+
+	//Marks caches in the layout this file writes; change it if the layout
+	//or the encoder changes, so that old caches are rebuilt
+	const uint32_t STAMP_TAG = 0x31435253; //"SRC1"
+
+	uint32_t fourCC(const char* s) {
+		return (unsigned char)s[0] | (unsigned char)s[1] << 8 |
+			(unsigned char)s[2] << 16 | (uint32_t)(unsigned char)s[3] << 24;
+	}
+
+	uint32_t getWord(const unsigned char* header, int i) {
+		const unsigned char* p = header + 4 * i;
+		return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+	}
+
+	void putWord(unsigned char* header, int i, uint32_t value) {
+		unsigned char* p = header + 4 * i;
+		p[0] = (unsigned char)value;
+		p[1] = (unsigned char)(value >> 8);
+		p[2] = (unsigned char)(value >> 16);
+		p[3] = (unsigned char)(value >> 24);
+	}
+
+	size_t levelSize(TextureFormat format, int width, int height) {
+		if (isBlockFormat(format)) {
+			return (size_t)((width + 3) / 4) * ((height + 3) / 4) *
+				blockBytes(format);
+		}
+		return 4 * (size_t)width * height;
+	}
+
+	//Works out the sizes and offsets of the levels of a width x height
+	//texture, down to 1 x 1
+	vector<MipLevel> mipChain(TextureFormat format, int width, int height,
+							  int count) {
+		vector<MipLevel> levels;
+		size_t offset = DDS_DATA_OFFSET;
+		for(int i = 0; i < count; i++) {
+			MipLevel level;
+			level.width = width;
+			level.height = height;
+			level.offset = offset;
+			level.size = levelSize(format, width, height);
+			levels.push_back(level);
+			offset += level.size;
+			width = max(1, width / 2);
+			height = max(1, height / 2);
+		}
+		return levels;
+	}
+
+	int mipCount(int width, int height) {
+		int count = 1;
+		while (width > 1 || height > 1) {
+			width = max(1, width / 2);
+			height = max(1, height / 2);
+			count++;
+		}
+		return count;
+	}
+
+	//Halves an RGBA image in each direction (unless it is 1 pixel across
+	//already), averaging each 2x2 square
+	Image halve(const Image &in) {
+		Image out(max(1, in.width / 2), max(1, in.height / 2), 4);
+		parallelFor(0, out.height, 64, [&](size_t begin, size_t end) {
+			for(int y = (int)begin; y < (int)end; y++) {
+				const unsigned char* row0 = in.row(min(2 * y, in.height - 1));
+				const unsigned char* row1 = in.row(min(2 * y + 1, in.height - 1));
+				unsigned char* o = out.row(y);
+				for(int x = 0; x < out.width; x++) {
+					int x0 = 4 * min(2 * x, in.width - 1);
+					int x1 = 4 * min(2 * x + 1, in.width - 1);
+					for(int c = 0; c < 4; c++) {
+						o[4 * x + c] = (unsigned char)((row0[x0 + c] + row0[x1 + c] +
+														row1[x0 + c] + row1[x1 + c] + 2) / 4);
+					}
+				}
+			}
+		});
+		return out;
+	}
+
+	int to565(const float* color) {
+		int r = (int)(color[0] * 31 / 255 + 0.5f);
+		int g = (int)(color[1] * 63 / 255 + 0.5f);
+		int b = (int)(color[2] * 31 / 255 + 0.5f);
+		return max(0, min(31, r)) << 11 | max(0, min(63, g)) << 5 |
+			max(0, min(31, b));
+	}
+
+	void from565(int c, int* rgb) {
+		int r = (c >> 11) & 31;
+		int g = (c >> 5) & 63;
+		int b = c & 31;
+		rgb[0] = r << 3 | r >> 2;
+		rgb[1] = g << 2 | g >> 4;
+		rgb[2] = b << 3 | b >> 2;
+	}
+
+	//Picks the nearest of the 4 colors between endpoints c0 and c1 for each
+	//pixel.  Writes the block to out and returns its squared error.
+	int fitColors(const unsigned char* rgba, int c0, int c1,
+				  unsigned char* out) {
+		if (c0 < c1) {
+			swap(c0, c1);
+		}
+		int palette[4][3];
+		from565(c0, palette[0]);
+		from565(c1, palette[1]);
+		for(int c = 0; c < 3; c++) {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+
+		uint32_t indices = 0;
+		int error = 0;
+		for(int i = 0; i < 16; i++) {
+			const unsigned char* p = rgba + 4 * i;
+			int best = 0;
+			int bestError = 1 << 30;
+			//With equal endpoints every index gives the same color, and
+			//index 0 is the one that means it in 3 color mode as well
+			for(int k = 0; k < (c0 == c1 ? 1 : 4); k++) {
+				int dr = p[0] - palette[k][0];
+				int dg = p[1] - palette[k][1];
+				int db = p[2] - palette[k][2];
+				int e = dr * dr + dg * dg + db * db;
+				if (e < bestError) {
+					best = k;
+					bestError = e;
+				}
+			}
+			indices |= (uint32_t)best << (2 * i);
+			error += bestError;
+		}
+		out[0] = (unsigned char)c0;
+		out[1] = (unsigned char)(c0 >> 8);
+		out[2] = (unsigned char)c1;
+		out[3] = (unsigned char)(c1 >> 8);
+		for(int i = 0; i < 4; i++) {
+			out[4 + i] = (unsigned char)(indices >> (8 * i));
+		}
+		return error;
+	}
+
+	//Compresses the colors of a block.  The endpoints are the extremes of
+	//the colors along their principal axis, then refined once by least
+	//squares for the indices they give.
+	void encodeColors(const unsigned char* rgba, unsigned char* out) {
+		float mean[3] = {0, 0, 0};
+		for(int i = 0; i < 16; i++) {
+			for(int c = 0; c < 3; c++) {
+				mean[c] += rgba[4 * i + c] / 16.0f;
+			}
+		}
+		float cov[6] = {0, 0, 0, 0, 0, 0}; //rr, rg, rb, gg, gb, bb
+		for(int i = 0; i < 16; i++) {
+			float r = rgba[4 * i] - mean[0];
+			float g = rgba[4 * i + 1] - mean[1];
+			float b = rgba[4 * i + 2] - mean[2];
+			cov[0] += r * r;
+			cov[1] += r * g;
+			cov[2] += r * b;
+			cov[3] += g * g;
+			cov[4] += g * b;
+			cov[5] += b * b;
+		}
+
+		//Power iteration for the principal axis
+		float axis[3] = {1, 1, 1};
+		for(int k = 0; k < 8; k++) {
+			float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+			float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+			float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+			float length = sqrtf(x * x + y * y + z * z);
+			if (length < 1e-6f) {
+				break;
+			}
+			axis[0] = x / length;
+			axis[1] = y / length;
+			axis[2] = z / length;
+		}
+
+		float lo = 0;
+		float hi = 0;
+		for(int i = 0; i < 16; i++) {
+			float t = 0;
+			for(int c = 0; c < 3; c++) {
+				t += (rgba[4 * i + c] - mean[c]) * axis[c];
+			}
+			lo = min(lo, t);
+			hi = max(hi, t);
+		}
+		float a[3], b[3];
+		for(int c = 0; c < 3; c++) {
+			a[c] = mean[c] + hi * axis[c];
+			b[c] = mean[c] + lo * axis[c];
+		}
+		int error = fitColors(rgba, to565(a), to565(b), out);
+		if (error == 0) {
+			return;
+		}
+
+		//Least squares endpoints for the weights the indices give them
+		static const float WEIGHTS[4] = {1, 0, 2.0f / 3, 1.0f / 3};
+		uint32_t indices = out[4] | out[5] << 8 | out[6] << 16 |
+			(uint32_t)out[7] << 24;
+		float aa = 0, ab = 0, bb = 0;
+		float ax[3] = {0, 0, 0};
+		float bx[3] = {0, 0, 0};
+		for(int i = 0; i < 16; i++) {
+			float w = WEIGHTS[(indices >> (2 * i)) & 3];
+			aa += w * w;
+			ab += w * (1 - w);
+			bb += (1 - w) * (1 - w);
+			for(int c = 0; c < 3; c++) {
+				ax[c] += w * rgba[4 * i + c];
+				bx[c] += (1 - w) * rgba[4 * i + c];
+			}
+		}
+		float det = aa * bb - ab * ab;
+		if (fabsf(det) < 1e-6f) {
+			return;
+		}
+		for(int c = 0; c < 3; c++) {
+			a[c] = (bb * ax[c] - ab * bx[c]) / det;
+			b[c] = (aa * bx[c] - ab * ax[c]) / det;
+		}
+		unsigned char refined[8];
+		if (fitColors(rgba, to565(a), to565(b), refined) < error) {
+			memcpy(out, refined, 8);
+		}
+	}
+
+	//Compresses the alpha of a block into BC3's 8 byte alpha block
+	void encodeAlpha(const unsigned char* rgba, unsigned char* out) {
+		int lo = 255;
+		int hi = 0;
+		for(int i = 0; i < 16; i++) {
+			lo = min(lo, (int)rgba[4 * i + 3]);
+			hi = max(hi, (int)rgba[4 * i + 3]);
+		}
+		int palette[8];
+		palette[0] = hi;
+		palette[1] = lo;
+		for(int i = 1; i < 7; i++) {
+			palette[i + 1] = ((7 - i) * hi + i * lo) / 7;
+		}
+
+		uint64_t indices = 0;
+		for(int i = 0; i < 16 && hi > lo; i++) {
+			int a = rgba[4 * i + 3];
+			int best = 0;
+			for(int k = 1; k < 8; k++) {
+				if (abs(a - palette[k]) < abs(a - palette[best])) {
+					best = k;
+				}
+			}
+			indices |= (uint64_t)best << (3 * i);
+		}
+		out[0] = (unsigned char)hi;
+		out[1] = (unsigned char)lo;
+		for(int i = 0; i < 6; i++) {
+			out[2 + i] = (unsigned char)(indices >> (8 * i));
+		}
+	}
+
+	//Writes a level of an RGBA image in format
+	void encodeLevel(const Image &rgba, TextureFormat format,
+					 unsigned char* out) {
+		int width = rgba.width;
+		int height = rgba.height;
+		if (!isBlockFormat(format)) {
+			for(int y = 0; y < height; y++) {
+				memcpy(out + 4 * (size_t)width * y, rgba.row(y), 4 * width);
+			}
+			return;
+		}
+
+		int blocksWide = (width + 3) / 4;
+		int blocksHigh = (height + 3) / 4;
+		size_t size = blockBytes(format);
+		parallelFor(0, blocksHigh, 16, [&](size_t begin, size_t end) {
+			unsigned char block[64];
+			for(int by = (int)begin; by < (int)end; by++) {
+				for(int bx = 0; bx < blocksWide; bx++) {
+					//Blocks past the edge repeat the last row and column
+					for(int i = 0; i < 16; i++) {
+						int x = min(4 * bx + (i & 3), width - 1);
+						int y = min(4 * by + (i >> 2), height - 1);
+						memcpy(block + 4 * i, rgba.row(y) + 4 * x, 4);
+					}
+					unsigned char* o = out + size * ((size_t)blocksWide * by + bx);
+					if (format == TEXTURE_BC1) {
+						encodeBC1Block(block, o);
+					}
+					else {
+						encodeBC3Block(block, o);
+					}
+				}
+			}
+		});
+	}
+}
+
+void encodeBC1Block(const unsigned char* rgba, unsigned char* out) {
+	encodeColors(rgba, out);
+}
+
+void encodeBC3Block(const unsigned char* rgba, unsigned char* out) {
+	encodeAlpha(rgba, out);
+	encodeColors(rgba, out + 8);
+}
+
+bool stampFile(const char* filename, CacheStamp &stamp) {
+	struct stat info;
+	if (stat(filename, &info) != 0) {
+		return false;
+	}
+	stamp.size = (uint64_t)info.st_size;
+#ifdef __APPLE__
+	stamp.seconds = info.st_mtimespec.tv_sec;
+	stamp.nanoseconds = info.st_mtimespec.tv_nsec;
+#else
+	stamp.seconds = info.st_mtim.tv_sec;
+	stamp.nanoseconds = info.st_mtim.tv_nsec;
+#endif
+	return true;
+}
+
+string cachePathFor(const char* filename) {
+	return string(filename) + ".dds";
+}
+
+void buildTextureCache(const Image &image, TextureFormat format,
+					   const CacheStamp &stamp,
+					   vector<unsigned char> &out) {
+	int count = mipCount(image.width, image.height);
+	vector<MipLevel> levels = mipChain(format, image.width, image.height,
+									   count);
+	out.assign(levels.back().offset + levels.back().size, 0);
+
+	unsigned char* header = &out[4];
+	memcpy(&out[0], "DDS ", 4);
+	putWord(header, DDS_SIZE, 4 * DDS_HEADER_WORDS);
+	//Caps, height, width, pixel format and mipmap count, then linear size
+	//or pitch
+	putWord(header, DDS_FLAGS, 0x2100F | (isBlockFormat(format) ? 0x80000 : 0x8));
+	putWord(header, DDS_HEIGHT, image.height);
+	putWord(header, DDS_WIDTH, image.width);
+	putWord(header, DDS_LINEAR_SIZE, isBlockFormat(format) ?
+			(uint32_t)levels[0].size : 4 * image.width);
+	putWord(header, DDS_MIPMAP_COUNT, count);
+	putWord(header, DDS_STAMP, STAMP_TAG);
+	putWord(header, DDS_STAMP + 1, (uint32_t)stamp.size);
+	putWord(header, DDS_STAMP + 2, (uint32_t)(stamp.size >> 32));
+	putWord(header, DDS_STAMP + 3, (uint32_t)stamp.seconds);
+	putWord(header, DDS_STAMP + 4, (uint32_t)((uint64_t)stamp.seconds >> 32));
+	putWord(header, DDS_STAMP + 5, (uint32_t)stamp.nanoseconds);
+
+	putWord(header, DDS_PIXEL_FORMAT, 32);
+	if (isBlockFormat(format)) {
+		putWord(header, DDS_PIXEL_FORMAT + 1, 0x4); //Four CC
+		putWord(header, DDS_PIXEL_FORMAT + 2,
+				fourCC(format == TEXTURE_BC1 ? "DXT1" : "DXT5"));
+	}
+	else {
+		putWord(header, DDS_PIXEL_FORMAT + 1, 0x41); //RGB with alpha
+		putWord(header, DDS_PIXEL_FORMAT + 3, 32);
+		putWord(header, DDS_PIXEL_FORMAT + 4, 0x000000FF);
+		putWord(header, DDS_PIXEL_FORMAT + 5, 0x0000FF00);
+		putWord(header, DDS_PIXEL_FORMAT + 6, 0x00FF0000);
+		putWord(header, DDS_PIXEL_FORMAT + 7, 0xFF000000);
+	}
+	putWord(header, DDS_CAPS, 0x401008); //Complex, texture, mipmap
+
+	Image rgba(image.width, image.height, 4);
+	for(int y = 0; y < image.height; y++) {
+		const unsigned char* in = image.row(y);
+		unsigned char* o = rgba.row(y);
+		for(int x = 0; x < image.width; x++) {
+			memcpy(o + 4 * x, in + 3 * x, 3);
+			o[4 * x + 3] = 255;
+		}
+	}
+	for(int i = 0; i < count; i++) {
+		encodeLevel(rgba, format, &out[levels[i].offset]);
+		if (i + 1 < count) {
+			rgba = halve(rgba);
+		}
+	}
+}
+
+CachedTexture::CachedTexture() : file(NULL), bytes(NULL) {
+
+}
+
+CachedTexture::~CachedTexture() {
+	delete file;
+}
+
+bool CachedTexture::parse(size_t size, const CacheStamp &stamp,
+						  TextureFormat format) {
+	if (size < DDS_DATA_OFFSET || memcmp(bytes, "DDS ", 4) != 0) {
+		return false;
+	}
+	const unsigned char* header = bytes + 4;
+	if (getWord(header, DDS_SIZE) != 4 * DDS_HEADER_WORDS ||
+		getWord(header, DDS_STAMP) != STAMP_TAG ||
+		getWord(header, DDS_STAMP + 1) != (uint32_t)stamp.size ||
+		getWord(header, DDS_STAMP + 2) != (uint32_t)(stamp.size >> 32) ||
+		getWord(header, DDS_STAMP + 3) != (uint32_t)stamp.seconds ||
+		getWord(header, DDS_STAMP + 4) != (uint32_t)((uint64_t)stamp.seconds >> 32) ||
+		getWord(header, DDS_STAMP + 5) != (uint32_t)stamp.nanoseconds) {
+		return false;
+	}
+
+	bool block = (getWord(header, DDS_PIXEL_FORMAT + 1) & 0x4) != 0;
+	uint32_t code = getWord(header, DDS_PIXEL_FORMAT + 2);
+	if (block != isBlockFormat(format) ||
+		(block && code != fourCC(format == TEXTURE_BC1 ? "DXT1" : "DXT5"))) {
+		return false;
+	}
+
+	int width = (int)getWord(header, DDS_WIDTH);
+	int height = (int)getWord(header, DDS_HEIGHT);
+	int count = (int)getWord(header, DDS_MIPMAP_COUNT);
+	if (width <= 0 || height <= 0 || count != mipCount(width, height)) {
+		return false;
+	}
+	levels = mipChain(format, width, height, count);
+	if (levels.back().offset + levels.back().size > size) {
+		return false;
+	}
+	pixelFormat = format;
+	return true;
+}
+
+CachedTexture* CachedTexture::open(const char* path, const CacheStamp &stamp,
+								   TextureFormat format) {
+	CachedTexture* texture = new CachedTexture();
+	texture->file = new MappedFile(path);
+	texture->bytes = texture->file->data();
+	if (!texture->file->isOpen() ||
+		!texture->parse(texture->file->size(), stamp, format)) {
+		delete texture;
+		return NULL;
+	}
+	return texture;
+}
+
+CachedTexture* CachedTexture::load(const char* filename, TextureFormat format) {
+	CacheStamp stamp;
+	if (!stampFile(filename, stamp)) {
+		fprintf(stderr, "%s: could not open file\n", filename);
+		return NULL;
+	}
+	string path = cachePathFor(filename);
+	CachedTexture* texture = open(path.c_str(), stamp, format);
+	if (texture != NULL) {
+		return texture;
+	}
+
+	//Missing or out of date, so build it from the image
+	Image image = loadBMP(filename);
+	if (image.empty()) {
+		return NULL;
+	}
+	texture = new CachedTexture();
+	buildTextureCache(image, format, stamp, texture->buffer);
+	texture->bytes = &texture->buffer[0];
+	texture->parse(texture->buffer.size(), stamp, format);
+
+	//Written under another name first, so that a half written cache is
+	//never mistaken for a good one
+	string temporary = path + ".tmp";
+	FILE* file = fopen(temporary.c_str(), "wb");
+	bool written = file != NULL &&
+		fwrite(&texture->buffer[0], 1, texture->buffer.size(), file) ==
+		texture->buffer.size();
+	if (file != NULL) {
+		written = fclose(file) == 0 && written;
+	}
+	if (!written || rename(temporary.c_str(), path.c_str()) != 0) {
+		fprintf(stderr, "%s: could not write texture cache\n", path.c_str());
+		remove(temporary.c_str());
+	}
+	return texture;
+}
+
+size_t CachedTexture::dataSize() const {
+	return levels.back().offset + levels.back().size - levels[0].offset;
+}
@@ -0,0 +1,118 @@
+#ifndef TEXCACHE_H_INCLUDED
+#define TEXCACHE_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "imageloader.h"
+
+//How the pixels of a cached texture are stored
+enum TextureFormat {
+	TEXTURE_BC1, //4 bits per pixel, opaque (DXT1)
+	TEXTURE_BC3, //8 bits per pixel, with alpha (DXT5)
+	TEXTURE_RGBA8 //Uncompressed, for OpenGLs without S3TC
+};
+
+//Returns whether the format stores 4x4 blocks rather than single pixels
+inline bool isBlockFormat(TextureFormat format) {
+	return format != TEXTURE_RGBA8;
+}
+
+//Returns the bytes taken by one block (or, for RGBA8, one pixel)
+inline size_t blockBytes(TextureFormat format) {
+	return format == TEXTURE_BC1 ? 8 : format == TEXTURE_BC3 ? 16 : 4;
+}
+
+//Compresses a 4x4 block of RGBA pixels (64 bytes, a row of 4 at a time)
+//into 8 bytes of BC1, ignoring alpha
+void encodeBC1Block(const unsigned char* rgba, unsigned char* out);
+
+//Compresses a 4x4 block of RGBA pixels into 16 bytes of BC3
+void encodeBC3Block(const unsigned char* rgba, unsigned char* out);
+
+//One level of a texture's mip chain
+struct MipLevel {
+	int width;
+	int height;
+	size_t offset; //From the start of the cache file
+	size_t size;
+};
+
+//The size and modification time of the image file a cache was made from,
+//which are compared to decide whether the cache is out of date
+struct CacheStamp {
+	uint64_t size;
+	int64_t seconds;
+	int64_t nanoseconds;
+};
+
+//Fills in stamp for filename.  Returns false if the file can't be found.
+bool stampFile(const char* filename, CacheStamp &stamp);
+
+//Returns where the cache for an image file goes: next to it, with ".dds"
+//on the end
+std::string cachePathFor(const char* filename);
+
+//Builds a DDS file holding image's full mip chain in format, stamped with
+//stamp.  Rows are stored bottom up, the way OpenGL takes them (which is
+//upside down to other DDS readers).
+void buildTextureCache(const Image &image, TextureFormat format,
+					   const CacheStamp &stamp,
+					   std::vector<unsigned char> &out);
+
+//A texture cache file, mapped into memory where it was read from disk
+class CachedTexture {
+	private:
+		MappedFile* file;
+		std::vector<unsigned char> buffer; //The contents, if not mapped
+		const unsigned char* bytes;
+		TextureFormat pixelFormat;
+		std::vector<MipLevel> levels;
+
+		CachedTexture();
+		CachedTexture(const CachedTexture &other);
+		CachedTexture &operator=(const CachedTexture &other);
+		bool parse(size_t size, const CacheStamp &stamp, TextureFormat format);
+	public:
+		~CachedTexture();
+
+		//Maps the cache at path, if it is a cache of the file with stamp in
+		//format.  Returns NULL otherwise.
+		static CachedTexture* open(const char* path, const CacheStamp &stamp,
+								   TextureFormat format);
+
+		//Returns the cache for an image file in format, reading the cache
+		//file if it is up to date and building (and saving) it otherwise.
+		//Returns NULL, after printing why, if the image can't be read.
+		static CachedTexture* load(const char* filename, TextureFormat format);
+
+		TextureFormat format() const {
+			return pixelFormat;
+		}
+
+		int levelCount() const {
+			return (int)levels.size();
+		}
+
+		const MipLevel &level(int i) const {
+			return levels[i];
+		}
+
+		const unsigned char* levelData(int i) const {
+			return bytes + levels[i].offset;
+		}
+
+		//Returns the bytes of all the levels together
+		size_t dataSize() const;
+};
+
+
+
+
+
+
+
+
+
+#endif
@@ -0,0 +1,492 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "texmanager.h"
+
+using namespace std;
+
+namespace {
+	//Returns whether the context is OpenGL 2.1 or later, which is when pixel
+	//buffer objects became part of the core
+	bool hasPixelBuffers() {
+		const char* version = (const char*)glGetString(GL_VERSION);
+		int major = 0;
+		int minor = 0;
+		if (version == NULL || sscanf(version, "%d.%d", &major, &minor) != 2) {
+			return false;
+		}
+		return major > 2 || (major == 2 && minor >= 1);
+	}
+
+	//Returns whether the context can take BC1 and BC3 (DXT1 and DXT5)
+	//textures
+	bool hasS3TC() {
+		const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+		return extensions != NULL &&
+			strstr(extensions, "GL_EXT_texture_compression_s3tc") != NULL;
+	}
+
+	GLenum glFormat(TextureFormat format) {
+		switch(format) {
+			case TEXTURE_BC1:
+				return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+			case TEXTURE_BC3:
+				return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+			default:
+				return GL_RGBA8;
+		}
+	}
+
+	//Makes a texture with room for every level of source, to be uploaded
+	//into later
+	GLuint makeTexture(const CachedTexture &source) {
+		GLuint id;
+		glGenTextures(1, &id);
+		glBindTexture(GL_TEXTURE_2D, id);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+						GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+						source.levelCount() - 1);
+		for(int i = 0; i < source.levelCount(); i++) {
+			const MipLevel &level = source.level(i);
+			if (isBlockFormat(source.format())) {
+				glCompressedTexImage2D(GL_TEXTURE_2D, i, glFormat(source.format()),
+									   level.width, level.height, 0,
+									   (GLsizei)level.size, NULL);
+			}
+			else {
+				glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA8, level.width,
+							 level.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			}
+		}
+		return id;
+	}
+	
+	//Returns the name a file is known by, so that different paths to the
+	//same file share a texture
+	std::string canonicalPath(const char* filename) {
+		char* path = realpath(filename, NULL);
+		if (path == NULL) {
+			return filename;
+		}
+		std::string result = path;
+		free(path);
+		return result;
+	}
+}
+
+uint64_t hashTexture(const CachedTexture* texture) {
+	const uint64_t prime = 1099511628211ULL;
+	uint64_t hash = 14695981039346656037ULL;
+	hash = (hash ^ (uint64_t)texture->level(0).width) * prime;
+	hash = (hash ^ (uint64_t)texture->level(0).height) * prime;
+	
+	//A word at a time, which is plenty for telling images apart
+	size_t size = texture->level(0).size;
+	const unsigned char* p = texture->levelData(0);
+	size_t i = 0;
+	for(; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, p + i, 8);
+		hash = (hash ^ word) * prime;
+	}
+	for(; i < size; i++) {
+		hash = (hash ^ (unsigned char)p[i]) * prime;
+	}
+	return hash;
+}
+
+uint64_t checkTexture(const CachedTexture* texture) {
+	//Multiplies and rotates each word in, with different constants from
+	//FNV-1a, so that images colliding in one hash won't in the other
+	const uint64_t k1 = 0x9E3779B97F4A7C15ULL;
+	const uint64_t k2 = 0xC2B2AE3D27D4EB4FULL;
+	size_t size = texture->level(0).size;
+	uint64_t hash = k2 ^ ((uint64_t)texture->level(0).width << 32) ^
+		(uint64_t)texture->level(0).height ^ (size * k1);
+	const unsigned char* p = texture->levelData(0);
+	size_t i = 0;
+	for(; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, p + i, 8);
+		hash ^= word * k1;
+		hash = ((hash << 31) | (hash >> 33)) * k2;
+	}
+	for(; i < size; i++) {
+		hash ^= (unsigned char)p[i] * k1;
+		hash = ((hash << 31) | (hash >> 33)) * k2;
+	}
+	hash ^= hash >> 29;
+	return hash;
+}
+
+TextureManager::TextureManager(size_t budget, size_t bytesPerFrame) :
+	gpuBudget(budget), frameBudget(bytesPerFrame), frame(0),
+	pixelBuffer(0), outstanding(0), stopping(false) {
+	memset(&counts, 0, sizeof(counts));
+	cacheFormat = hasS3TC() ? TEXTURE_BC1 : TEXTURE_RGBA8;
+	
+	GLint bound;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+	const unsigned char grey[16] = {128, 128, 128, 255, 96, 96, 96, 255,
+									96, 96, 96, 255, 128, 128, 128, 255};
+	glGenTextures(1, &placeholder);
+	glBindTexture(GL_TEXTURE_2D, placeholder);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 2, 2, 0, GL_RGBA,
+				 GL_UNSIGNED_BYTE, grey);
+	glBindTexture(GL_TEXTURE_2D, bound);
+
+#ifdef GL_PIXEL_UNPACK_BUFFER
+	if (hasPixelBuffers()) {
+		glGenBuffers(1, &pixelBuffer);
+	}
+#endif
+	worker = thread(&TextureManager::workerLoop, this);
+}
+
+TextureManager::~TextureManager() {
+	{
+		lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	worker.join();
+
+	for(size_t i = 0; i < decoded.size(); i++) {
+		delete decoded[i].texture;
+	}
+	for(size_t i = 0; i < slots.size(); i++) {
+		delete slots[i].source;
+		if (slots[i].staging != 0) {
+			glDeleteTextures(1, &slots[i].staging);
+		}
+		if (slots[i].id != 0) {
+			glDeleteTextures(1, &slots[i].id);
+		}
+	}
+	glDeleteTextures(1, &placeholder);
+#ifdef GL_PIXEL_UNPACK_BUFFER
+	if (pixelBuffer != 0) {
+		glDeleteBuffers(1, &pixelBuffer);
+	}
+#endif
+}
+
+void TextureManager::workerLoop() {
+	unique_lock<std::mutex> lock(mutex);
+	for(;;) {
+		wake.wait(lock, [&] { return stopping || !requests.empty(); });
+		if (stopping) {
+			return;
+		}
+		Request request = requests.front();
+		requests.pop_front();
+		lock.unlock();
+
+		Decoded result;
+		result.handle = request.handle;
+		result.texture = CachedTexture::load(request.filename.c_str(),
+											 cacheFormat);
+		result.hash = result.texture != NULL ? hashTexture(result.texture) : 0;
+		result.check = result.texture != NULL ? checkTexture(result.texture) : 0;
+
+		lock.lock();
+		decoded.push_back(result);
+	}
+}
+
+//Asks the worker to read an entry's file
+void TextureManager::request(int handle) {
+	Request request;
+	request.handle = handle;
+	request.filename = entries[handle].path;
+	entries[handle].loading = true;
+	{
+		lock_guard<std::mutex> lock(mutex);
+		requests.push_back(request);
+		outstanding++;
+	}
+	wake.notify_one();
+}
+
+int TextureManager::acquire(const char* filename) {
+	string path = canonicalPath(filename);
+	map<string, int>::iterator found = byPath.find(path);
+	int handle;
+	if (found != byPath.end()) {
+		handle = found->second;
+	}
+	else {
+		Entry entry;
+		entry.path = path;
+		entry.refs = 0;
+		entry.slot = -1;
+		entry.loading = false;
+		handle = (int)entries.size();
+		entries.push_back(entry);
+		byPath[path] = handle;
+	}
+	
+	Entry &entry = entries[handle];
+	entry.refs++;
+	if (entry.slot >= 0 || entry.loading) {
+		counts.hits++;
+	}
+	else {
+		//Not loaded yet, evicted, or failed last time
+		counts.misses++;
+		request(handle);
+	}
+	return handle;
+}
+
+void TextureManager::release(int handle) {
+	if (entries[handle].refs > 0) {
+		entries[handle].refs--;
+	}
+}
+
+GLuint TextureManager::texture(int handle) {
+	int s = entries[handle].slot;
+	if (s < 0 || slots[s].id == 0) {
+		return placeholder;
+	}
+	slots[s].lastUse = frame;
+	return slots[s].id;
+}
+
+bool TextureManager::isLoaded(int handle) const {
+	int s = entries[handle].slot;
+	return s >= 0 && slots[s].id != 0;
+}
+
+//Gives an entry the texture for a newly loaded file, sharing an existing
+//one if it has the same pixels
+void TextureManager::receive(const Decoded &result) {
+	Entry &entry = entries[result.handle];
+	entry.loading = false;
+	if (result.texture == NULL) {
+		//Files that can't be read keep the placeholder
+		return;
+	}
+	
+	typedef multimap<uint64_t, int>::iterator HashIterator;
+	pair<HashIterator, HashIterator> same = byHash.equal_range(result.hash);
+	const MipLevel &level = result.texture->level(0);
+	for(HashIterator i = same.first; i != same.second; i++) {
+		const Slot &candidate = slots[i->second];
+		if (candidate.check != result.check || candidate.width != level.width ||
+			candidate.height != level.height ||
+			candidate.bytes != result.texture->dataSize()) {
+			continue;
+		}
+		
+		//Once uploaded, the pixels are gone, and both hashes have to do
+		const CachedTexture* other = candidate.source;
+		if (other == NULL ||
+			memcmp(other->levelData(0), result.texture->levelData(0),
+				   level.size) == 0) {
+			entry.slot = i->second;
+			counts.shared++;
+			delete result.texture;
+			return;
+		}
+	}
+	
+	Slot slot;
+	slot.id = 0;
+	slot.staging = 0;
+	slot.source = result.texture;
+	slot.level = 0;
+	slot.uploadedRows = 0;
+	slot.hash = result.hash;
+	slot.check = result.check;
+	slot.width = level.width;
+	slot.height = level.height;
+	slot.bytes = result.texture->dataSize();
+	slot.lastUse = frame;
+	slot.used = true;
+	
+	int s = 0;
+	while (s < (int)slots.size() && slots[s].used) {
+		s++;
+	}
+	if (s == (int)slots.size()) {
+		slots.push_back(slot);
+	}
+	else {
+		slots[s] = slot;
+	}
+	entry.slot = s;
+	byHash.insert(make_pair(result.hash, s));
+	uploads.push_back(s);
+	counts.textures++;
+}
+
+//Uploads as many of the remaining rows of the texture's current level as
+//fit in budget bytes (at least one row of blocks), and returns the number
+//of bytes uploaded
+size_t TextureManager::uploadRows(Slot &slot, size_t budget) {
+	const CachedTexture* source = slot.source;
+	TextureFormat format = source->format();
+	if (slot.staging == 0) {
+		slot.staging = makeTexture(*source);
+		counts.gpuBytes += slot.bytes;
+	}
+	else {
+		glBindTexture(GL_TEXTURE_2D, slot.staging);
+	}
+
+	//Block formats go 4 rows of pixels at a time, and levels whose height
+	//isn't a multiple of 4 go in one piece, since older drivers only take
+	//partial blocks at the edge of a level when the upload covers all of it
+	const MipLevel &level = source->level(slot.level);
+	int rowHeight = isBlockFormat(format) ? 4 : 1;
+	int rowCount = (level.height + rowHeight - 1) / rowHeight;
+	size_t rowBytes = level.size / rowCount;
+	int row = slot.uploadedRows / rowHeight;
+	int rows = rowCount - row;
+	if (rowHeight == 1 || level.height % 4 == 0) {
+		rows = (int)min((size_t)rows, max((size_t)1, budget / rowBytes));
+	}
+	size_t bytes = rows * rowBytes;
+	int y = row * rowHeight;
+	int height = min(level.height - y, rows * rowHeight);
+	const unsigned char* pixels = source->levelData(slot.level) + rowBytes * row;
+#ifdef GL_PIXEL_UNPACK_BUFFER
+	if (pixelBuffer != 0) {
+		//Orphan the last frame's storage, so that mapping doesn't wait for
+		//the driver to finish reading it
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+		void* mapped = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+		if (mapped != NULL) {
+			memcpy(mapped, pixels, bytes);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			pixels = NULL; //Read from the start of the buffer
+		}
+		else {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		}
+	}
+#endif
+	if (isBlockFormat(format)) {
+		glCompressedTexSubImage2D(GL_TEXTURE_2D, slot.level, 0, y, level.width,
+								  height, glFormat(format), (GLsizei)bytes,
+								  pixels);
+	}
+	else {
+		glTexSubImage2D(GL_TEXTURE_2D, slot.level, 0, y, level.width, height,
+						GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	}
+#ifdef GL_PIXEL_UNPACK_BUFFER
+	if (pixelBuffer != 0) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+#endif
+	slot.uploadedRows = y + height;
+	if (slot.uploadedRows == level.height) {
+		slot.level++;
+		slot.uploadedRows = 0;
+	}
+	return bytes;
+}
+
+//Deletes the least recently drawn texture that nothing holds.  Returns
+//whether there was one.
+bool TextureManager::evictOne() {
+	vector<bool> held(slots.size(), false);
+	for(size_t i = 0; i < entries.size(); i++) {
+		if (entries[i].slot >= 0 && entries[i].refs > 0) {
+			held[entries[i].slot] = true;
+		}
+	}
+	int victim = -1;
+	for(int s = 0; s < (int)slots.size(); s++) {
+		//Textures still being uploaded are left alone
+		if (slots[s].used && slots[s].id != 0 && !held[s] &&
+			(victim < 0 || slots[s].lastUse < slots[victim].lastUse)) {
+			victim = s;
+		}
+	}
+	if (victim < 0) {
+		return false;
+	}
+	
+	Slot &slot = slots[victim];
+	glDeleteTextures(1, &slot.id);
+	slot.id = 0;
+	slot.used = false;
+	counts.gpuBytes -= slot.bytes;
+	counts.textures--;
+	counts.evictions++;
+	typedef multimap<uint64_t, int>::iterator HashIterator;
+	pair<HashIterator, HashIterator> same = byHash.equal_range(slot.hash);
+	for(HashIterator i = same.first; i != same.second; i++) {
+		if (i->second == victim) {
+			byHash.erase(i);
+			break;
+		}
+	}
+	for(size_t i = 0; i < entries.size(); i++) {
+		if (entries[i].slot == victim) {
+			entries[i].slot = -1;
+		}
+	}
+	return true;
+}
+
+bool TextureManager::update() {
+	frame++;
+	
+	//Pick up whatever the worker has finished
+	deque<Decoded> done;
+	{
+		lock_guard<std::mutex> lock(mutex);
+		done.swap(decoded);
+		outstanding -= (int)done.size();
+	}
+	for(size_t i = 0; i < done.size(); i++) {
+		receive(done[i]);
+	}
+
+	if (!uploads.empty()) {
+		GLint bound;
+		glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		size_t budget = frameBudget;
+		while (budget > 0 && !uploads.empty()) {
+			Slot &slot = slots[uploads.front()];
+			budget -= min(budget, uploadRows(slot, budget));
+			if (slot.level == slot.source->levelCount()) {
+				slot.id = slot.staging;
+				slot.staging = 0;
+				delete slot.source;
+				slot.source = NULL;
+				uploads.pop_front();
+			}
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindTexture(GL_TEXTURE_2D, bound);
+	}
+	
+	while (counts.gpuBytes > gpuBudget && evictOne()) {
+	}
+	return busy();
+}
+
+bool TextureManager::busy() {
+	lock_guard<std::mutex> lock(mutex);
+	return outstanding > 0 || !uploads.empty();
+}
+
+void TextureManager::printStats(FILE* file) const {
+	fprintf(file, "textures: %d hits, %d misses, %d shared, %d evictions, "
+			"%d textures using %.1f of %.1f MB\n", counts.hits, counts.misses,
+			counts.shared, counts.evictions, counts.textures,
+			counts.gpuBytes / 1048576.0, gpuBudget / 1048576.0);
+}
@@ -0,0 +1,176 @@
+#ifndef TEXMANAGER_H_INCLUDED
+#define TEXMANAGER_H_INCLUDED
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __APPLE__
+#include <OpenGL/gl.h>
+#else
+#ifndef GL_GLEXT_PROTOTYPES
+#define GL_GLEXT_PROTOTYPES
+#endif
+#include <GL/gl.h>
+#endif
+#include "texcache.h"
+
+//Owns the program's textures.  Each image file is loaded once, however
+//many times it is acquired, and files with identical pixels share one GL
+//texture.  Textures that nothing holds any more stay cached until the
+//textures' estimated GPU memory goes over a budget, when the least
+//recently drawn ones are deleted.
+//
+//Textures are read on a background thread from their caches (see
+//texcache.h): mipmapped and BC1 compressed where OpenGL has S3TC, and
+//RGBA8 otherwise.  Caches are built from the image files when they are
+//missing or out of date.  update(), called once a frame on the GL thread,
+//uploads the cached levels a few rows at a time (through a pixel buffer
+//object where OpenGL has them), so that no frame uploads much more than a
+//fixed number of bytes.  Until a texture has been uploaded in full, it is
+//drawn with a small grey placeholder.
+//
+//A TextureManager must be created and used on the thread with the GL
+//context, and destroyed while that context is still current.
+class TextureManager {
+	public:
+		struct Stats {
+			int hits; //Acquires of a file that was loaded or loading
+			int misses; //Acquires that had to read the file
+			int shared; //Files whose pixels matched an existing texture
+			int evictions; //Textures deleted to stay within the budget
+			int textures; //GL textures, not counting the placeholder
+			size_t gpuBytes; //Estimated memory used by the textures
+		};
+	private:
+		//A file that has been acquired, which is what a handle refers to
+		struct Entry {
+			std::string path;
+			int refs;
+			int slot; //Index into slots, or -1 if the file isn't loaded
+			bool loading; //Whether the worker has been asked for the file
+		};
+
+		//A GL texture and its upload state
+		struct Slot {
+			GLuint id; //0 until the texture has been uploaded in full
+			GLuint staging; //The texture being uploaded, or 0
+			CachedTexture* source; //Pixels waiting to be uploaded
+			int level; //The level being uploaded
+			int uploadedRows; //Rows of that level uploaded so far
+			uint64_t hash; //Of the pixels, for sharing textures
+			uint64_t check; //A second hash, so that one collision can't share
+			int width; //Of the first level
+			int height;
+			size_t bytes;
+			unsigned lastUse; //The frame the texture was last drawn in
+			bool used; //Whether the slot holds a texture
+		};
+
+		struct Request {
+			int handle;
+			std::string filename;
+		};
+
+		struct Decoded {
+			int handle;
+			CachedTexture* texture; //NULL if the file couldn't be read
+			uint64_t hash;
+			uint64_t check;
+		};
+
+		//Only touched on the GL thread
+		std::vector<Entry> entries;
+		std::map<std::string, int> byPath;
+		std::vector<Slot> slots;
+		std::multimap<uint64_t, int> byHash;
+		std::deque<int> uploads; //Slots with pixels left to upload
+		size_t gpuBudget;
+		size_t frameBudget;
+		unsigned frame;
+		Stats counts;
+		GLuint placeholder;
+		GLuint pixelBuffer; //0 if pixel buffer objects aren't supported
+		TextureFormat cacheFormat; //What the context can take
+
+		//Shared with the worker, and guarded by mutex
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::deque<Request> requests;
+		std::deque<Decoded> decoded;
+		int outstanding; //Loads whose pixels haven't reached the GL thread
+		bool stopping;
+
+		std::thread worker;
+
+		TextureManager(const TextureManager &other);
+		TextureManager &operator=(const TextureManager &other);
+
+		void workerLoop();
+		void request(int handle);
+		void receive(const Decoded &result);
+		size_t uploadRows(Slot &slot, size_t budget);
+		bool evictOne();
+	public:
+		//Keeps unused textures while they take up to about gpuBudget bytes,
+		//and uploads at most about bytesPerFrame bytes of pixels per update()
+		//(but always at least one row)
+		explicit TextureManager(size_t gpuBudget = 64 << 20,
+								size_t bytesPerFrame = 1 << 20);
+		~TextureManager();
+
+		//Returns a handle for the texture in an image file (BMP or raw PPM),
+		//loading it if it isn't loaded or loading already.  Every acquire
+		//should be matched by a release.  The handle stays the same for the
+		//same file, even after release.
+		int acquire(const char* filename);
+
+		//Lets the texture be evicted once nothing else holds it
+		void release(int handle);
+
+		//Returns the texture to bind for the handle right now: the
+		//placeholder until the texture has been uploaded
+		GLuint texture(int handle);
+
+		//Returns whether the texture's own pixels are in place
+		bool isLoaded(int handle) const;
+
+		//Picks up newly loaded textures, uploads pixels within the frame's
+		//budget and evicts textures over the memory budget.  Returns whether
+		//there is still work to do, in which case the caller should draw
+		//another frame soon.
+		bool update();
+
+		//Returns whether any texture is still being read or uploaded
+		bool busy();
+
+		const Stats &stats() const {
+			return counts;
+		}
+
+		//Prints the statistics on one line
+		void printStats(FILE* file) const;
+};
+
+//Returns a 64 bit FNV-1a hash of the size and pixels of a texture's first
+//level
+uint64_t hashTexture(const CachedTexture* texture);
+
+//Returns a second 64 bit hash of the same, made in a different way from
+//hashTexture, for confirming a match without the pixels to compare
+uint64_t checkTexture(const CachedTexture* texture);
+
+
+
+
+
+
+
+
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef TRIPLEBUFFER_H_INCLUDED
+#define TRIPLEBUFFER_H_INCLUDED
+
+#include <atomic>
+
+//Hands the latest of a stream of values from one writer thread to one
+//reader thread without locks.  There are three slots: the writer fills
+//one, the reader reads another, and the third holds the most recently
+//published value.  Publishing and picking up swap a slot with the third,
+//so neither thread ever waits for the other, and the reader skips any
+//values it was too slow to see.
+//
+//Slots are reused rather than rebuilt, so a T that owns memory (a vector,
+//say) keeps its capacity from one value to the next.
+template<class T>
+class TripleBuffer {
+	private:
+		//The middle slot's index, with FRESH set if it holds a value that
+		//the reader has not picked up
+		static const unsigned FRESH = 4;
+		static const unsigned INDEX = 3;
+
+		T slots[3];
+		std::atomic<unsigned> middle;
+		unsigned back; //Only touched by the writer
+		unsigned front; //Only touched by the reader
+
+		TripleBuffer(const TripleBuffer &other);
+		TripleBuffer &operator=(const TripleBuffer &other);
+	public:
+		TripleBuffer() : middle(1), back(0), front(2) {
+
+		}
+
+		//The slot for the writer to fill in next.  It holds whichever value
+		//was published three times ago, or a default constructed T.
+		T &write() {
+			return slots[back];
+		}
+
+		//Makes the slot returned by write() the latest value
+		void publish() {
+			back = middle.exchange(back | FRESH, std::memory_order_acq_rel) &
+				INDEX;
+		}
+
+		//Picks up the latest published value, if there is one the reader
+		//hasn't seen.  Returns whether there was.
+		bool update() {
+			if (!(middle.load(std::memory_order_relaxed) & FRESH)) {
+				return false;
+			}
+			front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+			return true;
+		}
+
+		//The value picked up by the last update(), which stays put until the
+		//next one
+		const T &read() const {
+			return slots[front];
+		}
+};
+
+
+
+
+
+
+
+
+
+
+#endif
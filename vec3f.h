@@ -27,37 +27,271 @@
 #define VEC3F_H_INCLUDED
 
 #include <iostream>
+#include <math.h>
 
+//Vec3f is padded to 16 bytes and uses SSE where the compiler targets it.
+//Define VEC3F_SIMD as 0 to get the plain 12 byte, scalar version.  Define
+//VEC3F_FAST_NORMALIZE to make normalize() the same as normalizeFast().
+#ifndef VEC3F_SIMD
+#if defined(__SSE__) || defined(_M_X64)
+#define VEC3F_SIMD 1
+#else
+#define VEC3F_SIMD 0
+#endif
+#endif
+
+#if VEC3F_SIMD
+#include <xmmintrin.h>
+#endif
+
+//All of Vec3f is inline, so that the compiler can keep vectors in
+//registers through the terrain and physics code that uses them heavily.
+//The SSE versions do each operation in the same order as the scalar ones,
+//so both give the same results.
+#if VEC3F_SIMD
+class alignas(16) Vec3f {
+	private:
+		float v[4]; //The fourth component is padding
+		
+		explicit Vec3f(__m128 m) {
+			_mm_store_ps(v, m);
+		}
+		
+		__m128 load() const {
+			return _mm_load_ps(v);
+		}
+		
+		//Returns x * x' + y * y' + z * z' in the lowest lane
+		static __m128 dot3(__m128 a, __m128 b) {
+			__m128 m = _mm_mul_ps(a, b);
+			__m128 y = _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1));
+			__m128 z = _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 2, 2, 2));
+			return _mm_add_ss(_mm_add_ss(m, y), z);
+		}
+	public:
+		Vec3f() {
+			
+		}
+		
+		Vec3f(float x, float y, float z) {
+			_mm_store_ps(v, _mm_setr_ps(x, y, z, 0.0f));
+		}
+		
+		float &operator[](int index) {
+			return v[index];
+		}
+		
+		float operator[](int index) const {
+			return v[index];
+		}
+		
+		Vec3f operator*(float scale) const {
+			return Vec3f(_mm_mul_ps(load(), _mm_set1_ps(scale)));
+		}
+		
+		Vec3f operator/(float scale) const {
+			return Vec3f(_mm_div_ps(load(), _mm_set1_ps(scale)));
+		}
+		
+		Vec3f operator+(const Vec3f &other) const {
+			return Vec3f(_mm_add_ps(load(), other.load()));
+		}
+		
+		Vec3f operator-(const Vec3f &other) const {
+			return Vec3f(_mm_sub_ps(load(), other.load()));
+		}
+		
+		Vec3f operator-() const {
+			return Vec3f(_mm_sub_ps(_mm_setzero_ps(), load()));
+		}
+		
+		const Vec3f &operator*=(float scale) {
+			_mm_store_ps(v, _mm_mul_ps(load(), _mm_set1_ps(scale)));
+			return *this;
+		}
+		
+		const Vec3f &operator/=(float scale) {
+			_mm_store_ps(v, _mm_div_ps(load(), _mm_set1_ps(scale)));
+			return *this;
+		}
+		
+		const Vec3f &operator+=(const Vec3f &other) {
+			_mm_store_ps(v, _mm_add_ps(load(), other.load()));
+			return *this;
+		}
+		
+		const Vec3f &operator-=(const Vec3f &other) {
+			_mm_store_ps(v, _mm_sub_ps(load(), other.load()));
+			return *this;
+		}
+		
+		float magnitude() const {
+			__m128 m = load();
+			return _mm_cvtss_f32(_mm_sqrt_ss(dot3(m, m)));
+		}
+		
+		float magnitudeSquared() const {
+			__m128 m = load();
+			return _mm_cvtss_f32(dot3(m, m));
+		}
+		
+		Vec3f normalize() const {
+#ifdef VEC3F_FAST_NORMALIZE
+			return normalizeFast();
+#else
+			__m128 m = load();
+			__m128 length = _mm_sqrt_ss(dot3(m, m));
+			return Vec3f(_mm_div_ps(m, _mm_shuffle_ps(length, length, 0)));
+#endif
+		}
+		
+		//Like normalize(), but with an approximate reciprocal square root
+		//and one Newton-Raphson step in place of the square root and
+		//divides.  The result is off by up to a few parts in 10^7, which is
+		//plenty for lighting normals.
+		Vec3f normalizeFast() const {
+			//Working on whole registers, with the squared length in every
+			//lane, saves the shuffles that scalar operations would need
+			__m128 m = load();
+			__m128 s = _mm_mul_ps(m, m);
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_shuffle_ps(s, s, 0x00),
+											 _mm_shuffle_ps(s, s, 0x55)),
+								  _mm_shuffle_ps(s, s, 0xaa));
+			__m128 r = _mm_rsqrt_ps(d);
+			//r * (1.5 - 0.5 * d * r * r)
+			r = _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(1.5f),
+				_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), d), _mm_mul_ps(r, r))));
+			return Vec3f(_mm_mul_ps(m, r));
+		}
+		
+		float dot(const Vec3f &other) const {
+			return _mm_cvtss_f32(dot3(load(), other.load()));
+		}
+		
+		Vec3f cross(const Vec3f &other) const {
+			__m128 a = load();
+			__m128 b = other.load();
+			__m128 a1 = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+			__m128 b1 = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+			__m128 a2 = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 0, 2));
+			__m128 b2 = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 1, 0, 2));
+			return Vec3f(_mm_sub_ps(_mm_mul_ps(a1, b2), _mm_mul_ps(a2, b1)));
+		}
+};
+#else
 class Vec3f {
 	private:
 		float v[3];
 	public:
-		Vec3f();
-		Vec3f(float x, float y, float z);
-		
-		float &operator[](int index);
-		float operator[](int index) const;
-		
-		Vec3f operator*(float scale) const;
-		Vec3f operator/(float scale) const;
-		Vec3f operator+(const Vec3f &other) const;
-		Vec3f operator-(const Vec3f &other) const;
-		Vec3f operator-() const;
-		
-		const Vec3f &operator*=(float scale);
-		const Vec3f &operator/=(float scale);
-		const Vec3f &operator+=(const Vec3f &other);
-		const Vec3f &operator-=(const Vec3f &other);
-		
-		float magnitude() const;
-		float magnitudeSquared() const;
-		Vec3f normalize() const;
-		float dot(const Vec3f &other) const;
-		Vec3f cross(const Vec3f &other) const;
+		Vec3f() {
+			
+		}
+		
+		Vec3f(float x, float y, float z) {
+			v[0] = x;
+			v[1] = y;
+			v[2] = z;
+		}
+		
+		float &operator[](int index) {
+			return v[index];
+		}
+		
+		float operator[](int index) const {
+			return v[index];
+		}
+		
+		Vec3f operator*(float scale) const {
+			return Vec3f(v[0] * scale, v[1] * scale, v[2] * scale);
+		}
+		
+		Vec3f operator/(float scale) const {
+			return Vec3f(v[0] / scale, v[1] / scale, v[2] / scale);
+		}
+		
+		Vec3f operator+(const Vec3f &other) const {
+			return Vec3f(v[0] + other.v[0], v[1] + other.v[1], v[2] + other.v[2]);
+		}
+		
+		Vec3f operator-(const Vec3f &other) const {
+			return Vec3f(v[0] - other.v[0], v[1] - other.v[1], v[2] - other.v[2]);
+		}
+		
+		Vec3f operator-() const {
+			return Vec3f(-v[0], -v[1], -v[2]);
+		}
+		
+		const Vec3f &operator*=(float scale) {
+			v[0] *= scale;
+			v[1] *= scale;
+			v[2] *= scale;
+			return *this;
+		}
+		
+		const Vec3f &operator/=(float scale) {
+			v[0] /= scale;
+			v[1] /= scale;
+			v[2] /= scale;
+			return *this;
+		}
+		
+		const Vec3f &operator+=(const Vec3f &other) {
+			v[0] += other.v[0];
+			v[1] += other.v[1];
+			v[2] += other.v[2];
+			return *this;
+		}
+		
+		const Vec3f &operator-=(const Vec3f &other) {
+			v[0] -= other.v[0];
+			v[1] -= other.v[1];
+			v[2] -= other.v[2];
+			return *this;
+		}
+		
+		float magnitude() const {
+			return sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+		}
+		
+		float magnitudeSquared() const {
+			return v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+		}
+		
+		Vec3f normalize() const {
+#ifdef VEC3F_FAST_NORMALIZE
+			return normalizeFast();
+#else
+			float m = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+			return Vec3f(v[0] / m, v[1] / m, v[2] / m);
+#endif
+		}
+		
+		//Like normalize(), but with one divide instead of three
+		Vec3f normalizeFast() const {
+			float r = 1.0f / sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+			return Vec3f(v[0] * r, v[1] * r, v[2] * r);
+		}
+		
+		float dot(const Vec3f &other) const {
+			return v[0] * other.v[0] + v[1] * other.v[1] + v[2] * other.v[2];
+		}
+		
+		Vec3f cross(const Vec3f &other) const {
+			return Vec3f(v[1] * other.v[2] - v[2] * other.v[1],
+						 v[2] * other.v[0] - v[0] * other.v[2],
+						 v[0] * other.v[1] - v[1] * other.v[0]);
+		}
 };
+#endif
+
+inline Vec3f operator*(float scale, const Vec3f &v) {
+	return v * scale;
+}
 
-Vec3f operator*(float scale, const Vec3f &v);
-std::ostream &operator<<(std::ostream &output, const Vec3f &v);
+inline std::ostream &operator<<(std::ostream &output, const Vec3f &v) {
+	output << '(' << v[0] << ", " << v[1] << ", " << v[2] << ')';
+	return output;
+}
 
 
 
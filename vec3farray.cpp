@@ -0,0 +1,490 @@
+#include <stdlib.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define VEC3F_X86_DISPATCH
+#endif
+
+#include "vec3farray.h"
+
+using namespace std;
+
+Vec3fArray::Vec3fArray(size_t n) : xs(NULL), ys(NULL), zs(NULL), count(n) {
+	//Padding each stream to 16 floats keeps all three 64 byte aligned
+	size_t padded = (n + 15) & ~(size_t)15;
+	void* p;
+	if (posix_memalign(&p, 64, sizeof(float) * (3 * padded + 16)) == 0) {
+		xs = (float*)p;
+		ys = xs + padded;
+		zs = ys + padded;
+	}
+	else {
+		count = 0;
+	}
+}
+
+Vec3fArray::Vec3fArray(Vec3fArray &&other) :
+	xs(other.xs), ys(other.ys), zs(other.zs), count(other.count) {
+	other.xs = other.ys = other.zs = NULL;
+	other.count = 0;
+}
+
+Vec3fArray &Vec3fArray::operator=(Vec3fArray &&other) {
+	if (this != &other) {
+		free(xs);
+		xs = other.xs;
+		ys = other.ys;
+		zs = other.zs;
+		count = other.count;
+		other.xs = other.ys = other.zs = NULL;
+		other.count = 0;
+	}
+	return *this;
+}
+
+Vec3fArray::~Vec3fArray() {
+	free(xs);
+}
+
+//The kernels all take the arrays' streams and a range [begin, end), so
+//that the SIMD versions can hand their leftovers to the scalar ones.  The
+//scalar versions do each operation the way Vec3f does, and the SIMD ones
+//do them in the same order (and without fused multiply-adds), so all of
+//them round the same.
+namespace {
+	struct Streams {
+		const float* x;
+		const float* y;
+		const float* z;
+
+		Streams(const Vec3fArray &a) : x(a.x()), y(a.y()), z(a.z()) {
+
+		}
+	};
+
+	struct OutStreams {
+		float* x;
+		float* y;
+		float* z;
+
+		OutStreams(Vec3fArray &a) : x(a.x()), y(a.y()), z(a.z()) {
+
+		}
+	};
+
+	void addScalar(Streams a, Streams b, OutStreams out,
+				   size_t begin, size_t end) {
+		for(size_t i = begin; i < end; i++) {
+			out.x[i] = a.x[i] + b.x[i];
+			out.y[i] = a.y[i] + b.y[i];
+			out.z[i] = a.z[i] + b.z[i];
+		}
+	}
+
+	void scaleScalar(Streams a, float scale, OutStreams out,
+					 size_t begin, size_t end) {
+		for(size_t i = begin; i < end; i++) {
+			out.x[i] = a.x[i] * scale;
+			out.y[i] = a.y[i] * scale;
+			out.z[i] = a.z[i] * scale;
+		}
+	}
+
+	void dotScalar(Streams a, Streams b, float* out,
+				   size_t begin, size_t end) {
+		for(size_t i = begin; i < end; i++) {
+			out[i] = a.x[i] * b.x[i] + a.y[i] * b.y[i] + a.z[i] * b.z[i];
+		}
+	}
+
+	void crossScalar(Streams a, Streams b, OutStreams out,
+					 size_t begin, size_t end) {
+		for(size_t i = begin; i < end; i++) {
+			float x = a.y[i] * b.z[i] - a.z[i] * b.y[i];
+			float y = a.z[i] * b.x[i] - a.x[i] * b.z[i];
+			float z = a.x[i] * b.y[i] - a.y[i] * b.x[i];
+			out.x[i] = x;
+			out.y[i] = y;
+			out.z[i] = z;
+		}
+	}
+
+	void normalizeScalar(Streams a, OutStreams out, size_t begin,
+						 size_t end) {
+		for(size_t i = begin; i < end; i++) {
+			float m = sqrtf(a.x[i] * a.x[i] + a.y[i] * a.y[i] +
+							a.z[i] * a.z[i]);
+			out.x[i] = a.x[i] / m;
+			out.y[i] = a.y[i] / m;
+			out.z[i] = a.z[i] / m;
+		}
+	}
+
+	void normalizeFastScalar(Streams a, OutStreams out, size_t begin,
+							 size_t end) {
+		for(size_t i = begin; i < end; i++) {
+			Vec3f v = Vec3f(a.x[i], a.y[i], a.z[i]).normalizeFast();
+			out.x[i] = v[0];
+			out.y[i] = v[1];
+			out.z[i] = v[2];
+		}
+	}
+
+	void transformScalar(const float* m, Streams a, OutStreams out,
+						 size_t begin, size_t end) {
+		for(size_t i = begin; i < end; i++) {
+			float x = m[0] * a.x[i] + m[4] * a.y[i] + m[8] * a.z[i] + m[12];
+			float y = m[1] * a.x[i] + m[5] * a.y[i] + m[9] * a.z[i] + m[13];
+			float z = m[2] * a.x[i] + m[6] * a.y[i] + m[10] * a.z[i] + m[14];
+			out.x[i] = x;
+			out.y[i] = y;
+			out.z[i] = z;
+		}
+	}
+
+#ifdef VEC3F_X86_DISPATCH
+	__attribute__((target("avx2")))
+	void addAVX2(Streams a, Streams b, OutStreams out, size_t begin,
+				 size_t end) {
+		size_t i = begin;
+		for(; i + 8 <= end; i += 8) {
+			_mm256_storeu_ps(out.x + i, _mm256_add_ps(_mm256_loadu_ps(a.x + i),
+													  _mm256_loadu_ps(b.x + i)));
+			_mm256_storeu_ps(out.y + i, _mm256_add_ps(_mm256_loadu_ps(a.y + i),
+													  _mm256_loadu_ps(b.y + i)));
+			_mm256_storeu_ps(out.z + i, _mm256_add_ps(_mm256_loadu_ps(a.z + i),
+													  _mm256_loadu_ps(b.z + i)));
+		}
+		addScalar(a, b, out, i, end);
+	}
+
+	__attribute__((target("avx2")))
+	void scaleAVX2(Streams a, float scale, OutStreams out, size_t begin,
+				   size_t end) {
+		__m256 s = _mm256_set1_ps(scale);
+		size_t i = begin;
+		for(; i + 8 <= end; i += 8) {
+			_mm256_storeu_ps(out.x + i, _mm256_mul_ps(_mm256_loadu_ps(a.x + i), s));
+			_mm256_storeu_ps(out.y + i, _mm256_mul_ps(_mm256_loadu_ps(a.y + i), s));
+			_mm256_storeu_ps(out.z + i, _mm256_mul_ps(_mm256_loadu_ps(a.z + i), s));
+		}
+		scaleScalar(a, scale, out, i, end);
+	}
+
+	__attribute__((target("avx2")))
+	inline __m256 dot8(__m256 ax, __m256 ay, __m256 az,
+					   __m256 bx, __m256 by, __m256 bz) {
+		return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, bx),
+										   _mm256_mul_ps(ay, by)),
+							 _mm256_mul_ps(az, bz));
+	}
+
+	__attribute__((target("avx2")))
+	void dotAVX2(Streams a, Streams b, float* out, size_t begin, size_t end) {
+		size_t i = begin;
+		for(; i + 8 <= end; i += 8) {
+			_mm256_storeu_ps(out + i, dot8(_mm256_loadu_ps(a.x + i),
+										   _mm256_loadu_ps(a.y + i),
+										   _mm256_loadu_ps(a.z + i),
+										   _mm256_loadu_ps(b.x + i),
+										   _mm256_loadu_ps(b.y + i),
+										   _mm256_loadu_ps(b.z + i)));
+		}
+		dotScalar(a, b, out, i, end);
+	}
+
+	__attribute__((target("avx2")))
+	void crossAVX2(Streams a, Streams b, OutStreams out, size_t begin,
+				   size_t end) {
+		size_t i = begin;
+		for(; i + 8 <= end; i += 8) {
+			__m256 ax = _mm256_loadu_ps(a.x + i);
+			__m256 ay = _mm256_loadu_ps(a.y + i);
+			__m256 az = _mm256_loadu_ps(a.z + i);
+			__m256 bx = _mm256_loadu_ps(b.x + i);
+			__m256 by = _mm256_loadu_ps(b.y + i);
+			__m256 bz = _mm256_loadu_ps(b.z + i);
+			_mm256_storeu_ps(out.x + i, _mm256_sub_ps(_mm256_mul_ps(ay, bz),
+													  _mm256_mul_ps(az, by)));
+			_mm256_storeu_ps(out.y + i, _mm256_sub_ps(_mm256_mul_ps(az, bx),
+													  _mm256_mul_ps(ax, bz)));
+			_mm256_storeu_ps(out.z + i, _mm256_sub_ps(_mm256_mul_ps(ax, by),
+													  _mm256_mul_ps(ay, bx)));
+		}
+		crossScalar(a, b, out, i, end);
+	}
+
+	__attribute__((target("avx2")))
+	void normalizeAVX2(Streams a, OutStreams out, size_t begin, size_t end) {
+		size_t i = begin;
+		for(; i + 8 <= end; i += 8) {
+			__m256 x = _mm256_loadu_ps(a.x + i);
+			__m256 y = _mm256_loadu_ps(a.y + i);
+			__m256 z = _mm256_loadu_ps(a.z + i);
+			__m256 m = _mm256_sqrt_ps(dot8(x, y, z, x, y, z));
+			_mm256_storeu_ps(out.x + i, _mm256_div_ps(x, m));
+			_mm256_storeu_ps(out.y + i, _mm256_div_ps(y, m));
+			_mm256_storeu_ps(out.z + i, _mm256_div_ps(z, m));
+		}
+		normalizeScalar(a, out, i, end);
+	}
+
+	__attribute__((target("avx2")))
+	void normalizeFastAVX2(Streams a, OutStreams out, size_t begin,
+						   size_t end) {
+		const __m256 half = _mm256_set1_ps(0.5f);
+		const __m256 threeHalves = _mm256_set1_ps(1.5f);
+		size_t i = begin;
+		for(; i + 8 <= end; i += 8) {
+			__m256 x = _mm256_loadu_ps(a.x + i);
+			__m256 y = _mm256_loadu_ps(a.y + i);
+			__m256 z = _mm256_loadu_ps(a.z + i);
+			__m256 d = dot8(x, y, z, x, y, z);
+			__m256 r = _mm256_rsqrt_ps(d);
+			r = _mm256_mul_ps(r, _mm256_sub_ps(threeHalves,
+				_mm256_mul_ps(_mm256_mul_ps(half, d), _mm256_mul_ps(r, r))));
+			_mm256_storeu_ps(out.x + i, _mm256_mul_ps(x, r));
+			_mm256_storeu_ps(out.y + i, _mm256_mul_ps(y, r));
+			_mm256_storeu_ps(out.z + i, _mm256_mul_ps(z, r));
+		}
+		normalizeFastScalar(a, out, i, end);
+	}
+
+	__attribute__((target("avx2")))
+	inline __m256 row8(const float* m, __m256 x, __m256 y, __m256 z) {
+		return _mm256_add_ps(
+			_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[0]), x),
+										_mm256_mul_ps(_mm256_set1_ps(m[4]), y)),
+						  _mm256_mul_ps(_mm256_set1_ps(m[8]), z)),
+			_mm256_set1_ps(m[12]));
+	}
+
+	__attribute__((target("avx2")))
+	void transformAVX2(const float* m, Streams a, OutStreams out,
+					   size_t begin, size_t end) {
+		size_t i = begin;
+		for(; i + 8 <= end; i += 8) {
+			__m256 x = _mm256_loadu_ps(a.x + i);
+			__m256 y = _mm256_loadu_ps(a.y + i);
+			__m256 z = _mm256_loadu_ps(a.z + i);
+			_mm256_storeu_ps(out.x + i, row8(m, x, y, z));
+			_mm256_storeu_ps(out.y + i, row8(m + 1, x, y, z));
+			_mm256_storeu_ps(out.z + i, row8(m + 2, x, y, z));
+		}
+		transformScalar(m, a, out, i, end);
+	}
+
+	//The AVX-512 versions finish with a masked pass instead of falling back
+	//to scalar code.  GCC lets AVX-512 code use fused multiply-adds, so
+	//contraction is turned off for them to keep the rounding the same.
+	__attribute__((target("avx512f"), optimize("fp-contract=off")))
+	inline __mmask16 tailMask(size_t i, size_t end) {
+		return end - i >= 16 ? (__mmask16)0xffff
+			: (__mmask16)((1u << (end - i)) - 1);
+	}
+
+	__attribute__((target("avx512f"), optimize("fp-contract=off")))
+	void addAVX512(Streams a, Streams b, OutStreams out, size_t begin,
+				   size_t end) {
+		for(size_t i = begin; i < end; i += 16) {
+			__mmask16 k = tailMask(i, end);
+			_mm512_mask_storeu_ps(out.x + i, k,
+				_mm512_add_ps(_mm512_maskz_loadu_ps(k, a.x + i),
+							  _mm512_maskz_loadu_ps(k, b.x + i)));
+			_mm512_mask_storeu_ps(out.y + i, k,
+				_mm512_add_ps(_mm512_maskz_loadu_ps(k, a.y + i),
+							  _mm512_maskz_loadu_ps(k, b.y + i)));
+			_mm512_mask_storeu_ps(out.z + i, k,
+				_mm512_add_ps(_mm512_maskz_loadu_ps(k, a.z + i),
+							  _mm512_maskz_loadu_ps(k, b.z + i)));
+		}
+	}
+
+	__attribute__((target("avx512f"), optimize("fp-contract=off")))
+	void scaleAVX512(Streams a, float scale, OutStreams out, size_t begin,
+					 size_t end) {
+		__m512 s = _mm512_set1_ps(scale);
+		for(size_t i = begin; i < end; i += 16) {
+			__mmask16 k = tailMask(i, end);
+			_mm512_mask_storeu_ps(out.x + i, k,
+				_mm512_mul_ps(_mm512_maskz_loadu_ps(k, a.x + i), s));
+			_mm512_mask_storeu_ps(out.y + i, k,
+				_mm512_mul_ps(_mm512_maskz_loadu_ps(k, a.y + i), s));
+			_mm512_mask_storeu_ps(out.z + i, k,
+				_mm512_mul_ps(_mm512_maskz_loadu_ps(k, a.z + i), s));
+		}
+	}
+
+	__attribute__((target("avx512f"), optimize("fp-contract=off")))
+	inline __m512 dot16(__m512 ax, __m512 ay, __m512 az,
+						__m512 bx, __m512 by, __m512 bz) {
+		return _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(ax, bx),
+										   _mm512_mul_ps(ay, by)),
+							 _mm512_mul_ps(az, bz));
+	}
+
+	__attribute__((target("avx512f"), optimize("fp-contract=off")))
+	void dotAVX512(Streams a, Streams b, float* out, size_t begin,
+				   size_t end) {
+		for(size_t i = begin; i < end; i += 16) {
+			__mmask16 k = tailMask(i, end);
+			_mm512_mask_storeu_ps(out + i, k,
+				dot16(_mm512_maskz_loadu_ps(k, a.x + i),
+					  _mm512_maskz_loadu_ps(k, a.y + i),
+					  _mm512_maskz_loadu_ps(k, a.z + i),
+					  _mm512_maskz_loadu_ps(k, b.x + i),
+					  _mm512_maskz_loadu_ps(k, b.y + i),
+					  _mm512_maskz_loadu_ps(k, b.z + i)));
+		}
+	}
+
+	__attribute__((target("avx512f"), optimize("fp-contract=off")))
+	void crossAVX512(Streams a, Streams b, OutStreams out, size_t begin,
+					 size_t end) {
+		for(size_t i = begin; i < end; i += 16) {
+			__mmask16 k = tailMask(i, end);
+			__m512 ax = _mm512_maskz_loadu_ps(k, a.x + i);
+			__m512 ay = _mm512_maskz_loadu_ps(k, a.y + i);
+			__m512 az = _mm512_maskz_loadu_ps(k, a.z + i);
+			__m512 bx = _mm512_maskz_loadu_ps(k, b.x + i);
+			__m512 by = _mm512_maskz_loadu_ps(k, b.y + i);
+			__m512 bz = _mm512_maskz_loadu_ps(k, b.z + i);
+			_mm512_mask_storeu_ps(out.x + i, k,
+				_mm512_sub_ps(_mm512_mul_ps(ay, bz), _mm512_mul_ps(az, by)));
+			_mm512_mask_storeu_ps(out.y + i, k,
+				_mm512_sub_ps(_mm512_mul_ps(az, bx), _mm512_mul_ps(ax, bz)));
+			_mm512_mask_storeu_ps(out.z + i, k,
+				_mm512_sub_ps(_mm512_mul_ps(ax, by), _mm512_mul_ps(ay, bx)));
+		}
+	}
+
+	__attribute__((target("avx512f"), optimize("fp-contract=off")))
+	void normalizeAVX512(Streams a, OutStreams out, size_t begin,
+						 size_t end) {
+		for(size_t i = begin; i < end; i += 16) {
+			__mmask16 k = tailMask(i, end);
+			__m512 x = _mm512_maskz_loadu_ps(k, a.x + i);
+			__m512 y = _mm512_maskz_loadu_ps(k, a.y + i);
+			__m512 z = _mm512_maskz_loadu_ps(k, a.z + i);
+			__m512 m = _mm512_maskz_sqrt_ps(k, dot16(x, y, z, x, y, z));
+			_mm512_mask_storeu_ps(out.x + i, k, _mm512_div_ps(x, m));
+			_mm512_mask_storeu_ps(out.y + i, k, _mm512_div_ps(y, m));
+			_mm512_mask_storeu_ps(out.z + i, k, _mm512_div_ps(z, m));
+		}
+	}
+
+	__attribute__((target("avx512f"), optimize("fp-contract=off")))
+	void normalizeFastAVX512(Streams a, OutStreams out, size_t begin,
+							 size_t end) {
+		const __m512 half = _mm512_set1_ps(0.5f);
+		const __m512 threeHalves = _mm512_set1_ps(1.5f);
+		for(size_t i = begin; i < end; i += 16) {
+			__mmask16 k = tailMask(i, end);
+			__m512 x = _mm512_maskz_loadu_ps(k, a.x + i);
+			__m512 y = _mm512_maskz_loadu_ps(k, a.y + i);
+			__m512 z = _mm512_maskz_loadu_ps(k, a.z + i);
+			__m512 d = dot16(x, y, z, x, y, z);
+			__m512 r = _mm512_maskz_rsqrt14_ps(k, d);
+			r = _mm512_mul_ps(r, _mm512_sub_ps(threeHalves,
+				_mm512_mul_ps(_mm512_mul_ps(half, d), _mm512_mul_ps(r, r))));
+			_mm512_mask_storeu_ps(out.x + i, k, _mm512_mul_ps(x, r));
+			_mm512_mask_storeu_ps(out.y + i, k, _mm512_mul_ps(y, r));
+			_mm512_mask_storeu_ps(out.z + i, k, _mm512_mul_ps(z, r));
+		}
+	}
+
+	__attribute__((target("avx512f"), optimize("fp-contract=off")))
+	inline __m512 row16(const float* m, __m512 x, __m512 y, __m512 z) {
+		return _mm512_add_ps(
+			_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(_mm512_set1_ps(m[0]), x),
+										_mm512_mul_ps(_mm512_set1_ps(m[4]), y)),
+						  _mm512_mul_ps(_mm512_set1_ps(m[8]), z)),
+			_mm512_set1_ps(m[12]));
+	}
+
+	__attribute__((target("avx512f"), optimize("fp-contract=off")))
+	void transformAVX512(const float* m, Streams a, OutStreams out,
+						 size_t begin, size_t end) {
+		for(size_t i = begin; i < end; i += 16) {
+			__mmask16 k = tailMask(i, end);
+			__m512 x = _mm512_maskz_loadu_ps(k, a.x + i);
+			__m512 y = _mm512_maskz_loadu_ps(k, a.y + i);
+			__m512 z = _mm512_maskz_loadu_ps(k, a.z + i);
+			_mm512_mask_storeu_ps(out.x + i, k, row16(m, x, y, z));
+			_mm512_mask_storeu_ps(out.y + i, k, row16(m + 1, x, y, z));
+			_mm512_mask_storeu_ps(out.z + i, k, row16(m + 2, x, y, z));
+		}
+	}
+#endif
+
+	//The versions of the kernels the CPU runs best
+	struct Vec3fKernels {
+		void (*add)(Streams, Streams, OutStreams, size_t, size_t);
+		void (*scale)(Streams, float, OutStreams, size_t, size_t);
+		void (*dot)(Streams, Streams, float*, size_t, size_t);
+		void (*cross)(Streams, Streams, OutStreams, size_t, size_t);
+		void (*normalize)(Streams, OutStreams, size_t, size_t);
+		void (*normalizeFast)(Streams, OutStreams, size_t, size_t);
+		void (*transform)(const float*, Streams, OutStreams, size_t, size_t);
+	};
+
+	Vec3fKernels chooseVec3fKernels() {
+		Vec3fKernels k = {addScalar, scaleScalar, dotScalar, crossScalar,
+						  normalizeScalar, normalizeFastScalar,
+						  transformScalar};
+#ifdef VEC3F_X86_DISPATCH
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f")) {
+			Vec3fKernels avx512 = {addAVX512, scaleAVX512, dotAVX512,
+								   crossAVX512, normalizeAVX512,
+								   normalizeFastAVX512, transformAVX512};
+			k = avx512;
+		}
+		else if (__builtin_cpu_supports("avx2")) {
+			Vec3fKernels avx2 = {addAVX2, scaleAVX2, dotAVX2, crossAVX2,
+								 normalizeAVX2, normalizeFastAVX2,
+								 transformAVX2};
+			k = avx2;
+		}
+#endif
+		return k;
+	}
+
+	const Vec3fKernels &vec3fKernels() {
+		static const Vec3fKernels kernels = chooseVec3fKernels();
+		return kernels;
+	}
+}
+
+void addVec3f(const Vec3fArray &a, const Vec3fArray &b, Vec3fArray &out) {
+	vec3fKernels().add(a, b, out, 0, out.size());
+}
+
+void scaleVec3f(const Vec3fArray &a, float scale, Vec3fArray &out) {
+	vec3fKernels().scale(a, scale, out, 0, out.size());
+}
+
+void dotVec3f(const Vec3fArray &a, const Vec3fArray &b, float* out,
+			  size_t count) {
+	vec3fKernels().dot(a, b, out, 0, count);
+}
+
+void crossVec3f(const Vec3fArray &a, const Vec3fArray &b, Vec3fArray &out) {
+	vec3fKernels().cross(a, b, out, 0, out.size());
+}
+
+void normalizeVec3f(const Vec3fArray &a, Vec3fArray &out) {
+#ifdef VEC3F_FAST_NORMALIZE
+	vec3fKernels().normalizeFast(a, out, 0, out.size());
+#else
+	vec3fKernels().normalize(a, out, 0, out.size());
+#endif
+}
+
+void normalizeFastVec3f(const Vec3fArray &a, Vec3fArray &out) {
+	vec3fKernels().normalizeFast(a, out, 0, out.size());
+}
+
+void transformVec3f(const float* matrix, const Vec3fArray &a,
+					Vec3fArray &out) {
+	vec3fKernels().transform(matrix, a, out, 0, out.size());
+}
@@ -0,0 +1,107 @@
+#ifndef VEC3FARRAY_H_INCLUDED
+#define VEC3FARRAY_H_INCLUDED
+
+#include <stddef.h>
+#include "vec3f.h"
+
+//A batch of vectors stored as structure of arrays: all the x's, then all
+//the y's, then all the z's, each 64 byte aligned and padded to a multiple
+//of 16 floats, so that the batch kernels below can work on 8 or 16 vectors
+//at a time.  Like Image, a Vec3fArray can be moved but not copied.
+class Vec3fArray {
+	private:
+		float* xs;
+		float* ys;
+		float* zs;
+		size_t count;
+
+		Vec3fArray(const Vec3fArray &other);
+		Vec3fArray &operator=(const Vec3fArray &other);
+	public:
+		//Makes an array of n vectors, with uninitialized components
+		explicit Vec3fArray(size_t n = 0);
+		Vec3fArray(Vec3fArray &&other);
+		Vec3fArray &operator=(Vec3fArray &&other);
+		~Vec3fArray();
+
+		size_t size() const {
+			return count;
+		}
+
+		float* x() {
+			return xs;
+		}
+
+		float* y() {
+			return ys;
+		}
+
+		float* z() {
+			return zs;
+		}
+
+		const float* x() const {
+			return xs;
+		}
+
+		const float* y() const {
+			return ys;
+		}
+
+		const float* z() const {
+			return zs;
+		}
+
+		Vec3f get(size_t i) const {
+			return Vec3f(xs[i], ys[i], zs[i]);
+		}
+
+		void set(size_t i, const Vec3f &v) {
+			xs[i] = v[0];
+			ys[i] = v[1];
+			zs[i] = v[2];
+		}
+};
+
+//Batch kernels.  Each works on the first out.size() vectors, which the
+//inputs must have at least, and may write to one of its inputs.  They use
+//AVX-512 or AVX2 where the CPU has them, chosen at run time, and give
+//exactly the same results as the matching Vec3f operations one vector at a
+//time.
+
+//out[i] = a[i] + b[i]
+void addVec3f(const Vec3fArray &a, const Vec3fArray &b, Vec3fArray &out);
+
+//out[i] = a[i] * scale
+void scaleVec3f(const Vec3fArray &a, float scale, Vec3fArray &out);
+
+//out[i] = a[i].dot(b[i]), for i < count
+void dotVec3f(const Vec3fArray &a, const Vec3fArray &b, float* out,
+			  size_t count);
+
+//out[i] = a[i].cross(b[i])
+void crossVec3f(const Vec3fArray &a, const Vec3fArray &b, Vec3fArray &out);
+
+//out[i] = a[i].normalize()
+void normalizeVec3f(const Vec3fArray &a, Vec3fArray &out);
+
+//out[i] = a[i].normalizeFast(), give or take: the AVX2 and AVX-512
+//versions start from different reciprocal square root estimates, so the
+//last bit or two can vary between CPUs
+void normalizeFastVec3f(const Vec3fArray &a, Vec3fArray &out);
+
+//Transforms the points a[i] (with w = 1) by matrix, which is 4x4 and
+//column major, the way OpenGL stores matrices, and drops the resulting w
+void transformVec3f(const float* matrix, const Vec3fArray &a,
+					Vec3fArray &out);
+
+
+
+
+
+
+
+
+
+
+#endif